@@ -1,6 +1,16 @@
 #include <os2var2_common.h>
+#include <buffer_pool.h>
+#include <compression.h>
+#include <crc32c.h>
+#include <delta.h>
+#include <file_source.h>
+#include <mapped_file.h>
+#include <payload.h>
+#include <resume_journal.h>
+#include <sweep.h>
 
 #include <array>
+#include <atomic>
 #include <string>
 #include <optional>
 #include <fstream>
@@ -18,25 +28,11 @@ struct ClientConfig
 
         auto clientConfigJson = nlohmann::json{};
 
-        auto confgFile = std::ifstream{ configName };
-
-        bResult &= confgFile.is_open();
+        bResult &= parse_mapped_file(configName, clientConfigJson);
 
         if(bResult)
         {
-            confgFile >> clientConfigJson;
-
-            if (confgFile.fail())
-                return false;
-
-            bResult &= JSON_GET_AND_PARSE(clientConfigJson, server_ip, is_string);
-            bResult &= JSON_GET_AND_PARSE(clientConfigJson, server_port, is_string);
-            bResult &= JSON_GET_AND_PARSE(clientConfigJson, package_size, is_number_unsigned);
-            bResult &= JSON_GET_AND_PARSE(clientConfigJson, timeout, is_array);
-            bResult &= JSON_GET_AND_PARSE(clientConfigJson, file_name, is_string);
-            bResult &= JSON_GET_AND_PARSE(clientConfigJson, apply_socket_timeout, is_boolean);
-            bResult &= JSON_GET_AND_PARSE(clientConfigJson, apply_select_timeout, is_boolean);
-            bResult &= JSON_GET_AND_PARSE(clientConfigJson, number_of_tries, is_number_unsigned);
+            bResult &= codec_from_json(clientConfigJson, *this);
         }
 
         return bResult;
@@ -44,28 +40,7 @@ struct ClientConfig
 
     bool serialize(std::string const& configName)
     {
-        auto bResult = true;
-
-        auto confgFile = std::ofstream{ configName };
-
-        bResult &= confgFile.is_open();
-
-        if (bResult)
-        {
-            confgFile << nlohmann::json
-                    {
-                        {"server_ip"            , server_ip           },
-                        {"server_port"          , server_port         },
-                        {"package_size"         , package_size        },
-                        {"timeout"              , timeout             },
-                        {"file_name"            , file_name           },
-                        {"apply_socket_timeout" , apply_socket_timeout},
-                        {"apply_select_timeout" , apply_select_timeout},
-                        {"number_of_tries"      , number_of_tries     }
-                    };
-        }
-
-        return bResult;
+        return dump_json_file(configName, codec_to_json(*this));
     }
 
     std::string                server_ip;
@@ -76,48 +51,53 @@ struct ClientConfig
     bool                       apply_socket_timeout;
     bool                       apply_select_timeout;
     std::uint32_t              number_of_tries;
-};
-
-int main(int argc, char **argv)
-{
-    auto const clientConfig = []()
+    double                     target_ci = 0.0;   // optional, turns number_of_tries into an upper bound
+    std::uint32_t              min_tries = 2;
+    std::optional<SweepGrid>   sweep;
+    bool                       huge_pages = false;   // optional, back the send buffer pool with huge pages
+    std::uint32_t              read_ahead_buffers = 0;   // optional, stream file_name through this many pool chunks instead of mapping it
+    std::string                payload = "file";         // optional, "zeros" | "pattern" | "xoshiro" send generated data instead of file_name
+    std::int64_t               payload_size = 0;         // optional, bytes per generated file
+    std::uint64_t              payload_seed = 0;         // optional, xoshiro seed
+    std::string                payload_pattern;          // optional, bytes repeated by "pattern"
+    bool                       digest = true;            // optional, send a CRC32C trailer after every file for the server to check
+    std::string                transfer_id;              // optional, makes the session resumable under this ID
+    std::uint32_t              resume_attempts = 3;      // optional, reconnects after a dropped resumable session
+    bool                       delta = false;            // optional, send only what changed against the server's previous out_ file
+    bool                       compression = false;      // optional, LZ4 compress the blocks of every file that compress well enough to pay off
+    std::string                psk;                      // optional, 64 hex digits shared with the server, encrypts the session
+
+    static constexpr auto fields()
     {
-        auto const configName = std::string{"config_client.json"};
-
-        auto config = std::optional<ClientConfig>{ ClientConfig{} };
-        if (!config->deserialize(configName)) {
-            config->server_ip = "localhost";
-            config->server_port = "9999";
-            config->package_size = 16;
-            config->timeout = { 25, 50, 75 };
-            config->file_name = "in.dat";
-            config->apply_socket_timeout = true;
-            config->apply_select_timeout = true;
-            config->number_of_tries = 1;
-            config->serialize(configName);
-
-            print_std("Generated default config: ", configName);
-            config = std::nullopt;
-        }
-
-        return config;
-    } ();
-
-    if(!clientConfig.has_value())
-        return 0;
-
-    // Initialize Winsock
-    auto const wsaData = createWSADataRaii();
-    if (!wsaData) {
-        print_err("WSAStartup failed");
-        return 1;
+        return std::make_tuple(
+                codec_field   ("server_ip"           , &ClientConfig::server_ip           ),
+                codec_field   ("server_port"         , &ClientConfig::server_port         ),
+                codec_field   ("package_size"        , &ClientConfig::package_size        ),
+                codec_field   ("timeout"             , &ClientConfig::timeout             ),
+                codec_field   ("file_name"           , &ClientConfig::file_name           ),
+                codec_field   ("apply_socket_timeout", &ClientConfig::apply_socket_timeout),
+                codec_field   ("apply_select_timeout", &ClientConfig::apply_select_timeout),
+                codec_field   ("number_of_tries"     , &ClientConfig::number_of_tries     ),
+                codec_optional("target_ci"           , &ClientConfig::target_ci           ),
+                codec_optional("min_tries"           , &ClientConfig::min_tries           ),
+                codec_optional("sweep"               , &ClientConfig::sweep               ),
+                codec_optional("huge_pages"          , &ClientConfig::huge_pages          ),
+                codec_optional("read_ahead_buffers"  , &ClientConfig::read_ahead_buffers  ),
+                codec_optional("payload"             , &ClientConfig::payload             ),
+                codec_optional("payload_size"        , &ClientConfig::payload_size        ),
+                codec_optional("payload_seed"        , &ClientConfig::payload_seed        ),
+                codec_optional("payload_pattern"     , &ClientConfig::payload_pattern     ),
+                codec_optional("digest"              , &ClientConfig::digest              ),
+                codec_optional("transfer_id"         , &ClientConfig::transfer_id         ),
+                codec_optional("resume_attempts"     , &ClientConfig::resume_attempts     ),
+                codec_optional("delta"               , &ClientConfig::delta               ),
+                codec_optional("compression"         , &ClientConfig::compression         ),
+                codec_optional("psk"                 , &ClientConfig::psk                 ));
     }
+};
 
-    print_std("using config:");
-    print_std("server_ip:    ", clientConfig->server_ip);
-    print_std("server_port:  ", clientConfig->server_port);
-    print_std("package_size: ", clientConfig->package_size);
-
+Connection connect_to_server(std::string const& serverIp, std::string const& serverPort)
+{
     auto const hints = []()
     {
         auto _hints = addrinfo{};
@@ -129,87 +109,140 @@ int main(int argc, char **argv)
         return _hints;
     } ();
 
-    // Resolve the server address and port
+    auto connection = Connection{};
 
-    auto const serverAddrinfo = getaddrinfoRaii(clientConfig->server_ip.c_str(), clientConfig->server_port.c_str(), &hints);
+    // Resolve the server address and port
+    auto const serverAddrinfo = getaddrinfoRaii(serverIp.c_str(), serverPort.c_str(), &hints);
     if (!serverAddrinfo) {
         print_err("getaddrinfo failed: ");
-        return 1;
+        return connection;
     }
 
-    auto connection = [&serverAddrinfo]()
+    // Attempt to connect to an address until one succeeds
+    for (addrinfo* ptr = serverAddrinfo.get(); ptr != nullptr; ptr = ptr->ai_next)
     {
-        auto _connection = Connection{};
 
-        // Attempt to connect to an address until one succeeds
-        for (addrinfo* ptr = serverAddrinfo.get(); ptr != nullptr; ptr = ptr->ai_next)
+        // Create a SOCKET for connecting to server
+        connection.setSocket(socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol));
+        if (!connection.is_valid()) {
+            print_err("createSocket failed with error: ", WSAGetLastError());
+            break;
+        }
+
+        // Connect to server.
+        connection.connect(*ptr);
+        if (connection.is_socket_error())
         {
+            connection.reset();
+            continue;
+        }
 
-            // Create a SOCKET for connecting to server
-            _connection.setSocket(socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol));
-            if (!_connection.is_valid()) {
-                print_err("createSocket failed with error: ", WSAGetLastError());
-                break;
-            }
+        return connection;
+    }
 
-            // Connect to server.
-            _connection.connect(*ptr);
-            if (_connection.is_socket_error())
-            {
-                _connection.reset();
-                continue;
-            }
+    connection.reset();
+    return connection;
+}
 
-            return _connection;
-        }
+FileProcessConfig make_file_process_config(ClientConfig const& clientConfig)
+{
+    auto fileProcessConfig = FileProcessConfig{};
+    fileProcessConfig.timeouts = clientConfig.timeout.size();
+    fileProcessConfig.package_size = clientConfig.package_size;
+    fileProcessConfig.file_name = clientConfig.file_name;
+    fileProcessConfig.target_ci = clientConfig.target_ci;
+    fileProcessConfig.min_tries = clientConfig.min_tries;
+    fileProcessConfig.payload = clientConfig.payload;
+    fileProcessConfig.payload_seed = clientConfig.payload_seed;
+    fileProcessConfig.payload_pattern = clientConfig.payload_pattern;
+    fileProcessConfig.digest = clientConfig.digest;
+    fileProcessConfig.transfer_id = clientConfig.transfer_id;
+    fileProcessConfig.delta = clientConfig.delta;
+    fileProcessConfig.compression = clientConfig.compression;
+
+    return fileProcessConfig;
+}
 
-        _connection.reset();
-        return _connection;
-    } ();
+// Runs every try of every timeout over an established connection.
+// With fileProcessConfig.report_times the server's recv time of each file is collected into recvTimes.
+int run_session(Connection& connection
+                , ClientConfig const& clientConfig
+                , FileProcessConfig const& fileProcessConfig
+                , std::vector<std::int64_t>& recvTimes
+                , BufferPool& bufferPool)
+{
+    // Mapped once and sent straight from the mapping on every try, or streamed with read-ahead
+    auto fileSource = FileSource{ bufferPool, clientConfig.read_ahead_buffers };
 
-    if (!connection.is_valid()) {
-        print_err("Unable to connect to server");
-        return 1;
+    // Generated payloads never touch the disk, the server regenerates and compares them
+    auto payloadSource = std::optional<PayloadSource>{};
+    if (auto payloadKind = PayloadKind::file; payload_kind(clientConfig.payload, payloadKind) && payloadKind != PayloadKind::file)
+    {
+        payloadSource.emplace(bufferPool, PayloadGenerator{ payloadKind, clientConfig.payload_seed, clientConfig.payload_pattern }, clientConfig.payload_size);
+    }
+
+    // Everything after the salts, the handshake included, travels in records
+    if (!clientConfig.psk.empty())
+    {
+        auto psk = ChaCha20Poly1305::Key{};
+        if (!parse_psk(clientConfig.psk, psk) || !secure_connection(connection, psk, true)) {
+            print_err("Failed to set up encryption: ", WSAGetLastError());
+            return 1;
+        }
     }
-    print_std("Connected successfully");
 
-    // Buffer for Recieving/Sending data
-    auto buffer = std::vector<char>(clientConfig->package_size);
+    // Its ratio and speed estimates carry over from file to file
+    auto compressor = std::optional<BlockCompressor>{};
+    if (fileProcessConfig.compression)
+        compressor.emplace();
 
     {
-        auto fileProcessConfig = FileProcessConfig{};
-        fileProcessConfig.timeouts = clientConfig->timeout.size();
-        fileProcessConfig.package_size = clientConfig->package_size;
-        fileProcessConfig.file_name = clientConfig->file_name;
+        auto const strFileProcessConfig = codec_to_json(fileProcessConfig).dump();
 
-        auto const strFileProcessConfig = nlohmann::json
-            {
-                {"timeouts"      , fileProcessConfig.timeouts      },
-                {"package_size"  , fileProcessConfig.package_size  },
-                {"file_name"     , fileProcessConfig.file_name     },
-            }.dump();
-
-        // Send number of timeouts to server
-        auto const nSize = static_cast<std::uint32_t>(strFileProcessConfig.size());
-        connection.send_val(nSize);
-        connection.send(strFileProcessConfig.data(), nSize);
+        // Send the handshake, no length prefix: the server's push parser finds the end of the object
+        connection.send(strFileProcessConfig.data(), static_cast<int>(strFileProcessConfig.size()));
         if (connection.is_socket_error()) {
             print_err("Failed to send number of timeouts to server with error: ", WSAGetLastError());
             return 1;
         }
     }
 
-//    connection.setsockopt(SOL_SOCKET, SO_SNDBUF, static_cast<int>(clientConfig->package_size));
+    if (fileProcessConfig.buffer_size)
+    {
+        connection.setsockopt(SOL_SOCKET, SO_SNDBUF, static_cast<int>(fileProcessConfig.buffer_size));
+    }
 
     auto const defaultSendTime = static_cast<int>( std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::seconds{30}).count() );
 
-    connection.send_val(clientConfig->number_of_tries);
-    auto const nTries = clientConfig->number_of_tries;
-    for(int nTry = 0; nTry < nTries; ++nTry)
+    // A resumable session continues at the file the server's journal stopped at
+    auto const bResumable = !fileProcessConfig.transfer_id.empty();
+    auto nResumeTry = std::uint32_t{ 0 };
+    auto nResumeFile = std::uint32_t{ 0 };
+    if (bResumable)
+    {
+        nResumeTry = connection.recv_val<std::uint32_t>(MSG_WAITALL);
+        nResumeFile = connection.recv_val<std::uint32_t>(MSG_WAITALL);
+        if (connection.getResult() != static_cast<int>(sizeof(nResumeFile))) {
+            print_err("Failed to receive resume point from server with error: ", WSAGetLastError());
+            return 1;
+        }
+        if (nResumeTry > 0 || nResumeFile > 0)
+            print_std(":: resuming at try: ", nResumeTry, ", file: ", nResumeFile);
+    }
+
+    connection.send_val(clientConfig.number_of_tries);
+    auto const nTries = clientConfig.number_of_tries;
+    for(int nTry = static_cast<int>(nResumeTry); nTry < nTries; ++nTry)
     {
         auto nFileCounter = std::uint32_t{ 0 };
-        for (auto const& nTimeout : clientConfig->timeout)
+        for (auto const& nTimeout : clientConfig.timeout)
         {
+            if (nTry == static_cast<int>(nResumeTry) && nFileCounter < nResumeFile)
+            {
+                ++nFileCounter;
+                continue;
+            }
+
             auto tv = [&]()
             {
                 auto _tv = timeval{};
@@ -229,18 +262,13 @@ int main(int argc, char **argv)
 
             auto const nFileSize = [&]()
             {
-                auto fin = std::ifstream{ clientConfig->file_name, std::ios::binary };
-                if (!fin) {
-                    print_err("Failed to open file: ", clientConfig->file_name);
+                // Remapped only when the file's size or mtime changed since the last iteration
+                if (!(payloadSource ? payloadSource->open() : fileSource.open(clientConfig.file_name))) {
+                    print_err("Failed to open file: ", clientConfig.file_name);
                     return std::int64_t{-1};
                 }
 
-                fin.seekg(0, std::ios::end);
-                auto const _nFileSize = std::int64_t{ fin.tellg() };
-                fin.seekg(0, std::ios::beg);
-
-                buffer.resize(_nFileSize);
-                fin.read(buffer.data(), _nFileSize);
+                auto const _nFileSize = payloadSource ? payloadSource->size() : fileSource.size();
 
                 // Send timeout to server
                 connection.send_val(_nFileSize);
@@ -250,22 +278,102 @@ int main(int argc, char **argv)
             if(nFileSize == -1)
                 return 1;
 
-            print_std(":: try: ", nTry, ", file: ", std::to_string(nFileCounter), " - ", clientConfig->file_name, ", file size: ",  nFileSize, " bytes", ", timeout: ", nTimeout);
+            // Per file flag: the file follows as frames; empty files have none
+            auto const bCompressed = compressor && nFileSize > 0;
+            if (compressor)
+            {
+                connection.send_val(static_cast<std::uint8_t>(bCompressed));
+                if (bCompressed)
+                    compressor->start(nFileSize);
+            }
+
+            // Resumable sessions send only what the server does not have yet
+            auto ranges = ByteRanges{ nFileSize };
+            if (bResumable && !ranges.recv(connection, nFileSize)) {
+                print_err("Failed to receive missing ranges from server with error: ", WSAGetLastError());
+                return 1;
+            }
+
+            // Delta sessions send copy and literal records against the server's block signatures
+            // instead of the file; the stream is built before the timed transfer
+            auto deltaStream = std::vector<char>{};
+            auto bDelta = false;
+            if (fileProcessConfig.delta)
+            {
+                auto signatures = DeltaSignatures{};
+                if (!signatures.recv(connection)) {
+                    print_err("Failed to receive block signatures from server with error: ", WSAGetLastError());
+                    return 1;
+                }
+
+                // A streamed file is never whole in memory, it goes out as is
+                if (!signatures.empty() && fileSource.is_mapped())
+                {
+                    auto stats = DeltaEncoder::Stats{};
+                    deltaStream = DeltaEncoder{ signatures }.encode(fileSource.slice(0, nFileSize).first, nFileSize, stats);
+                    bDelta = true;
+                    print_std(":: delta: ", stats.nCopiedBytes, " bytes copied, ", stats.nLiteralBytes, " literal, ", deltaStream.size(), " to send");
+                }
+
+                connection.send_val(bDelta ? static_cast<std::int64_t>(deltaStream.size()) : std::int64_t{ -1 });
+                if (connection.is_socket_error()) {
+                    print_err("Failed to send delta size to server with error: ", WSAGetLastError());
+                    return 1;
+                }
+                if (bDelta)
+                    ranges = ByteRanges{ static_cast<std::int64_t>(deltaStream.size()) };
+            }
+
+            print_std(":: try: ", nTry, ", file: ", std::to_string(nFileCounter), " - ", clientConfig.file_name, ", file size: ",  nFileSize, " bytes", ", timeout: ", nTimeout);
 
 
             {
-                if(clientConfig->apply_socket_timeout)
+                if(clientConfig.apply_socket_timeout)
                 {
                     connection.setsockopt(SOL_SOCKET, SO_SNDTIMEO, static_cast<int>(nTimeout));
                 }
 
                 auto nCurFileSize = std::int64_t{ 0 };
+                auto bDropped = false;
+                auto const nCryptoTimeBefore = connection.crypto_time();
+
+                auto const source = [&](std::int64_t nOffset, std::int64_t nMax)
+                {
+                    return payloadSource ? payloadSource->slice(nOffset, nMax) : fileSource.slice(nOffset, nMax);
+                };
+
+                // The digest covers the file itself, front to back, whatever goes on the wire.
+                // Bytes are hashed as they pass by; ranges the server already has are read for it.
+                auto crc = Crc32c{};
+                auto nDigested = std::int64_t{ 0 };
+                auto const digestTo = [&](std::int64_t nOffset)
+                {
+                    while (fileProcessConfig.digest && nDigested < nOffset)
+                    {
+                        auto const slice = source(nDigested, nOffset - nDigested);
+                        if (slice.second <= 0)
+                            return false;
+                        crc.update(slice.first, static_cast<std::size_t>(slice.second));
+                        nDigested += slice.second;
+                    }
+                    return true;
+                };
+                auto const digestedSource = [&](std::int64_t nOffset, std::int64_t nMax)
+                {
+                    auto const slice = source(nOffset, nMax);
+                    if (fileProcessConfig.digest && nOffset == nDigested && slice.second > 0)
+                    {
+                        crc.update(slice.first, static_cast<std::size_t>(slice.second));
+                        nDigested += slice.second;
+                    }
+                    return slice;
+                };
 
-                while (nCurFileSize < nFileSize)
+                while (bCompressed ? !compressor->finished() : nCurFileSize < ranges.total())
                 {
                     auto const iRet = [&]()
                     {
-                        if(clientConfig->apply_select_timeout)
+                        if(clientConfig.apply_select_timeout)
                         {
                             fd_set fdWrite;
                             FD_ZERO(&fdWrite);
@@ -280,42 +388,121 @@ int main(int argc, char **argv)
 
                     if(iRet > 0)
                     {
-                        auto const nBytesReed = std::min<std::int64_t>(clientConfig->package_size, nFileSize - nCurFileSize);
+                        auto const location = ranges.locate(nCurFileSize);
+                        auto const nMax = std::min<std::int64_t>(clientConfig.package_size, location.second);
+                        auto const bPlain = !bCompressed && !bDelta;
+                        auto const slice = bCompressed
+                                ? compressor->pending(clientConfig.package_size, digestedSource)
+                                : bDelta
+                                ? std::pair<char const*, std::int64_t>{ deltaStream.data() + location.first, nMax }
+                                : digestTo(location.first)
+                                ? source(location.first, nMax)
+                                : std::pair<char const*, std::int64_t>{ nullptr, 0 };
+                        if (slice.second <= 0) {
+                            print_err("Failed to read file: ", clientConfig.file_name);
+                            return 1;
+                        }
 
-                        connection.send(buffer.data(), nBytesReed);
+                        connection.send(slice.first, static_cast<int>(slice.second));
 
-                        if(!connection.is_socket_error())
+                        if(connection.getResult() > 0)
                         {
+                            // Only what actually went out, the rest of the slice is sent again
+                            if (fileProcessConfig.digest && bPlain)
+                            {
+                                crc.update(slice.first, static_cast<std::size_t>(connection.getResult()));
+                                nDigested += connection.getResult();
+                            }
+                            if (bCompressed)
+                                compressor->consume(connection.getResult());
                             nCurFileSize += connection.getResult();
                         }
                         else
                         {
+                            // Nothing went out, the server is gone whether or not it was an error
+                            bDropped = true;
                             break;
                         }
                     }
                 }
 
-                if(clientConfig->apply_socket_timeout && !connection.is_socket_error())
+                if(clientConfig.apply_socket_timeout && !bDropped)
                 {
                     connection.setsockopt(SOL_SOCKET, SO_SNDTIMEO, defaultSendTime);
                 }
 
                 print_std("-- Sent: ", nCurFileSize, " bytes");
+                if (connection.is_secure())
+                {
+                    print_std("-- Encryption: ", connection.crypto_time() - nCryptoTimeBefore, " us");
+                }
+                if (bCompressed)
+                {
+                    auto const& stats = compressor->stats();
+                    print_std("-- Compression: ", stats.nRawBytes, " -> ", stats.nWireBytes, " bytes, ratio ",
+                              static_cast<double>(stats.nWireBytes) / static_cast<double>(std::max<std::int64_t>(stats.nRawBytes, 1)),
+                              ", ", stats.nCompressedBlocks, " of ", stats.nBlocks, " blocks compressed, codec time ", stats.nCodecTime, " us");
+                }
                 print_std("---------------");
                 print_std();
 
-                if(!connection.is_socket_error())
+                if(!bDropped)
                 {
                     print_std("!! File sent successfully");
                 }
+                else if (bResumable)
+                {
+                    print_err("Connection lost, the session can be resumed with transfer_id ", fileProcessConfig.transfer_id);
+                    return 1;
+                }
                 else
                 {
                     break;
                 }
+
+                if (fileProcessConfig.digest)
+                {
+                    // A delta or a resumed file leaves parts of the file unread so far
+                    if (!digestTo(nFileSize)) {
+                        print_err("Failed to read file: ", clientConfig.file_name);
+                        return 1;
+                    }
+
+                    connection.send_val(crc.value());
+                    if (connection.is_socket_error()) {
+                        print_err("Failed to send file digest to server with error: ", WSAGetLastError());
+                        return 1;
+                    }
+                }
+            }
+
+            if (fileProcessConfig.report_times)
+            {
+                auto const nRecvTime = connection.recv_val<std::int64_t>();
+                if (connection.getResult() <= 0) {
+                    print_err("Failed to receive recv time from server with error: ", WSAGetLastError());
+                    return 1;
+                }
+                recvTimes.push_back(nRecvTime);
             }
 
             ++nFileCounter;
         }
+
+        if (fileProcessConfig.target_ci > 0.0)
+        {
+            // Server decides after every try whether the confidence target is reached
+            auto const nStop = connection.recv_val<std::uint8_t>();
+            if (connection.getResult() <= 0) {
+                print_err("Failed to receive stop flag from server with error: ", WSAGetLastError());
+                return 1;
+            }
+            if (nStop != 0)
+            {
+                print_std(":: confidence target reached after ", nTry + 1, " tries");
+                break;
+            }
+        }
     }
 
 
@@ -331,9 +518,10 @@ int main(int argc, char **argv)
     }
 
     // Receive until the peer closes the connection
+    auto drain = std::array<char, 1024>{};
     do
     {
-        connection.recv(buffer.data(), buffer.size());
+        connection.recv(drain.data(), static_cast<int>(drain.size()));
 
         if (connection.getResult() > 0)
             print_std("Bytes received: ", connection.getResult());
@@ -345,3 +533,219 @@ int main(int argc, char **argv)
 
     return 0;
 }
+
+// Every cell of the grid is one session: lane i connects to server_port + i,
+// so one server instance per lane has to be running with number_of_sessions = 0.
+int run_sweep(ClientConfig const& clientConfig, BufferPool& bufferPool)
+{
+    auto const& sweep = *clientConfig.sweep;
+
+    auto const itUnsupported = std::find_if_not(sweep.transport.begin(), sweep.transport.end(), is_supported_transport);
+    if (itUnsupported != sweep.transport.end()) {
+        print_err("Unsupported transport: ", *itUnsupported);
+        return 1;
+    }
+
+    auto const cells = sweep.plan();
+    auto const nLanes = sweep.lanes(cells.size());
+    auto const nBasePort = from_string<int>(clientConfig.server_port);
+
+    print_std("sweep: ", cells.size(), " cells, ", nLanes, " lanes, ",
+              sweep.warmup_runs, " warm-up + ", sweep.repetitions, " runs per cell");
+
+    auto dataset = SweepDataset{};
+    auto nNextCell = std::atomic<std::size_t>{ 0 };
+    auto nFailedCells = std::atomic<std::size_t>{ 0 };
+
+    auto const runLane = [&](std::uint32_t nLane)
+    {
+        SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR{ 1 } << (nLane % (sizeof(DWORD_PTR) * 8)));
+
+        auto const strPort = std::to_string(nBasePort + nLane);
+
+        for (auto nCell = nNextCell++; nCell < cells.size(); nCell = nNextCell++)
+        {
+            auto const& cell = cells[nCell];
+
+            auto cellConfig = clientConfig;
+            cellConfig.sweep.reset();
+            cellConfig.server_port = strPort;
+            cellConfig.package_size = cell.package_size;
+            cellConfig.timeout = { cell.timeout };
+            cellConfig.number_of_tries = sweep.warmup_runs + sweep.repetitions;
+            if (!wait_strategy_flags(cell.wait_strategy, cellConfig.apply_socket_timeout, cellConfig.apply_select_timeout)) {
+                print_err("Unknown wait strategy: ", cell.wait_strategy);
+                ++nFailedCells;
+                continue;
+            }
+
+            auto fileProcessConfig = make_file_process_config(cellConfig);
+            fileProcessConfig.apply_socket_timeout = cellConfig.apply_socket_timeout;
+            fileProcessConfig.apply_select_timeout = cellConfig.apply_select_timeout;
+            fileProcessConfig.buffer_size = cell.buffer_size;
+            fileProcessConfig.report_times = true;
+
+            auto connection = connect_to_server(cellConfig.server_ip, cellConfig.server_port);
+            if (!connection.is_valid()) {
+                print_err("Unable to connect to server on port ", cellConfig.server_port);
+                ++nFailedCells;
+                continue;
+            }
+
+            auto recvTimes = std::vector<std::int64_t>{};
+            if (run_session(connection, cellConfig, fileProcessConfig, recvTimes, bufferPool) != 0) {
+                ++nFailedCells;
+                continue;
+            }
+
+            recvTimes.erase(recvTimes.begin(), std::next(recvTimes.begin(), std::min<std::size_t>(sweep.warmup_runs, recvTimes.size())));
+            dataset.append(cell, nLane, summarize(recvTimes, sweep.outlier_mad));
+        }
+    };
+
+    {
+        auto lanes = std::vector<std::thread>{};
+        for (std::uint32_t nLane = 1; nLane < nLanes; ++nLane)
+            lanes.emplace_back(runLane, nLane);
+        runLane(0);
+        for (auto& lane : lanes)
+            lane.join();
+    }
+
+    if (!dataset.write(sweep.output)) {
+        print_err("Failed to write sweep results: ", sweep.output);
+        return 1;
+    }
+
+    print_std("sweep results: ", sweep.output, ", failed cells: ", nFailedCells.load());
+    return nFailedCells.load() == 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    auto const clientConfig = []()
+    {
+        auto const configName = std::string{"config_client.json"};
+
+        auto config = std::optional<ClientConfig>{ ClientConfig{} };
+        if (!config->deserialize(configName)) {
+            config->server_ip = "localhost";
+            config->server_port = "9999";
+            config->package_size = 16;
+            config->timeout = { 25, 50, 75 };
+            config->file_name = "in.dat";
+            config->apply_socket_timeout = true;
+            config->apply_select_timeout = true;
+            config->number_of_tries = 1;
+            config->target_ci = 0.0;
+            config->min_tries = 2;
+            config->serialize(configName);
+
+            print_std("Generated default config: ", configName);
+            config = std::nullopt;
+        }
+
+        return config;
+    } ();
+
+    if(!clientConfig.has_value())
+        return 0;
+
+    // Initialize Winsock
+    auto const wsaData = createWSADataRaii();
+    if (!wsaData) {
+        print_err("WSAStartup failed");
+        return 1;
+    }
+
+    print_std("using config:");
+    print_std("server_ip:    ", clientConfig->server_ip);
+    print_std("server_port:  ", clientConfig->server_port);
+    print_std("package_size: ", clientConfig->package_size);
+
+    {
+        auto payloadKind = PayloadKind::file;
+        if (!payload_kind(clientConfig->payload, payloadKind)) {
+            print_err("Unknown payload: ", clientConfig->payload);
+            return 1;
+        }
+        if (payloadKind != PayloadKind::file)
+        {
+            if (clientConfig->payload_size <= 0) {
+                print_err("payload_size is required for payload ", clientConfig->payload);
+                return 1;
+            }
+            print_std("payload:      ", clientConfig->payload, ", ", clientConfig->payload_size, " bytes per file");
+        }
+
+        if (!clientConfig->transfer_id.empty())
+        {
+            if (!is_valid_transfer_id(clientConfig->transfer_id)) {
+                print_err("transfer_id may only contain letters, digits, '_' and '-': ", clientConfig->transfer_id);
+                return 1;
+            }
+            // Generated payloads are produced front to back and cannot skip ranges
+            if (payloadKind != PayloadKind::file) {
+                print_err("payload ", clientConfig->payload, " cannot be combined with transfer_id");
+                return 1;
+            }
+            // A delta rebuilds the whole file from the old copy, not ranges of it,
+            // and compressed frames cover the whole file as well
+            if (clientConfig->delta || clientConfig->compression) {
+                print_err("delta and compression cannot be combined with transfer_id");
+                return 1;
+            }
+        }
+
+        if (clientConfig->delta && payloadKind != PayloadKind::file) {
+            print_err("payload ", clientConfig->payload, " cannot be combined with delta");
+            return 1;
+        }
+        if (clientConfig->delta && clientConfig->compression) {
+            print_err("delta cannot be combined with compression");
+            return 1;
+        }
+
+        if (auto psk = ChaCha20Poly1305::Key{}; !clientConfig->psk.empty() && !parse_psk(clientConfig->psk, psk)) {
+            print_err("psk must be 64 hex digits");
+            return 1;
+        }
+    }
+
+    // Shared by every sweep lane, each lane thread keeps its own cache of free chunks
+    auto bufferPool = BufferPool{ [&]()
+    {
+        auto options = BufferPool::Options{};
+        options.bHugePages = clientConfig->huge_pages;
+        return options;
+    } () };
+
+    if (clientConfig->sweep)
+        return run_sweep(*clientConfig, bufferPool);
+
+    auto const fileProcessConfig = make_file_process_config(*clientConfig);
+    auto recvTimes = std::vector<std::int64_t>{};
+
+    // A resumable session reconnects after a drop and the server sends only what is missing
+    auto const nAttempts = clientConfig->transfer_id.empty() ? 1u : 1u + clientConfig->resume_attempts;
+    auto iResult = 1;
+    for (auto nAttempt = 0u; nAttempt < nAttempts && iResult != 0; ++nAttempt)
+    {
+        if (nAttempt > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::seconds{ 1 });
+            print_std(":: reconnect attempt ", nAttempt, " of ", clientConfig->resume_attempts);
+        }
+
+        auto connection = connect_to_server(clientConfig->server_ip, clientConfig->server_port);
+        if (!connection.is_valid()) {
+            print_err("Unable to connect to server");
+            continue;
+        }
+        print_std("Connected successfully");
+
+        iResult = run_session(connection, *clientConfig, fileProcessConfig, recvTimes, bufferPool);
+    }
+
+    return iResult;
+}
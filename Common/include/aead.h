@@ -0,0 +1,541 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define OS2VAR2_CHACHA_X64 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#include <bcrypt.h>
+#undef min
+#undef max
+#else
+#include <fstream>
+#endif
+
+// ChaCha20-Poly1305 as in RFC 8439. ChaCha20 runs eight blocks at once in
+// AVX2 registers when the CPU has them, one block at a time otherwise;
+// Poly1305 is the 26-bit limb ("donna-32") version on every target.
+
+namespace detail_chacha
+{
+    constexpr std::size_t kBlockSize = 64;
+
+    inline std::uint32_t load32(unsigned char const* p) noexcept
+    {
+        auto n = std::uint32_t{};
+        std::memcpy(&n, p, sizeof(n));
+        return n;
+    }
+
+    inline void store32(unsigned char* p, std::uint32_t n) noexcept
+    {
+        std::memcpy(p, &n, sizeof(n));
+    }
+
+    inline std::uint32_t rotl(std::uint32_t x, int k) noexcept
+    {
+        return (x << k) | (x >> (32 - k));
+    }
+
+    inline void quarter_round(std::uint32_t& a, std::uint32_t& b, std::uint32_t& c, std::uint32_t& d) noexcept
+    {
+        a += b; d = rotl(d ^ a, 16);
+        c += d; b = rotl(b ^ c, 12);
+        a += b; d = rotl(d ^ a, 8);
+        c += d; b = rotl(b ^ c, 7);
+    }
+
+    // "expand 32-byte k", key, block counter, nonce; all little endian
+    inline std::array<std::uint32_t, 16> make_state(unsigned char const* pKey, std::uint32_t nCounter, unsigned char const* pNonce) noexcept
+    {
+        auto state = std::array<std::uint32_t, 16>{ 0x61707865u, 0x3320646Eu, 0x79622D32u, 0x6B206574u };
+        for (std::size_t i = 0; i < 8; ++i)
+            state[4 + i] = load32(pKey + 4 * i);
+        state[12] = nCounter;
+        for (std::size_t i = 0; i < 3; ++i)
+            state[13 + i] = load32(pNonce + 4 * i);
+        return state;
+    }
+
+    inline void block(std::array<std::uint32_t, 16> const& state, unsigned char* pOut) noexcept
+    {
+        auto x = state;
+        for (int i = 0; i < 10; ++i)
+        {
+            quarter_round(x[0], x[4], x[8],  x[12]);
+            quarter_round(x[1], x[5], x[9],  x[13]);
+            quarter_round(x[2], x[6], x[10], x[14]);
+            quarter_round(x[3], x[7], x[11], x[15]);
+            quarter_round(x[0], x[5], x[10], x[15]);
+            quarter_round(x[1], x[6], x[11], x[12]);
+            quarter_round(x[2], x[7], x[8],  x[13]);
+            quarter_round(x[3], x[4], x[9],  x[14]);
+        }
+        for (std::size_t i = 0; i < 16; ++i)
+            store32(pOut + 4 * i, x[i] + state[i]);
+    }
+
+    // XORs nSize bytes with the key stream from state's counter on, advancing it
+    inline void xor_portable(std::array<std::uint32_t, 16>& state, unsigned char const* pIn, unsigned char* pOut, std::size_t nSize) noexcept
+    {
+        auto keyStream = std::array<unsigned char, kBlockSize>{};
+        while (nSize > 0)
+        {
+            block(state, keyStream.data());
+            ++state[12];
+
+            auto const nBytes = std::min(nSize, kBlockSize);
+            for (std::size_t i = 0; i < nBytes; ++i)
+                pOut[i] = static_cast<unsigned char>(pIn[i] ^ keyStream[i]);
+            pIn += nBytes;
+            pOut += nBytes;
+            nSize -= nBytes;
+        }
+    }
+
+#ifdef OS2VAR2_CHACHA_X64
+
+#if defined(__GNUC__) || defined(__clang__)
+#define OS2VAR2_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define OS2VAR2_TARGET_AVX2
+#endif
+
+    OS2VAR2_TARGET_AVX2
+    inline void transpose_store(__m256i const* x, unsigned char const* pIn, unsigned char* pOut) noexcept
+    {
+        // x[w] holds word w of the eight blocks; block b has to end up as x[0..7] lane b
+        auto const t0 = _mm256_unpacklo_epi32(x[0], x[1]);
+        auto const t1 = _mm256_unpackhi_epi32(x[0], x[1]);
+        auto const t2 = _mm256_unpacklo_epi32(x[2], x[3]);
+        auto const t3 = _mm256_unpackhi_epi32(x[2], x[3]);
+        auto const t4 = _mm256_unpacklo_epi32(x[4], x[5]);
+        auto const t5 = _mm256_unpackhi_epi32(x[4], x[5]);
+        auto const t6 = _mm256_unpacklo_epi32(x[6], x[7]);
+        auto const t7 = _mm256_unpackhi_epi32(x[6], x[7]);
+
+        __m256i u[8];
+        u[0] = _mm256_unpacklo_epi64(t0, t2);
+        u[1] = _mm256_unpackhi_epi64(t0, t2);
+        u[2] = _mm256_unpacklo_epi64(t1, t3);
+        u[3] = _mm256_unpackhi_epi64(t1, t3);
+        u[4] = _mm256_unpacklo_epi64(t4, t6);
+        u[5] = _mm256_unpackhi_epi64(t4, t6);
+        u[6] = _mm256_unpacklo_epi64(t5, t7);
+        u[7] = _mm256_unpackhi_epi64(t5, t7);
+
+        for (std::size_t b = 0; b < 4; ++b)
+        {
+            auto const low = _mm256_permute2x128_si256(u[b], u[b + 4], 0x20);
+            auto const high = _mm256_permute2x128_si256(u[b], u[b + 4], 0x31);
+
+            auto const pLow = reinterpret_cast<__m256i*>(pOut + b * kBlockSize);
+            auto const pHigh = reinterpret_cast<__m256i*>(pOut + (b + 4) * kBlockSize);
+            _mm256_storeu_si256(pLow, _mm256_xor_si256(low, _mm256_loadu_si256(reinterpret_cast<__m256i const*>(pIn + b * kBlockSize))));
+            _mm256_storeu_si256(pHigh, _mm256_xor_si256(high, _mm256_loadu_si256(reinterpret_cast<__m256i const*>(pIn + (b + 4) * kBlockSize))));
+        }
+    }
+
+    OS2VAR2_TARGET_AVX2
+    inline void quarter_round_avx2(__m256i* x, int a, int b, int c, int d, __m256i rot16, __m256i rot8) noexcept
+    {
+        x[a] = _mm256_add_epi32(x[a], x[b]); x[d] = _mm256_shuffle_epi8(_mm256_xor_si256(x[d], x[a]), rot16);
+        x[c] = _mm256_add_epi32(x[c], x[d]); x[b] = _mm256_xor_si256(x[b], x[c]);
+        x[b] = _mm256_or_si256(_mm256_slli_epi32(x[b], 12), _mm256_srli_epi32(x[b], 20));
+        x[a] = _mm256_add_epi32(x[a], x[b]); x[d] = _mm256_shuffle_epi8(_mm256_xor_si256(x[d], x[a]), rot8);
+        x[c] = _mm256_add_epi32(x[c], x[d]); x[b] = _mm256_xor_si256(x[b], x[c]);
+        x[b] = _mm256_or_si256(_mm256_slli_epi32(x[b], 7), _mm256_srli_epi32(x[b], 25));
+    }
+
+    OS2VAR2_TARGET_AVX2
+    inline void xor_avx2(std::array<std::uint32_t, 16>& state, unsigned char const* pIn, unsigned char* pOut, std::size_t nSize) noexcept
+    {
+        auto const rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                            2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+        auto const rot8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+                                           3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+        auto const lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+        // One register per state word, one lane per block
+        while (nSize >= 8 * kBlockSize)
+        {
+            __m256i origin[16];
+            for (std::size_t i = 0; i < 16; ++i)
+                origin[i] = _mm256_set1_epi32(static_cast<int>(state[i]));
+            origin[12] = _mm256_add_epi32(origin[12], lanes);
+
+            __m256i x[16];
+            for (std::size_t i = 0; i < 16; ++i)
+                x[i] = origin[i];
+
+            for (int i = 0; i < 10; ++i)
+            {
+                quarter_round_avx2(x, 0, 4, 8,  12, rot16, rot8);
+                quarter_round_avx2(x, 1, 5, 9,  13, rot16, rot8);
+                quarter_round_avx2(x, 2, 6, 10, 14, rot16, rot8);
+                quarter_round_avx2(x, 3, 7, 11, 15, rot16, rot8);
+                quarter_round_avx2(x, 0, 5, 10, 15, rot16, rot8);
+                quarter_round_avx2(x, 1, 6, 11, 12, rot16, rot8);
+                quarter_round_avx2(x, 2, 7, 8,  13, rot16, rot8);
+                quarter_round_avx2(x, 3, 4, 9,  14, rot16, rot8);
+            }
+
+            for (std::size_t i = 0; i < 16; ++i)
+                x[i] = _mm256_add_epi32(x[i], origin[i]);
+
+            // Words 0..7 are the first half of each block, 8..15 the second
+            transpose_store(x, pIn, pOut);
+            transpose_store(x + 8, pIn + 32, pOut + 32);
+
+            state[12] += 8;
+            pIn += 8 * kBlockSize;
+            pOut += 8 * kBlockSize;
+            nSize -= 8 * kBlockSize;
+        }
+
+        xor_portable(state, pIn, pOut, nSize);
+    }
+
+#undef OS2VAR2_TARGET_AVX2
+
+    inline bool cpu_has_avx2() noexcept
+    {
+#if defined(_MSC_VER) && !defined(__clang__)
+        int info[4] = {};
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
+
+        // AVX and OSXSAVE, and the OS saves the YMM state
+        __cpuid(info, 1);
+        if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+            return false;
+
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+
+    inline bool use_avx2() noexcept
+    {
+        static bool const s_bAvx2 = cpu_has_avx2();
+        return s_bAvx2;
+    }
+
+#endif
+
+    inline void xor_stream(std::array<std::uint32_t, 16>& state, unsigned char const* pIn, unsigned char* pOut, std::size_t nSize) noexcept
+    {
+#ifdef OS2VAR2_CHACHA_X64
+        if (use_avx2())
+        {
+            xor_avx2(state, pIn, pOut, nSize);
+            return;
+        }
+#endif
+        xor_portable(state, pIn, pOut, nSize);
+    }
+}
+
+/************
+ * Poly1305 *
+ ************/
+
+class Poly1305
+{
+public:
+    static constexpr std::size_t kTagSize = 16;
+
+    explicit Poly1305(unsigned char const* pKey) noexcept
+    {
+        using detail_chacha::load32;
+
+        // r is clamped as the RFC requires, s is added at the end
+        m_r[0] = load32(pKey + 0) & 0x3FFFFFF;
+        m_r[1] = (load32(pKey + 3) >> 2) & 0x3FFFF03;
+        m_r[2] = (load32(pKey + 6) >> 4) & 0x3FFC0FF;
+        m_r[3] = (load32(pKey + 9) >> 6) & 0x3F03FFF;
+        m_r[4] = (load32(pKey + 12) >> 8) & 0x00FFFFF;
+        for (std::size_t i = 0; i < 4; ++i)
+            m_pad[i] = load32(pKey + 16 + 4 * i);
+    }
+
+    void update(unsigned char const* p, std::size_t nSize) noexcept
+    {
+        if (m_nBuffered > 0)
+        {
+            auto const nBytes = std::min(nSize, kBlockSize - m_nBuffered);
+            std::memcpy(m_buffer.data() + m_nBuffered, p, nBytes);
+            m_nBuffered += nBytes;
+            p += nBytes;
+            nSize -= nBytes;
+            if (m_nBuffered < kBlockSize)
+                return;
+
+            blocks(m_buffer.data(), kBlockSize, 1u << 24);
+            m_nBuffered = 0;
+        }
+
+        auto const nWhole = nSize / kBlockSize * kBlockSize;
+        blocks(p, nWhole, 1u << 24);
+
+        std::memcpy(m_buffer.data(), p + nWhole, nSize - nWhole);
+        m_nBuffered = nSize - nWhole;
+    }
+
+    // Zero bytes up to the next 16-byte boundary, as the AEAD construction pads
+    void pad() noexcept
+    {
+        if (m_nBuffered == 0)
+            return;
+
+        std::memset(m_buffer.data() + m_nBuffered, 0, kBlockSize - m_nBuffered);
+        blocks(m_buffer.data(), kBlockSize, 1u << 24);
+        m_nBuffered = 0;
+    }
+
+    std::array<unsigned char, kTagSize> finish() noexcept
+    {
+        if (m_nBuffered > 0)
+        {
+            m_buffer[m_nBuffered] = 1;
+            std::memset(m_buffer.data() + m_nBuffered + 1, 0, kBlockSize - m_nBuffered - 1);
+            blocks(m_buffer.data(), kBlockSize, 0);
+        }
+
+        auto h = m_h;
+        constexpr std::uint32_t kMask = 0x3FFFFFF;
+
+        // Fully carry h
+        auto c = h[1] >> 26; h[1] &= kMask;
+        h[2] += c; c = h[2] >> 26; h[2] &= kMask;
+        h[3] += c; c = h[3] >> 26; h[3] &= kMask;
+        h[4] += c; c = h[4] >> 26; h[4] &= kMask;
+        h[0] += c * 5; c = h[0] >> 26; h[0] &= kMask;
+        h[1] += c;
+
+        // h - p, taken when it does not underflow
+        auto g = std::array<std::uint32_t, 5>{};
+        g[0] = h[0] + 5; c = g[0] >> 26; g[0] &= kMask;
+        g[1] = h[1] + c; c = g[1] >> 26; g[1] &= kMask;
+        g[2] = h[2] + c; c = g[2] >> 26; g[2] &= kMask;
+        g[3] = h[3] + c; c = g[3] >> 26; g[3] &= kMask;
+        g[4] = h[4] + c - (1u << 26);
+
+        auto const nSelect = (g[4] >> 31) - 1;
+        for (std::size_t i = 0; i < 5; ++i)
+            h[i] = (h[i] & ~nSelect) | (g[i] & nSelect);
+
+        // To 4 x 32 bits, plus s
+        auto const w = std::array<std::uint32_t, 4>{
+            h[0] | (h[1] << 26),
+            (h[1] >> 6) | (h[2] << 20),
+            (h[2] >> 12) | (h[3] << 14),
+            (h[3] >> 18) | (h[4] << 8) };
+
+        auto tag = std::array<unsigned char, kTagSize>{};
+        auto f = std::uint64_t{ 0 };
+        for (std::size_t i = 0; i < 4; ++i)
+        {
+            f = std::uint64_t{ w[i] } + m_pad[i] + (f >> 32);
+            detail_chacha::store32(tag.data() + 4 * i, static_cast<std::uint32_t>(f));
+        }
+        return tag;
+    }
+
+private:
+    static constexpr std::size_t kBlockSize = 16;
+
+    void blocks(unsigned char const* p, std::size_t nSize, std::uint32_t nHighBit) noexcept
+    {
+        using detail_chacha::load32;
+        constexpr std::uint32_t kMask = 0x3FFFFFF;
+
+        auto const r0 = std::uint64_t{ m_r[0] }, r1 = std::uint64_t{ m_r[1] }, r2 = std::uint64_t{ m_r[2] };
+        auto const r3 = std::uint64_t{ m_r[3] }, r4 = std::uint64_t{ m_r[4] };
+        auto const s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+        auto h0 = m_h[0], h1 = m_h[1], h2 = m_h[2], h3 = m_h[3], h4 = m_h[4];
+
+        for (; nSize >= kBlockSize; p += kBlockSize, nSize -= kBlockSize)
+        {
+            h0 += load32(p + 0) & kMask;
+            h1 += (load32(p + 3) >> 2) & kMask;
+            h2 += (load32(p + 6) >> 4) & kMask;
+            h3 += (load32(p + 9) >> 6) & kMask;
+            h4 += (load32(p + 12) >> 8) | nHighBit;
+
+            // h *= r mod 2^130 - 5, the 5 folds the wrap-around back in
+            auto const d0 = h0 * r0 + h1 * s4 + h2 * s3 + h3 * s2 + std::uint64_t{ h4 } * s1;
+            auto d1 = h0 * r1 + h1 * r0 + h2 * s4 + h3 * s3 + std::uint64_t{ h4 } * s2;
+            auto d2 = h0 * r2 + h1 * r1 + h2 * r0 + h3 * s4 + std::uint64_t{ h4 } * s3;
+            auto d3 = h0 * r3 + h1 * r2 + h2 * r1 + h3 * r0 + std::uint64_t{ h4 } * s4;
+            auto d4 = h0 * r4 + h1 * r3 + h2 * r2 + h3 * r1 + std::uint64_t{ h4 } * r0;
+
+            auto c = static_cast<std::uint32_t>(d0 >> 26); h0 = static_cast<std::uint32_t>(d0) & kMask;
+            d1 += c; c = static_cast<std::uint32_t>(d1 >> 26); h1 = static_cast<std::uint32_t>(d1) & kMask;
+            d2 += c; c = static_cast<std::uint32_t>(d2 >> 26); h2 = static_cast<std::uint32_t>(d2) & kMask;
+            d3 += c; c = static_cast<std::uint32_t>(d3 >> 26); h3 = static_cast<std::uint32_t>(d3) & kMask;
+            d4 += c; c = static_cast<std::uint32_t>(d4 >> 26); h4 = static_cast<std::uint32_t>(d4) & kMask;
+            h0 += c * 5; c = h0 >> 26; h0 &= kMask;
+            h1 += c;
+        }
+
+        m_h = { h0, h1, h2, h3, h4 };
+    }
+
+    std::array<std::uint32_t, 5> m_r{};
+    std::array<std::uint32_t, 4> m_pad{};
+    std::array<std::uint32_t, 5> m_h{};
+    std::array<unsigned char, kBlockSize> m_buffer{};
+    std::size_t m_nBuffered = 0;
+};
+
+/********************
+ * ChaCha20Poly1305 *
+ ********************/
+
+class ChaCha20Poly1305
+{
+public:
+    using Key = std::array<unsigned char, 32>;
+    using Nonce = std::array<unsigned char, 12>;
+    using Tag = std::array<unsigned char, Poly1305::kTagSize>;
+
+    explicit ChaCha20Poly1305(Key const& key) noexcept
+        : m_key{ key }
+    {}
+
+    // Encrypts [pData, pData + nSize) in place and returns the tag over aad and ciphertext
+    Tag seal(Nonce const& nonce, void const* pAad, std::size_t nAadSize, char* pData, std::size_t nSize) const noexcept
+    {
+        auto state = detail_chacha::make_state(m_key.data(), 0, nonce.data());
+        auto mac = make_mac(state);
+
+        auto const p = reinterpret_cast<unsigned char*>(pData);
+        detail_chacha::xor_stream(state, p, p, nSize);
+        return authenticate(mac, pAad, nAadSize, p, nSize);
+    }
+
+    // Checks the tag, then decrypts in place; the data is left alone if the tag is wrong
+    bool open(Nonce const& nonce, void const* pAad, std::size_t nAadSize, char* pData, std::size_t nSize, Tag const& tag) const noexcept
+    {
+        auto state = detail_chacha::make_state(m_key.data(), 0, nonce.data());
+        auto mac = make_mac(state);
+
+        auto const p = reinterpret_cast<unsigned char*>(pData);
+        auto const expected = authenticate(mac, pAad, nAadSize, p, nSize);
+
+        // Constant time compare
+        auto nDiff = 0u;
+        for (std::size_t i = 0; i < tag.size(); ++i)
+            nDiff |= static_cast<unsigned>(expected[i] ^ tag[i]);
+        if (nDiff != 0)
+            return false;
+
+        detail_chacha::xor_stream(state, p, p, nSize);
+        return true;
+    }
+
+private:
+    // Block 0 of the key stream keys Poly1305, the data starts at block 1
+    static Poly1305 make_mac(std::array<std::uint32_t, 16>& state) noexcept
+    {
+        auto keyBlock = std::array<unsigned char, detail_chacha::kBlockSize>{};
+        detail_chacha::block(state, keyBlock.data());
+        ++state[12];
+        return Poly1305{ keyBlock.data() };
+    }
+
+    static Tag authenticate(Poly1305& mac, void const* pAad, std::size_t nAadSize, unsigned char const* pCipher, std::size_t nSize) noexcept
+    {
+        mac.update(static_cast<unsigned char const*>(pAad), nAadSize);
+        mac.pad();
+        mac.update(pCipher, nSize);
+        mac.pad();
+
+        auto lengths = std::array<unsigned char, 16>{};
+        auto const nAad64 = static_cast<std::uint64_t>(nAadSize);
+        auto const nSize64 = static_cast<std::uint64_t>(nSize);
+        std::memcpy(lengths.data(), &nAad64, 8);
+        std::memcpy(lengths.data() + 8, &nSize64, 8);
+        mac.update(lengths.data(), lengths.size());
+        return mac.finish();
+    }
+
+    Key m_key;
+};
+
+// Pre-shared keys are 64 hex digits
+inline bool parse_psk(std::string const& strHex, ChaCha20Poly1305::Key& key)
+{
+    if (strHex.size() != 2 * key.size())
+        return false;
+
+    auto const digit = [](char c) -> int
+    {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+
+    for (std::size_t i = 0; i < key.size(); ++i)
+    {
+        auto const nHigh = digit(strHex[2 * i]);
+        auto const nLow = digit(strHex[2 * i + 1]);
+        if (nHigh < 0 || nLow < 0)
+            return false;
+        key[i] = static_cast<unsigned char>(nHigh * 16 + nLow);
+    }
+    return true;
+}
+
+// Bytes from the OS random generator
+inline bool random_bytes(void* pData, std::size_t nSize)
+{
+#ifdef _WIN32
+    return BCryptGenRandom(nullptr, static_cast<PUCHAR>(pData), static_cast<ULONG>(nSize), BCRYPT_USE_SYSTEM_PREFERRED_RNG) >= 0;
+#else
+    auto fin = std::ifstream{ "/dev/urandom", std::ios::binary };
+    return static_cast<bool>(fin.read(static_cast<char*>(pData), static_cast<std::streamsize>(nSize)));
+#endif
+}
+
+using SessionSalt = std::array<unsigned char, 16>;
+
+// Both directions of one connection get their own keys, derived from the PSK
+// and a random salt from each side, so no key and nonce pair ever repeats
+// across connections even though record counters restart at zero. The ChaCha20
+// block function serves as the PRF: key it with the PSK and feed it the client
+// salt, then key it with that and feed it the server salt.
+inline std::pair<ChaCha20Poly1305::Key, ChaCha20Poly1305::Key> derive_session_keys(ChaCha20Poly1305::Key const& psk, SessionSalt const& clientSalt, SessionSalt const& serverSalt) noexcept
+{
+    using namespace detail_chacha;
+
+    auto stream = std::array<unsigned char, kBlockSize>{};
+    block(make_state(psk.data(), load32(clientSalt.data() + 12), clientSalt.data()), stream.data());
+
+    auto intermediate = ChaCha20Poly1305::Key{};
+    std::memcpy(intermediate.data(), stream.data(), intermediate.size());
+    block(make_state(intermediate.data(), load32(serverSalt.data() + 12), serverSalt.data()), stream.data());
+
+    auto keys = std::pair<ChaCha20Poly1305::Key, ChaCha20Poly1305::Key>{};
+    std::memcpy(keys.first.data(), stream.data(), 32);         // client to server
+    std::memcpy(keys.second.data(), stream.data() + 32, 32);   // server to client
+    return keys;
+}
@@ -0,0 +1,352 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+/*************
+ * log_level *
+ *************/
+
+// Records below OS2VAR2_LOG_LEVEL are discarded at compile time
+#ifndef OS2VAR2_LOG_LEVEL
+#define OS2VAR2_LOG_LEVEL 0
+#endif
+
+enum class log_level : int
+{
+    trace   = 0,
+    debug   = 1,
+    info    = 2,
+    warning = 3,
+    error   = 4
+};
+
+enum class log_sink : std::uint32_t
+{
+    out = 1,
+    err = 2
+};
+
+template<log_level Level>
+constexpr bool log_enabled = static_cast<int>(Level) >= OS2VAR2_LOG_LEVEL;
+
+/************
+ * LogChars *
+ ************/
+
+// A char array copied into the record. The type cannot tell a string literal
+// from a local buffer, and literals are short, so copying them costs about
+// as much as the pointer did.
+template<std::size_t N>
+struct LogChars
+{
+    LogChars(char const (&str)[N]) noexcept
+    {
+        std::memcpy(data, str, N);
+    }
+
+    friend std::ostream& operator<<(std::ostream& stream, LogChars const& chars)
+    {
+        auto const pEnd = static_cast<char const*>(std::memchr(chars.data, '\0', N));
+        return stream.write(chars.data, pEnd ? pEnd - chars.data : static_cast<std::streamsize>(N));
+    }
+
+    char data[N];
+};
+
+/***************
+ * log_capture *
+ ***************/
+
+// Arguments are formatted later on the logger thread, so anything that may
+// point at caller-owned memory is captured by value. Small char arrays go
+// into the record itself, everything string-like else into a std::string.
+template<typename T
+        , typename TRef = std::remove_reference_t<T>
+        , typename TDecay = std::decay_t<T>>
+using log_capture_t = std::conditional_t<
+        std::is_array_v<TRef>
+        && std::is_same_v<std::remove_cv_t<std::remove_extent_t<TRef>>, char>
+        && std::extent_v<TRef> <= 256
+        , LogChars<std::extent_v<TRef>>
+        , std::conditional_t<
+                std::is_same_v<TDecay, char*>
+                || std::is_same_v<TDecay, char const*>
+                || std::is_same_v<TDecay, std::string_view>
+                , std::string
+                , TDecay>>;
+
+/***********
+ * LogRing *
+ ***********/
+
+// Single producer / single consumer byte ring holding variable sized records.
+class LogRing
+{
+public:
+    using FormatFunc = void(*)(void* pArgs, std::ostream& stream);
+
+    struct alignas(16) Record
+    {
+        FormatFunc    format;   // nullptr marks padding up to the ring end
+        std::uint32_t size;     // header + payload, multiple of alignof(Record)
+        log_sink      sink;
+    };
+
+    static constexpr std::size_t nCapacity = std::size_t{ 1 } << 16;
+
+    static constexpr std::size_t record_size(std::size_t nPayload) noexcept
+    {
+        return (sizeof(Record) + nPayload + alignof(Record) - 1) & ~(alignof(Record) - 1);
+    }
+
+    template<typename TArgs>
+    void push(log_sink sink, TArgs&& args)
+    {
+        using Args = std::decay_t<TArgs>;
+        static_assert(alignof(Args) <= alignof(Record), "log argument is over-aligned");
+        static_assert(record_size(sizeof(Args)) <= nCapacity / 4, "log record is too large");
+
+        auto const nSize = record_size(sizeof(Args));
+        auto const nTail = m_nTail.load(std::memory_order_relaxed);
+        auto const nOffset = nTail % nCapacity;
+        auto const nPadding = nOffset + nSize > nCapacity ? nCapacity - nOffset : std::size_t{ 0 };
+
+        // Ring is full: wait for the logger thread instead of dropping lines
+        while (nTail + nPadding + nSize - m_nHead.load(std::memory_order_acquire) > nCapacity)
+            std::this_thread::yield();
+
+        if (nPadding)
+            new (m_data + nOffset) Record{ nullptr, static_cast<std::uint32_t>(nPadding), sink };
+
+        auto const pRecord = m_data + (nTail + nPadding) % nCapacity;
+        new (pRecord) Record{ &format_record<Args>, static_cast<std::uint32_t>(nSize), sink };
+        new (pRecord + sizeof(Record)) Args(std::forward<TArgs>(args));
+
+        m_nTail.store(nTail + nPadding + nSize, std::memory_order_release);
+    }
+
+    // Formats every published record into the stream streamFor(sink) returns,
+    // returns false if there was nothing
+    template<typename TStreamFor>
+    bool drain(TStreamFor&& streamFor)
+    {
+        auto nHead = m_nHead.load(std::memory_order_relaxed);
+        auto const nTail = m_nTail.load(std::memory_order_acquire);
+        if (nHead == nTail)
+            return false;
+
+        while (nHead != nTail)
+        {
+            auto const pRecord = m_data + nHead % nCapacity;
+            auto const& record = *std::launder(reinterpret_cast<Record*>(pRecord));
+            if (record.format)
+                record.format(pRecord + sizeof(Record), streamFor(record.sink));
+            nHead += record.size;
+        }
+
+        m_nHead.store(nHead, std::memory_order_release);
+        return true;
+    }
+
+private:
+    template<typename Args>
+    static void format_record(void* pArgs, std::ostream& stream)
+    {
+        auto& args = *std::launder(static_cast<Args*>(pArgs));
+        std::apply([&stream](auto const&...values) { ((stream << values), ...); }, args);
+        stream << '\n';
+        args.~Args();
+    }
+
+    alignas(64) std::atomic<std::size_t> m_nHead{ 0 };
+    alignas(64) std::atomic<std::size_t> m_nTail{ 0 };
+    alignas(64) unsigned char m_data[nCapacity];
+};
+
+/***************
+ * AsyncLogger *
+ ***************/
+
+// Producers only capture their arguments into a per-thread ring; formatting
+// and the actual write() calls happen on a background thread, one batch per sink.
+class AsyncLogger
+{
+public:
+    static AsyncLogger& instance()
+    {
+        static AsyncLogger logger;
+        return logger;
+    }
+
+    template<typename...Ts>
+    void write(log_sink sink, Ts&&...args)
+    {
+        local_ring().push(sink, std::tuple<log_capture_t<Ts>...>{ std::forward<Ts>(args)... });
+    }
+
+    // Blocks until everything logged before the call has reached the file descriptors
+    void flush()
+    {
+        auto const nRequest = m_nFlushRequest.fetch_add(1) + 1;
+        m_wake.notify_one();
+        while (m_nFlushDone.load() < nRequest)
+            std::this_thread::yield();
+    }
+
+    ~AsyncLogger()
+    {
+        m_bStop.store(true);
+        m_wake.notify_one();
+        if (m_worker.joinable())
+            m_worker.join();
+    }
+
+    AsyncLogger(AsyncLogger const&) = delete;
+    AsyncLogger& operator=(AsyncLogger const&) = delete;
+
+private:
+    AsyncLogger()
+        : m_worker{ [this]() { run(); } }
+    {}
+
+    LogRing& local_ring()
+    {
+        thread_local LogRing* pRing = nullptr;
+        if (!pRing)
+        {
+            auto ring = std::make_unique<LogRing>();
+            pRing = ring.get();
+
+            auto const lock = std::lock_guard{ m_ringsMutex };
+            m_rings.push_back(std::move(ring));
+        }
+        return *pRing;
+    }
+
+    bool drain_all()
+    {
+        auto bDrained = false;
+        {
+            auto const lock = std::lock_guard{ m_ringsMutex };
+            for (auto& ring : m_rings)
+                bDrained |= ring->drain([this](log_sink sink) -> std::ostream& { return stream_for(sink); });
+        }
+
+        if (bDrained)
+        {
+            write_fd(1, m_out);
+            write_fd(2, m_err);
+        }
+        return bDrained;
+    }
+
+    // Whatever the other sink has buffered goes out first, so stdout and stderr
+    // lines keep the order they were logged in
+    std::ostream& stream_for(log_sink sink)
+    {
+        if (sink != m_lastSink)
+        {
+            if (m_lastSink == log_sink::err)
+                write_fd(2, m_err);
+            else
+                write_fd(1, m_out);
+            m_lastSink = sink;
+        }
+        return sink == log_sink::err ? m_err : m_out;
+    }
+
+    static void write_fd(int fd, std::ostringstream& stream)
+    {
+        auto const str = stream.str();
+        auto pData = str.data();
+        auto nLeft = str.size();
+        while (nLeft > 0)
+        {
+#ifdef _WIN32
+            auto const nWritten = ::_write(fd, pData, static_cast<unsigned>(nLeft));
+#else
+            auto const nWritten = ::write(fd, pData, nLeft);
+#endif
+            if (nWritten <= 0)
+                break;
+            pData += nWritten;
+            nLeft -= static_cast<std::size_t>(nWritten);
+        }
+        stream.str({});
+    }
+
+    void run()
+    {
+        while (true)
+        {
+            auto const bStop = m_bStop.load();
+            auto const nRequest = m_nFlushRequest.load();
+
+            auto const bDrained = drain_all();
+
+            m_nFlushDone.store(nRequest);
+
+            if (bStop)
+                break;
+
+            if (!bDrained)
+            {
+                auto lock = std::unique_lock{ m_wakeMutex };
+                m_wake.wait_for(lock, std::chrono::milliseconds{ 1 });
+            }
+        }
+    }
+
+    std::mutex m_ringsMutex;
+    std::vector<std::unique_ptr<LogRing>> m_rings;
+
+    std::ostringstream m_out;
+    std::ostringstream m_err;
+    log_sink m_lastSink = log_sink::out;
+
+    std::atomic<bool> m_bStop{ false };
+    std::atomic<std::uint64_t> m_nFlushRequest{ 0 };
+    std::atomic<std::uint64_t> m_nFlushDone{ 0 };
+    std::mutex m_wakeMutex;
+    std::condition_variable m_wake;
+
+    std::thread m_worker;
+};
+
+/*************
+ * log_write *
+ *************/
+
+template<log_level Level, typename...Ts>
+void log_write(log_sink sink, Ts&&...args)
+{
+    if constexpr (log_enabled<Level>)
+        AsyncLogger::instance().write(sink, std::forward<Ts>(args)...);
+}
+
+inline void log_flush()
+{
+    AsyncLogger::instance().flush();
+}
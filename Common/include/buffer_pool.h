@@ -0,0 +1,513 @@
+#pragma once
+
+#include "unique_handle.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#undef min
+#undef max
+#else
+#include <sys/mman.h>
+#endif
+
+class BufferPool;
+
+/**************
+ * PoolBuffer *
+ **************/
+
+// One page-aligned chunk, returned to its pool on destruction. Move-only, so a
+// chunk filled by recv can be handed on to a writer without copying the data.
+class PoolBuffer
+{
+public:
+    PoolBuffer() noexcept = default;
+
+    PoolBuffer(PoolBuffer&& other) noexcept
+        : m_pPool{ std::exchange(other.m_pPool, nullptr) }
+        , m_pData{ std::exchange(other.m_pData, nullptr) }
+        , m_nIndex{ other.m_nIndex }
+    {}
+
+    PoolBuffer& operator=(PoolBuffer&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            m_pPool = std::exchange(other.m_pPool, nullptr);
+            m_pData = std::exchange(other.m_pData, nullptr);
+            m_nIndex = other.m_nIndex;
+        }
+        return *this;
+    }
+
+    PoolBuffer(PoolBuffer const&) = delete;
+    PoolBuffer& operator=(PoolBuffer const&) = delete;
+
+    ~PoolBuffer() noexcept
+    {
+        reset();
+    }
+
+    inline void reset() noexcept;
+
+    char* data() const noexcept { return m_pData; }
+    inline std::size_t size() const noexcept;
+
+    explicit operator bool() const noexcept { return m_pData != nullptr; }
+
+private:
+    friend class BufferPool;
+
+    PoolBuffer(BufferPool* pPool, char* pData, std::uint32_t nIndex) noexcept
+        : m_pPool{ pPool }
+        , m_pData{ pData }
+        , m_nIndex{ nIndex }
+    {}
+
+    BufferPool*   m_pPool = nullptr;
+    char*         m_pData = nullptr;
+    std::uint32_t m_nIndex = 0;
+};
+
+/**************
+ * BufferPool *
+ **************/
+
+// Fixed-size chunks carved from one preallocated region. A chunk's pages are
+// faulted in the first time it is handed out, or all up front with bPrefault.
+//
+// Every thread keeps a small cache of free chunks, so acquire/release usually
+// touch no shared state. A cache holds at most the region's share of one of
+// nThreads threads, so a few threads cannot hoard it. Caches refill from and
+// spill to a global free list, a lock-free stack of chunk indices with an ABA
+// tag. When the region runs dry, chunks come from the heap instead of failing.
+//
+// The pool must outlive the buffers it handed out.
+class BufferPool
+{
+public:
+    struct Options
+    {
+        std::size_t nChunkSize  = std::size_t{ 1 } << 20;   // rounded up to whole pages
+        std::size_t nChunkCount = 64;
+        bool        bHugePages  = false;                   // MAP_HUGETLB / MEM_LARGE_PAGES, else THP advice
+        bool        bPrefault   = false;                   // fault the whole region in at construction
+        std::size_t nThreads    = std::max(std::thread::hardware_concurrency(), 1u);   // threads acquiring or releasing chunks
+    };
+
+    static constexpr std::size_t kPageSize = 4096;
+
+    explicit BufferPool(Options const& options)
+        : m_nChunkSize{ (std::max<std::size_t>(options.nChunkSize, 1) + kPageSize - 1) / kPageSize * kPageSize }
+        , m_nChunkCount{ static_cast<std::uint32_t>(std::min<std::size_t>(options.nChunkCount, kEmpty - 1)) }
+        , m_nId{ next_id() }
+    {
+        map_region(options.bHugePages, options.bPrefault);
+        if (!m_pRegion)
+            m_nChunkCount = 0;
+
+        // Below two a cache would only bounce chunks to and from the global list
+        m_nCacheLimit = static_cast<std::uint32_t>(std::min<std::size_t>(kCacheSize, m_nChunkCount / std::max<std::size_t>(options.nThreads, 1)));
+        if (m_nCacheLimit < 2)
+            m_nCacheLimit = 0;
+
+        m_touched = std::make_unique<std::atomic<bool>[]>(std::max<std::uint32_t>(m_nChunkCount, 1));
+        for (std::uint32_t i = 0; i < m_nChunkCount; ++i)
+            m_touched[i].store(options.bPrefault, std::memory_order_relaxed);
+
+        m_next = std::make_unique<std::atomic<std::uint32_t>[]>(std::max<std::uint32_t>(m_nChunkCount, 1));
+        for (std::uint32_t i = 0; i < m_nChunkCount; ++i)
+            m_next[i].store(i + 1 < m_nChunkCount ? i + 1 : kEmpty, std::memory_order_relaxed);
+        m_head.store(m_nChunkCount > 0 ? 0 : kEmpty, std::memory_order_release);
+
+        auto const lock = std::lock_guard<std::mutex>{ registry_mutex() };
+        registry().push_back(m_nId);
+    }
+
+    BufferPool(BufferPool const&) = delete;
+    BufferPool& operator=(BufferPool const&) = delete;
+
+    ~BufferPool() noexcept
+    {
+        {
+            auto const lock = std::lock_guard<std::mutex>{ registry_mutex() };
+            auto& ids = registry();
+            ids.erase(std::remove(ids.begin(), ids.end(), m_nId), ids.end());
+        }
+
+        // Other threads' caches go stale and are dropped when they see the id mismatch
+        if (auto pCache = find_cache(false))
+            pCache->pPool = nullptr;
+    }
+
+    PoolBuffer acquire()
+    {
+        auto nIndex = kEmpty;
+        if (auto pCache = m_nCacheLimit > 0 ? find_cache(true) : nullptr)
+        {
+            if (pCache->nCount == 0)
+            {
+                // Refill half the cache, so a release right after does not spill straight back
+                while (pCache->nCount < m_nCacheLimit / 2)
+                {
+                    auto const nPopped = pop_global();
+                    if (nPopped == kEmpty)
+                        break;
+                    pCache->indices[pCache->nCount++] = nPopped;
+                }
+            }
+            if (pCache->nCount > 0)
+                nIndex = pCache->indices[--pCache->nCount];
+        }
+        else
+        {
+            nIndex = pop_global();
+        }
+
+        if (nIndex != kEmpty)
+        {
+            auto const pData = m_pRegion + std::size_t{ nIndex } * m_nChunkSize;
+            if (!m_touched[nIndex].load(std::memory_order_relaxed))
+            {
+                // The caller owns the chunk now, nobody else touches the flag
+                touch(pData, m_nChunkSize);
+                m_touched[nIndex].store(true, std::memory_order_relaxed);
+            }
+            return PoolBuffer{ this, pData, nIndex };
+        }
+
+        m_nHeapChunks.fetch_add(1, std::memory_order_relaxed);
+        return PoolBuffer{ this, static_cast<char*>(::operator new(m_nChunkSize, std::align_val_t{ kPageSize })), kEmpty };
+    }
+
+    std::size_t chunk_size() const noexcept { return m_nChunkSize; }
+    std::size_t chunk_count() const noexcept { return m_nChunkCount; }
+    bool huge_pages() const noexcept { return m_bHugePages; }
+
+    // Chunks that had to come from the heap because the region was exhausted
+    std::size_t heap_chunks() const noexcept { return m_nHeapChunks.load(std::memory_order_relaxed); }
+
+private:
+    friend class PoolBuffer;
+
+    static constexpr std::uint32_t kEmpty = 0xFFFFFFFFu;
+    static constexpr std::uint32_t kCacheSize = 32;
+    static constexpr std::size_t kCacheSlots = 4;
+
+    struct ThreadCache
+    {
+        BufferPool*   pPool = nullptr;
+        std::uint64_t nPoolId = 0;
+        std::uint32_t nCount = 0;
+        std::array<std::uint32_t, kCacheSize> indices{};
+    };
+
+    // Hands cached chunks back when the thread exits, unless their pool is gone
+    struct ThreadCaches
+    {
+        std::array<ThreadCache, kCacheSlots> caches;
+
+        ~ThreadCaches()
+        {
+            auto const lock = std::lock_guard<std::mutex>{ registry_mutex() };
+            auto const& ids = registry();
+            for (auto& cache : caches)
+            {
+                if (cache.pPool && std::find(ids.cbegin(), ids.cend(), cache.nPoolId) != ids.cend())
+                {
+                    while (cache.nCount > 0)
+                        cache.pPool->push_global(cache.indices[--cache.nCount]);
+                }
+            }
+        }
+    };
+
+    void release(char* pData, std::uint32_t nIndex) noexcept
+    {
+        if (nIndex == kEmpty)
+        {
+            ::operator delete(pData, std::align_val_t{ kPageSize });
+            return;
+        }
+
+        if (auto pCache = m_nCacheLimit > 0 ? find_cache(true) : nullptr)
+        {
+            if (pCache->nCount >= m_nCacheLimit)
+            {
+                while (pCache->nCount > m_nCacheLimit / 2)
+                    push_global(pCache->indices[--pCache->nCount]);
+            }
+            pCache->indices[pCache->nCount++] = nIndex;
+        }
+        else
+        {
+            push_global(nIndex);
+        }
+    }
+
+    // This thread's cache for the pool, claiming a free or stale slot if bClaim
+    ThreadCache* find_cache(bool bClaim) noexcept
+    {
+        thread_local auto threadCaches = ThreadCaches{};
+
+        ThreadCache* pFree = nullptr;
+        for (auto& cache : threadCaches.caches)
+        {
+            if (cache.pPool == this && cache.nPoolId == m_nId)
+                return &cache;
+            if (!pFree && (!cache.pPool || (cache.pPool == this && cache.nPoolId != m_nId)))
+                pFree = &cache;
+        }
+
+        if (!bClaim || !pFree)
+            return nullptr;
+
+        pFree->pPool = this;
+        pFree->nPoolId = m_nId;
+        pFree->nCount = 0;
+        return pFree;
+    }
+
+    /***************
+     * global list *
+     ***************/
+
+    // head packs the top index with a tag bumped on every update
+    static std::uint64_t pack(std::uint32_t nIndex, std::uint64_t nHead) noexcept
+    {
+        return (((nHead >> 32) + 1) << 32) | nIndex;
+    }
+
+    std::uint32_t pop_global() noexcept
+    {
+        auto nHead = m_head.load(std::memory_order_acquire);
+        for (;;)
+        {
+            auto const nIndex = static_cast<std::uint32_t>(nHead);
+            if (nIndex == kEmpty)
+                return kEmpty;
+
+            // A stale read here is caught by the tag in the compare-exchange
+            auto const nNext = m_next[nIndex].load(std::memory_order_relaxed);
+            if (m_head.compare_exchange_weak(nHead, pack(nNext, nHead), std::memory_order_acq_rel, std::memory_order_acquire))
+                return nIndex;
+        }
+    }
+
+    void push_global(std::uint32_t nIndex) noexcept
+    {
+        auto nHead = m_head.load(std::memory_order_relaxed);
+        do
+        {
+            m_next[nIndex].store(static_cast<std::uint32_t>(nHead), std::memory_order_relaxed);
+        } while (!m_head.compare_exchange_weak(nHead, pack(nIndex, nHead), std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    /**********
+     * region *
+     **********/
+
+    // Writes one byte per page, committed or reserved pages fault here and not mid-transfer
+    static void touch(char* pData, std::size_t nBytes) noexcept
+    {
+        auto pTouch = static_cast<char volatile*>(pData);
+        for (std::size_t nOffset = 0; nOffset < nBytes; nOffset += kPageSize)
+            pTouch[nOffset] = 0;
+    }
+
+    void map_region(bool bHugePages, bool bPrefault)
+    {
+        auto const nBytes = m_nChunkSize * m_nChunkCount;
+        if (nBytes == 0)
+            return;
+
+#ifdef _WIN32
+        if (bHugePages)
+        {
+            auto const nLargePage = GetLargePageMinimum();
+            if (nLargePage > 0)
+            {
+                auto const nLargeBytes = (nBytes + nLargePage - 1) / nLargePage * nLargePage;
+                m_region.reset(VirtualAlloc(nullptr, nLargeBytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE));
+                m_bHugePages = static_cast<bool>(m_region);
+            }
+        }
+        if (!m_region)
+        {
+            m_region.reset(VirtualAlloc(nullptr, nBytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+            if (!m_region)
+                return;
+
+            if (bPrefault)
+                touch(static_cast<char*>(m_region.get()), nBytes);
+        }
+        m_pRegion = static_cast<char*>(m_region.get());
+#else
+        if (bHugePages)
+        {
+            constexpr auto nHugePage = std::size_t{ 2 } << 20;
+            auto const nHugeBytes = (nBytes + nHugePage - 1) / nHugePage * nHugePage;
+            auto const pData = ::mmap(nullptr, nHugeBytes, PROT_READ | PROT_WRITE,
+                                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (bPrefault ? MAP_POPULATE : 0), -1, 0);
+            if (pData != MAP_FAILED)
+            {
+                m_region.reset(mapped_region{ pData, nHugeBytes });
+                m_bHugePages = true;
+            }
+        }
+        if (!m_region)
+        {
+            auto const pData = ::mmap(nullptr, nBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (pData == MAP_FAILED)
+                return;
+            m_region.reset(mapped_region{ pData, nBytes });
+
+            // Transparent huge pages where the kernel allows it
+            if (bHugePages)
+                ::madvise(pData, nBytes, MADV_HUGEPAGE);
+            if (bPrefault)
+            {
+                ::madvise(pData, nBytes, MADV_WILLNEED);
+                touch(static_cast<char*>(pData), nBytes);
+            }
+        }
+        m_pRegion = static_cast<char*>(m_region.get().pData);
+#endif
+    }
+
+    static std::uint64_t next_id() noexcept
+    {
+        static auto nNextId = std::atomic<std::uint64_t>{ 1 };
+        return nNextId.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static std::mutex& registry_mutex()
+    {
+        static auto mutex = std::mutex{};
+        return mutex;
+    }
+
+    // Ids of live pools, consulted only at thread exit
+    static std::vector<std::uint64_t>& registry()
+    {
+        static auto ids = std::vector<std::uint64_t>{};
+        return ids;
+    }
+
+#ifdef _WIN32
+    struct virtual_alloc_traits
+    {
+        using handle_type = void*;
+        static constexpr handle_type invalid() noexcept { return nullptr; }
+        static void close(handle_type h) noexcept { VirtualFree(h, 0, MEM_RELEASE); }
+    };
+
+    unique_handle<virtual_alloc_traits> m_region;
+#else
+    unique_mapping m_region;
+#endif
+
+    std::size_t   m_nChunkSize;
+    std::uint32_t m_nChunkCount;
+    std::uint64_t m_nId;
+    char*         m_pRegion = nullptr;
+    bool          m_bHugePages = false;
+    std::uint32_t m_nCacheLimit = 0;
+
+    std::unique_ptr<std::atomic<std::uint32_t>[]> m_next;
+    std::unique_ptr<std::atomic<bool>[]> m_touched;   // chunk's pages have been faulted in
+    std::atomic<std::uint64_t> m_head{ kEmpty };
+    std::atomic<std::size_t>   m_nHeapChunks{ 0 };
+};
+
+inline void PoolBuffer::reset() noexcept
+{
+    if (m_pPool)
+        m_pPool->release(m_pData, m_nIndex);
+    m_pPool = nullptr;
+    m_pData = nullptr;
+}
+
+inline std::size_t PoolBuffer::size() const noexcept
+{
+    return m_pPool ? m_pPool->chunk_size() : 0;
+}
+
+/***************
+ * BufferChain *
+ ***************/
+
+// A file-sized byte range spread over pool chunks. Chunks are kept between
+// assign() calls, so a session reuses the same memory for every file.
+class BufferChain
+{
+public:
+    // False for a negative size, the chain is left empty then
+    bool assign(BufferPool& pool, std::int64_t nBytes)
+    {
+        if (nBytes < 0)
+        {
+            m_chunks.clear();
+            m_nSize = 0;
+            return false;
+        }
+
+        auto const nChunkSize = static_cast<std::int64_t>(pool.chunk_size());
+        auto const nChunks = static_cast<std::size_t>((nBytes + nChunkSize - 1) / nChunkSize);
+
+        if (m_pPool != &pool)
+            m_chunks.clear();
+        m_pPool = &pool;
+
+        if (m_chunks.size() > nChunks)
+            m_chunks.resize(nChunks);
+        while (m_chunks.size() < nChunks)
+            m_chunks.push_back(pool.acquire());
+
+        m_nSize = nBytes;
+        return true;
+    }
+
+    // Contiguous writable bytes starting at nOffset, up to the end of its chunk or of the range
+    std::pair<char*, std::int64_t> span_at(std::int64_t nOffset) const noexcept
+    {
+        auto const nChunkSize = static_cast<std::int64_t>(m_pPool->chunk_size());
+        auto const nInChunk = nOffset % nChunkSize;
+        return { m_chunks[static_cast<std::size_t>(nOffset / nChunkSize)].data() + nInChunk
+               , std::min(nChunkSize - nInChunk, m_nSize - nOffset) };
+    }
+
+    // Calls func(char*, std::int64_t) for every chunk's share of the range, in order
+    template<typename TFunc>
+    bool for_each_span(TFunc&& func) const
+    {
+        for (auto nOffset = std::int64_t{ 0 }; nOffset < m_nSize; )
+        {
+            auto const span = span_at(nOffset);
+            if (!func(span.first, span.second))
+                return false;
+            nOffset += span.second;
+        }
+        return true;
+    }
+
+    std::int64_t size() const noexcept { return m_nSize; }
+
+private:
+    BufferPool*             m_pPool = nullptr;
+    std::vector<PoolBuffer> m_chunks;
+    std::int64_t            m_nSize = 0;
+};
@@ -0,0 +1,358 @@
+#pragma once
+
+#include "buffer_pool.h"
+#include "utils.h"
+#include "xxh64.h"
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#undef min
+#undef max
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace detail_chunk_store
+{
+    // 128 bit content address as 32 hex digits
+    inline std::string content_id(void const* pData, std::size_t nSize)
+    {
+        auto strId = std::string(32, '0');
+        auto const nLow = xxh64(pData, nSize, 0);
+        auto const nHigh = xxh64(pData, nSize, 0x9E3779B97F4A7C15ull);
+        for (int i = 0; i < 16; ++i)
+        {
+            strId[i] = "0123456789abcdef"[(nHigh >> (60 - 4 * i)) & 0xF];
+            strId[16 + i] = "0123456789abcdef"[(nLow >> (60 - 4 * i)) & 0xF];
+        }
+        return strId;
+    }
+
+    inline bool make_directory(std::string const& strPath)
+    {
+#ifdef _WIN32
+        return CreateDirectoryA(strPath.c_str(), nullptr) != 0 || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+        return ::mkdir(strPath.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+    }
+
+    inline bool file_exists(std::string const& strPath)
+    {
+#ifdef _WIN32
+        return GetFileAttributesA(strPath.c_str()) != INVALID_FILE_ATTRIBUTES;
+#else
+        struct stat fileStat;
+        return ::stat(strPath.c_str(), &fileStat) == 0;
+#endif
+    }
+
+    inline bool hard_link(std::string const& strTarget, std::string const& strLink)
+    {
+#ifdef _WIN32
+        return CreateHardLinkA(strLink.c_str(), strTarget.c_str(), nullptr) != 0;
+#else
+        return ::link(strTarget.c_str(), strLink.c_str()) == 0;
+#endif
+    }
+}
+
+/***************
+ * GearChunker *
+ ***************/
+
+// Content-defined chunking with a gear rolling hash (FastCDC): a boundary is
+// placed where the hash of the last 64 bytes matches a mask, so an insert
+// or delete only moves the boundaries next to it. The mask is stricter before
+// the average size and looser after it, which keeps chunk sizes close to the
+// average.
+class GearChunker
+{
+public:
+    struct Options
+    {
+        std::size_t nMinSize = 16 * 1024;
+        std::size_t nAvgSize = 64 * 1024;   // a power of two
+        std::size_t nMaxSize = 256 * 1024;
+    };
+
+    explicit GearChunker(Options const& options)
+        : m_options{ options }
+    {
+        auto nBits = 0;
+        while ((std::size_t{ 1 } << (nBits + 1)) <= options.nAvgSize)
+            ++nBits;
+
+        m_nMaskSmall = top_bits(nBits + 2);
+        m_nMaskLarge = top_bits(nBits > 2 ? nBits - 2 : 1);
+    }
+
+    // How many of the nSize bytes belong to the current chunk; bCut is set
+    // when the chunk ends there and the next call starts a new one
+    std::size_t next(unsigned char const* p, std::size_t nSize, bool& bCut) noexcept
+    {
+        auto const& gear = table();
+
+        bCut = false;
+        for (std::size_t i = 0; i < nSize; ++i)
+        {
+            if (++m_nLength <= m_options.nMinSize)
+                continue;
+
+            m_nHash = (m_nHash << 1) + gear[p[i]];
+            auto const nMask = m_nLength < m_options.nAvgSize ? m_nMaskSmall : m_nMaskLarge;
+            if ((m_nHash & nMask) == 0 || m_nLength >= m_options.nMaxSize)
+            {
+                bCut = true;
+                m_nLength = 0;
+                m_nHash = 0;
+                return i + 1;
+            }
+        }
+        return nSize;
+    }
+
+    std::size_t max_size() const noexcept { return m_options.nMaxSize; }
+
+private:
+    static std::uint64_t top_bits(int nBits) noexcept
+    {
+        return ~std::uint64_t{ 0 } << (64 - nBits);
+    }
+
+    static std::array<std::uint64_t, 256> const& table() noexcept
+    {
+        static auto const s_table = []()
+        {
+            auto table = std::array<std::uint64_t, 256>{};
+            auto nState = std::uint64_t{ 0x6F73327661723267ull };
+            for (auto& nValue : table)
+            {
+                auto z = (nState += 0x9E3779B97F4A7C15ull);
+                z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+                z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+                nValue = z ^ (z >> 31);
+            }
+            return table;
+        } ();
+        return s_table;
+    }
+
+    Options       m_options;
+    std::uint64_t m_nMaskSmall = 0;
+    std::uint64_t m_nMaskLarge = 0;
+    std::uint64_t m_nHash = 0;
+    std::size_t   m_nLength = 0;
+};
+
+/**************
+ * ChunkStore *
+ **************/
+
+// Content-addressed store for received files. A file is cut into chunks by
+// GearChunker and every chunk is kept once under chunks/<id[0..1]>/<id>. The
+// file itself becomes a manifest listing its chunks, also stored once under
+// manifests/<id>, and the out_ file is a hard link to that manifest (a copy
+// where links are not supported). Sending the same file again writes nothing
+// but a link; a modified file writes only the chunks around the changes.
+//
+// Manifest: "os2var2-manifest 1 <file size>", then "<chunk id> <chunk size>" per line.
+class ChunkStore
+{
+public:
+    struct Stats
+    {
+        std::uint64_t nFiles = 0;
+        std::uint64_t nNewFiles = 0;
+        std::uint64_t nChunks = 0;
+        std::uint64_t nNewChunks = 0;
+        std::uint64_t nBytes = 0;
+        std::uint64_t nNewBytes = 0;
+    };
+
+    explicit ChunkStore(std::string strRoot, GearChunker::Options const& options = GearChunker::Options{})
+        : m_strRoot{ std::move(strRoot) }
+        , m_options{ options }
+    {}
+
+    // Creates the directory layout
+    bool open()
+    {
+        auto bResult = detail_chunk_store::make_directory(m_strRoot)
+                    && detail_chunk_store::make_directory(m_strRoot + "/chunks")
+                    && detail_chunk_store::make_directory(m_strRoot + "/manifests");
+
+        for (int i = 0; i < 256 && bResult; ++i)
+            bResult = detail_chunk_store::make_directory(m_strRoot + "/chunks/" + hex_byte(i));
+
+        return bResult;
+    }
+
+    // Stores data and makes strFileName its manifest; safe to call from several threads
+    bool store(std::string const& strFileName, BufferChain const& data)
+    {
+        auto chunker = GearChunker{ m_options };
+        auto scratch = std::vector<char>{};
+        scratch.reserve(chunker.max_size());
+
+        auto strManifest = "os2var2-manifest 1 " + std::to_string(data.size()) + "\n";
+
+        auto const putChunk = [&]()
+        {
+            auto const strId = detail_chunk_store::content_id(scratch.data(), scratch.size());
+            strManifest += strId + " " + std::to_string(scratch.size()) + "\n";
+
+            m_nChunks.fetch_add(1, std::memory_order_relaxed);
+            m_nBytes.fetch_add(scratch.size(), std::memory_order_relaxed);
+
+            auto const bNew = put_object(chunk_path(strId), scratch.data(), scratch.size());
+            if (bNew)
+            {
+                m_nNewChunks.fetch_add(1, std::memory_order_relaxed);
+                m_nNewBytes.fetch_add(scratch.size(), std::memory_order_relaxed);
+            }
+            scratch.clear();
+            return bNew || detail_chunk_store::file_exists(chunk_path(strId));
+        };
+
+        // The rolling hash runs across pool chunk boundaries
+        auto const bStored = data.for_each_span([&](char const* pData, std::int64_t nBytes)
+        {
+            auto p = reinterpret_cast<unsigned char const*>(pData);
+            auto nLeft = static_cast<std::size_t>(nBytes);
+            while (nLeft > 0)
+            {
+                auto bCut = false;
+                auto const nTaken = chunker.next(p, nLeft, bCut);
+                scratch.insert(scratch.end(), p, p + nTaken);
+                p += nTaken;
+                nLeft -= nTaken;
+
+                if (bCut && !putChunk())
+                    return false;
+            }
+            return true;
+        }) && (scratch.empty() || putChunk());
+
+        if (!bStored)
+        {
+            print_err("Failed to store chunks of ", strFileName);
+            return false;
+        }
+
+        auto const strManifestPath = m_strRoot + "/manifests/" + detail_chunk_store::content_id(strManifest.data(), strManifest.size());
+        m_nFiles.fetch_add(1, std::memory_order_relaxed);
+        if (put_object(strManifestPath, strManifest.data(), strManifest.size()))
+            m_nNewFiles.fetch_add(1, std::memory_order_relaxed);
+
+        std::remove(strFileName.c_str());
+        if (detail_chunk_store::hard_link(strManifestPath, strFileName))
+            return true;
+
+        auto fout = std::ofstream{ strFileName, std::ios::binary | std::ios::trunc };
+        fout.write(strManifest.data(), static_cast<std::streamsize>(strManifest.size()));
+        if (!fout.flush())
+        {
+            print_err("Failed to write manifest ", strFileName);
+            return false;
+        }
+        return true;
+    }
+
+    // Rebuilds the original file from a manifest
+    bool restore(std::string const& strManifestName, std::string const& strFileName) const
+    {
+        auto fin = std::ifstream{ strManifestName };
+        auto strMagic = std::string{};
+        auto nVersion = 0;
+        auto nSize = std::int64_t{};
+        if (!(fin >> strMagic >> nVersion >> nSize) || strMagic != "os2var2-manifest" || nVersion != 1)
+            return false;
+
+        auto fout = std::ofstream{ strFileName, std::ios::binary | std::ios::trunc };
+        auto strId = std::string{};
+        auto nChunkSize = std::int64_t{};
+        auto nWritten = std::int64_t{ 0 };
+        while (fin >> strId >> nChunkSize)
+        {
+            auto chunk = std::ifstream{ chunk_path(strId), std::ios::binary };
+            if (!(fout << chunk.rdbuf()))
+                return false;
+            nWritten += nChunkSize;
+        }
+        return nWritten == nSize && static_cast<bool>(fout.flush());
+    }
+
+    Stats stats() const noexcept
+    {
+        auto stats = Stats{};
+        stats.nFiles = m_nFiles.load(std::memory_order_relaxed);
+        stats.nNewFiles = m_nNewFiles.load(std::memory_order_relaxed);
+        stats.nChunks = m_nChunks.load(std::memory_order_relaxed);
+        stats.nNewChunks = m_nNewChunks.load(std::memory_order_relaxed);
+        stats.nBytes = m_nBytes.load(std::memory_order_relaxed);
+        stats.nNewBytes = m_nNewBytes.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+private:
+    static std::string hex_byte(int nByte)
+    {
+        return { "0123456789abcdef"[nByte >> 4], "0123456789abcdef"[nByte & 0xF] };
+    }
+
+    std::string chunk_path(std::string const& strId) const
+    {
+        return m_strRoot + "/chunks/" + strId.substr(0, 2) + "/" + strId;
+    }
+
+    // Writes the object unless it exists, returns whether it was written. Written
+    // under a temporary name first, so a reader never sees half an object and two
+    // writers of the same object do not get in each other's way.
+    bool put_object(std::string const& strPath, char const* pData, std::size_t nSize)
+    {
+        if (detail_chunk_store::file_exists(strPath))
+            return false;
+
+        auto const strTemp = strPath + ".tmp" + std::to_string(m_nTempCounter.fetch_add(1, std::memory_order_relaxed));
+        {
+            auto fout = std::ofstream{ strTemp, std::ios::binary | std::ios::trunc };
+            fout.write(pData, static_cast<std::streamsize>(nSize));
+            if (!fout.flush())
+            {
+                fout.close();
+                std::remove(strTemp.c_str());
+                return false;
+            }
+        }
+
+        // Someone else may have stored it meanwhile, the content is the same either way
+        if (std::rename(strTemp.c_str(), strPath.c_str()) != 0)
+        {
+            std::remove(strTemp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    std::string          m_strRoot;
+    GearChunker::Options m_options;
+
+    std::atomic<std::uint64_t> m_nTempCounter{ 0 };
+    std::atomic<std::uint64_t> m_nFiles{ 0 };
+    std::atomic<std::uint64_t> m_nNewFiles{ 0 };
+    std::atomic<std::uint64_t> m_nChunks{ 0 };
+    std::atomic<std::uint64_t> m_nNewChunks{ 0 };
+    std::atomic<std::uint64_t> m_nBytes{ 0 };
+    std::atomic<std::uint64_t> m_nNewBytes{ 0 };
+};
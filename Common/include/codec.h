@@ -0,0 +1,900 @@
+#pragma once
+
+#include <nlohmann/json.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A type opts in by declaring its members once:
+//
+//     static constexpr auto fields()
+//     {
+//         return std::make_tuple(codec_field("name", &Type::name),
+//                                codec_optional("size", &Type::size));
+//     }
+//
+// and gets JSON (DOM and SAX), MessagePack, CBOR and a fixed layout binary
+// encoding from that declaration. std::optional members are always optional.
+
+/*******************
+ * FieldDescriptor *
+ *******************/
+
+template<typename TClass, typename TMember>
+struct FieldDescriptor
+{
+    using class_type  = TClass;
+    using member_type = TMember;
+
+    std::string_view  name;
+    TMember TClass::* member;
+    bool              required;
+};
+
+template<typename TClass, typename TMember>
+constexpr auto codec_field(std::string_view name, TMember TClass::* member)
+{
+    return FieldDescriptor<TClass, TMember>{ name, member, true };
+}
+
+// Missing in the input keeps the member's current value
+template<typename TClass, typename TMember>
+constexpr auto codec_optional(std::string_view name, TMember TClass::* member)
+{
+    return FieldDescriptor<TClass, TMember>{ name, member, false };
+}
+
+/**********
+ * traits *
+ **********/
+
+template<typename T, typename = void>
+struct has_codec_fields : std::false_type {};
+
+template<typename T>
+struct has_codec_fields<T, std::void_t<decltype(T::fields())>> : std::true_type {};
+
+template<typename T>
+struct is_std_optional : std::false_type {};
+
+template<typename T>
+struct is_std_optional<std::optional<T>> : std::true_type {};
+
+template<typename T>
+struct is_std_vector : std::false_type {};
+
+template<typename T, typename A>
+struct is_std_vector<std::vector<T, A>> : std::true_type {};
+
+template<typename T>
+constexpr std::size_t codec_field_count = std::tuple_size_v<decltype(T::fields())>;
+
+template<typename TField>
+constexpr bool codec_is_required(TField const& field) noexcept
+{
+    return field.required && !is_std_optional<typename TField::member_type>::value;
+}
+
+// The JSON type a member accepts, same checks the JSON_GET_AND_PARSE macros used to take
+template<typename T>
+constexpr auto json_type_check() noexcept
+{
+    if constexpr (std::is_same_v<T, bool>)
+        return &nlohmann::json::is_boolean;
+    else if constexpr (std::is_integral_v<T> && std::is_unsigned_v<T>)
+        return &nlohmann::json::is_number_unsigned;
+    else if constexpr (std::is_integral_v<T>)
+        return &nlohmann::json::is_number_integer;
+    else if constexpr (std::is_floating_point_v<T>)
+        return &nlohmann::json::is_number;
+    else if constexpr (std::is_same_v<T, std::string>)
+        return &nlohmann::json::is_string;
+    else if constexpr (is_std_vector<T>::value)
+        return &nlohmann::json::is_array;
+    else
+    {
+        static_assert(has_codec_fields<T>::value, "member type has no codec");
+        return &nlohmann::json::is_object;
+    }
+}
+
+/****************
+ * PerfectHash *
+ ****************/
+
+constexpr std::uint32_t codec_hash(std::string_view str, std::uint32_t nSeed) noexcept
+{
+    auto nHash = std::uint32_t{ 2166136261u } ^ (nSeed * 0x9E3779B9u);
+    for (auto const c : str)
+    {
+        nHash ^= static_cast<unsigned char>(c);
+        nHash *= 16777619u;
+    }
+    return nHash ^ (nHash >> 15);
+}
+
+// Collision free table from key to field index, seed searched at compile time
+template<std::size_t N>
+struct PerfectHash
+{
+    static constexpr std::size_t nSlots = [] {
+        auto n = std::size_t{ 1 };
+        while (n < 2 * N)
+            n <<= 1;
+        return n;
+    } ();
+
+    std::array<std::string_view, N> names{};
+    std::array<int, nSlots>          slots{};
+    std::uint32_t                    seed = 0;
+
+    constexpr int find(std::string_view key) const noexcept
+    {
+        auto const nIndex = slots[codec_hash(key, seed) & (nSlots - 1)];
+        return nIndex >= 0 && names[static_cast<std::size_t>(nIndex)] == key ? nIndex : -1;
+    }
+};
+
+template<std::size_t N>
+constexpr PerfectHash<N> make_perfect_hash(std::array<std::string_view, N> const& names)
+{
+    auto hash = PerfectHash<N>{};
+    hash.names = names;
+
+    for (std::uint32_t nSeed = 0; ; ++nSeed)
+    {
+        for (auto& nSlot : hash.slots)
+            nSlot = -1;
+
+        auto bCollision = false;
+        for (std::size_t i = 0; i < N && !bCollision; ++i)
+        {
+            auto& nSlot = hash.slots[codec_hash(names[i], nSeed) & (PerfectHash<N>::nSlots - 1)];
+            bCollision = nSlot != -1;
+            nSlot = static_cast<int>(i);
+        }
+
+        if (!bCollision)
+        {
+            hash.seed = nSeed;
+            return hash;
+        }
+    }
+}
+
+template<typename T>
+struct CodecKeys
+{
+    static constexpr auto names = std::apply([](auto const&...fields)
+    {
+        return std::array<std::string_view, sizeof...(fields)>{ fields.name... };
+    }, T::fields());
+
+    static constexpr auto hash = make_perfect_hash(names);
+};
+
+/********
+ * JSON *
+ ********/
+
+template<typename T>
+nlohmann::json codec_to_json(T const& obj);
+
+template<typename T>
+bool codec_from_json(nlohmann::json const& json, T& obj);
+
+template<typename T>
+nlohmann::json codec_write_value(T const& value)
+{
+    if constexpr (has_codec_fields<T>::value)
+        return codec_to_json(value);
+    else if constexpr (is_std_vector<T>::value)
+    {
+        auto array = nlohmann::json::array();
+        for (auto const& element : value)
+            array.push_back(codec_write_value(element));
+        return array;
+    }
+    else
+        return nlohmann::json(value);
+}
+
+template<typename T>
+bool codec_read_value(nlohmann::json const& json, T& value)
+{
+    if constexpr (is_std_optional<T>::value)
+    {
+        if (json.is_null())
+        {
+            value.reset();
+            return true;
+        }
+
+        auto inner = typename T::value_type{};
+        if (!codec_read_value(json, inner))
+            return false;
+        value = std::move(inner);
+        return true;
+    }
+    else
+    {
+        if (!(json.*json_type_check<T>())())
+            return false;
+
+        if constexpr (has_codec_fields<T>::value)
+            return codec_from_json(json, value);
+        else if constexpr (is_std_vector<T>::value)
+        {
+            auto result = T{};
+            result.reserve(json.size());
+            for (auto const& element : json)
+            {
+                if (!codec_read_value(element, result.emplace_back()))
+                    return false;
+            }
+            value = std::move(result);
+            return true;
+        }
+        else
+        {
+            value = json.get<T>();
+            return true;
+        }
+    }
+}
+
+template<typename T>
+nlohmann::json codec_to_json(T const& obj)
+{
+    auto json = nlohmann::json::object();
+    std::apply([&](auto const&...fields)
+    {
+        auto const write = [&](auto const& field)
+        {
+            auto const& value = obj.*field.member;
+            if constexpr (is_std_optional<std::decay_t<decltype(value)>>::value)
+            {
+                if (value)
+                    json[std::string{ field.name }] = codec_write_value(*value);
+            }
+            else
+                json[std::string{ field.name }] = codec_write_value(value);
+        };
+        (write(fields), ...);
+    }, T::fields());
+    return json;
+}
+
+namespace detail_codec
+{
+    template<typename T, std::size_t I>
+    bool read_field(nlohmann::json const& json, T& obj)
+    {
+        constexpr auto field = std::get<I>(T::fields());
+        return codec_read_value(json, obj.*field.member);
+    }
+
+    template<typename T, std::size_t...Is>
+    constexpr auto make_json_readers(std::index_sequence<Is...>)
+    {
+        return std::array<bool(*)(nlohmann::json const&, T&), sizeof...(Is)>{ &read_field<T, Is>... };
+    }
+
+    template<typename T, std::size_t...Is>
+    constexpr auto make_required_mask(std::index_sequence<Is...>)
+    {
+        return std::array<bool, sizeof...(Is)>{ codec_is_required(std::get<Is>(T::fields()))... };
+    }
+
+    template<typename T>
+    constexpr auto required_mask = make_required_mask<T>(std::make_index_sequence<codec_field_count<T>>{});
+}
+
+// Walks the object once and dispatches every key through the perfect hash.
+// Fails on a missing required member or a member of the wrong type; unknown keys are ignored.
+template<typename T>
+bool codec_from_json(nlohmann::json const& json, T& obj)
+{
+    constexpr auto nFields = codec_field_count<T>;
+    static constexpr auto readers = detail_codec::make_json_readers<T>(std::make_index_sequence<nFields>{});
+
+    if (!json.is_object())
+        return false;
+
+    auto seen = std::array<bool, nFields>{};
+    auto bResult = true;
+
+    for (auto const& item : json.items())
+    {
+        auto const nIndex = CodecKeys<T>::hash.find(item.key());
+        if (nIndex < 0)
+            continue;
+
+        seen[nIndex] = true;
+        bResult &= readers[nIndex](item.value(), obj);
+    }
+
+    for (std::size_t i = 0; i < nFields; ++i)
+        bResult &= seen[i] || !detail_codec::required_mask<T>[i];
+
+    return bResult;
+}
+
+/************
+ * CodecSax *
+ ************/
+
+template<typename T>
+class CodecSax;
+
+namespace detail_codec
+{
+    // A nested object member is parsed by its own CodecSax, reached through this
+    class SaxNode
+    {
+    public:
+        virtual ~SaxNode() = default;
+
+        virtual bool null() = 0;
+        virtual bool boolean(bool val) = 0;
+        virtual bool number_integer(nlohmann::json::number_integer_t val) = 0;
+        virtual bool number_unsigned(nlohmann::json::number_unsigned_t val) = 0;
+        virtual bool number_float(nlohmann::json::number_float_t val, nlohmann::json::string_t const& str) = 0;
+        virtual bool string(nlohmann::json::string_t& val) = 0;
+        virtual bool start_object(std::size_t nElements) = 0;
+        virtual bool key(nlohmann::json::string_t& val) = 0;
+        virtual bool end_object() = 0;
+        virtual bool start_array(std::size_t nElements) = 0;
+        virtual bool end_array() = 0;
+
+        virtual bool is_complete() const noexcept = 0;
+        virtual std::size_t depth() const noexcept = 0;
+    };
+
+    // Scalar assignment with the same acceptance rules as json_type_check
+    template<typename TMember, typename TValue>
+    bool assign(TMember& member, TValue& value)
+    {
+        using Value = std::decay_t<TValue>;
+
+        if constexpr (is_std_optional<TMember>::value)
+        {
+            auto inner = typename TMember::value_type{};
+            if (!assign(inner, value))
+                return false;
+            member = std::move(inner);
+            return true;
+        }
+        else if constexpr (std::is_same_v<TMember, bool>)
+        {
+            if constexpr (std::is_same_v<Value, bool>)
+            {
+                member = value;
+                return true;
+            }
+            return false;
+        }
+        else if constexpr (std::is_integral_v<TMember> && std::is_unsigned_v<TMember>)
+        {
+            if constexpr (std::is_same_v<Value, nlohmann::json::number_unsigned_t>)
+            {
+                member = static_cast<TMember>(value);
+                return true;
+            }
+            return false;
+        }
+        else if constexpr (std::is_integral_v<TMember>)
+        {
+            if constexpr (std::is_same_v<Value, nlohmann::json::number_unsigned_t> || std::is_same_v<Value, nlohmann::json::number_integer_t>)
+            {
+                member = static_cast<TMember>(value);
+                return true;
+            }
+            return false;
+        }
+        else if constexpr (std::is_floating_point_v<TMember>)
+        {
+            if constexpr (std::is_arithmetic_v<Value> && !std::is_same_v<Value, bool>)
+            {
+                member = static_cast<TMember>(value);
+                return true;
+            }
+            return false;
+        }
+        else if constexpr (std::is_same_v<TMember, std::string>)
+        {
+            if constexpr (std::is_same_v<Value, std::string>)
+            {
+                member = std::move(value);
+                return true;
+            }
+            return false;
+        }
+        else
+            return false;
+    }
+
+    // bElement: the value is an element of an array member
+    template<typename T, std::size_t I, typename TValue>
+    bool sax_field(T& obj, TValue& value, bool bElement)
+    {
+        constexpr auto field = std::get<I>(T::fields());
+        auto& member = obj.*field.member;
+
+        if constexpr (is_std_vector<std::decay_t<decltype(member)>>::value)
+        {
+            if (!bElement)
+                return false;
+            if (assign(member.emplace_back(), value))
+                return true;
+            member.pop_back();
+            return false;
+        }
+        else
+            return !bElement && assign(member, value);
+    }
+
+    template<typename T, typename TValue, std::size_t...Is>
+    constexpr auto make_sax_setters(std::index_sequence<Is...>)
+    {
+        return std::array<bool(*)(T&, TValue&, bool), sizeof...(Is)>{ &sax_field<T, Is, TValue>... };
+    }
+
+    template<typename T, std::size_t I>
+    void clear_array(T& obj)
+    {
+        constexpr auto field = std::get<I>(T::fields());
+        if constexpr (is_std_vector<std::decay_t<decltype(obj.*field.member)>>::value)
+            (obj.*field.member).clear();
+    }
+
+    template<typename T, std::size_t...Is>
+    constexpr auto make_array_clearers(std::index_sequence<Is...>)
+    {
+        return std::array<void(*)(T&), sizeof...(Is)>{ &clear_array<T, Is>... };
+    }
+
+    template<typename T, std::size_t I>
+    constexpr bool is_array_field()
+    {
+        return is_std_vector<typename std::tuple_element_t<I, decltype(T::fields())>::member_type>::value;
+    }
+
+    template<typename T, std::size_t...Is>
+    constexpr auto make_array_mask(std::index_sequence<Is...>)
+    {
+        return std::array<bool, sizeof...(Is)>{ is_array_field<T, Is>()... };
+    }
+
+    // Parser for an object arriving at member I, or at a new element of it; null if the member takes no object
+    template<typename T, std::size_t I>
+    std::unique_ptr<SaxNode> open_object(T& obj, bool bElement)
+    {
+        constexpr auto field = std::get<I>(T::fields());
+        using Member = typename std::decay_t<decltype(field)>::member_type;
+        auto& member = obj.*field.member;
+
+        if constexpr (is_std_vector<Member>::value)
+        {
+            if constexpr (has_codec_fields<typename Member::value_type>::value)
+            {
+                if (bElement)
+                    return std::make_unique<CodecSax<typename Member::value_type>>(member.emplace_back());
+            }
+        }
+        else if constexpr (is_std_optional<Member>::value)
+        {
+            if constexpr (has_codec_fields<typename Member::value_type>::value)
+            {
+                if (!bElement)
+                    return std::make_unique<CodecSax<typename Member::value_type>>(member.emplace());
+            }
+        }
+        else if constexpr (has_codec_fields<Member>::value)
+        {
+            if (!bElement)
+                return std::make_unique<CodecSax<Member>>(member);
+        }
+        return nullptr;
+    }
+
+    template<typename T, std::size_t...Is>
+    constexpr auto make_object_openers(std::index_sequence<Is...>)
+    {
+        return std::array<std::unique_ptr<SaxNode>(*)(T&, bool), sizeof...(Is)>{ &open_object<T, Is>... };
+    }
+}
+
+// SAX consumer binding the members of T without a DOM. Works for every
+// input format of nlohmann::json::sax_parse (JSON, MessagePack, CBOR, ...).
+// Nested codec objects, optional ones and arrays of them are handed to a
+// CodecSax of their own type for as long as the object lasts.
+template<typename T>
+class CodecSax : public detail_codec::SaxNode
+{
+public:
+    using number_integer_t  = nlohmann::json::number_integer_t;
+    using number_unsigned_t = nlohmann::json::number_unsigned_t;
+    using number_float_t    = nlohmann::json::number_float_t;
+    using string_t          = nlohmann::json::string_t;
+
+    explicit CodecSax(T& obj) noexcept
+        : m_obj{ obj }
+    {}
+
+    bool null() override                                 { return m_pChild ? to_child([&](auto& child) { return child.null(); }) : value(nullptr); }
+    bool boolean(bool val) override                      { return m_pChild ? to_child([&](auto& child) { return child.boolean(val); }) : value(val); }
+    bool number_integer(number_integer_t val) override   { return m_pChild ? to_child([&](auto& child) { return child.number_integer(val); }) : value(val); }
+    bool number_unsigned(number_unsigned_t val) override { return m_pChild ? to_child([&](auto& child) { return child.number_unsigned(val); }) : value(val); }
+    bool number_float(number_float_t val, string_t const& str) override { return m_pChild ? to_child([&](auto& child) { return child.number_float(val, str); }) : value(val); }
+    bool string(string_t& val) override                  { return m_pChild ? to_child([&](auto& child) { return child.string(val); }) : value(val); }
+
+    bool start_object(std::size_t nElements) override
+    {
+        if (m_pChild)
+            return to_child([&](auto& child) { return child.start_object(nElements); });
+
+        // Objects under unknown keys are skipped
+        auto const bMember = m_nDepth == 1 && m_nField >= 0;
+        auto const bElement = m_nDepth == 2 && m_nArrayField >= 0;
+        if (bMember || bElement)
+        {
+            m_pChild = s_openers[bElement ? m_nArrayField : m_nField](m_obj, bElement);
+            if (m_pChild)
+                return to_child([&](auto& child) { return child.start_object(nElements); });
+            m_bValid = false;
+        }
+
+        m_bRootObject |= m_nDepth == 0;
+        ++m_nDepth;
+        m_nField = -1;
+        return true;
+    }
+
+    bool key(string_t& val) override
+    {
+        if (m_pChild)
+            return to_child([&](auto& child) { return child.key(val); });
+
+        if (m_nDepth == 1)
+        {
+            m_nField = CodecKeys<T>::hash.find(val);
+            if (m_nField >= 0)
+                m_seen[m_nField] = true;
+        }
+        return true;
+    }
+
+    bool end_object() override
+    {
+        if (m_pChild)
+            return to_child([&](auto& child) { return child.end_object(); });
+
+        --m_nDepth;
+        if (m_nDepth == 1)
+            m_nField = -1;
+        return true;
+    }
+
+    bool start_array(std::size_t nElements) override
+    {
+        if (m_pChild)
+            return to_child([&](auto& child) { return child.start_array(nElements); });
+
+        if (m_nDepth == 1 && m_nField >= 0)
+        {
+            if (s_arrayMask[m_nField])
+            {
+                s_clearers[m_nField](m_obj);
+                m_nArrayField = m_nField;
+            }
+            else
+                m_bValid = false;
+        }
+        ++m_nDepth;
+        return true;
+    }
+
+    bool end_array() override
+    {
+        if (m_pChild)
+            return to_child([&](auto& child) { return child.end_array(); });
+
+        --m_nDepth;
+        if (m_nDepth == 1)
+        {
+            m_nArrayField = -1;
+            m_nField = -1;
+        }
+        return true;
+    }
+
+    bool parse_error(std::size_t, std::string const&, nlohmann::detail::exception const&)
+    {
+        return false;
+    }
+
+    // Root was an object, every member had the expected type and all required members were present
+    bool is_complete() const noexcept override
+    {
+        auto bResult = m_bRootObject && m_bValid;
+        for (std::size_t i = 0; i < nFields; ++i)
+            bResult &= m_seen[i] || !detail_codec::required_mask<T>[i];
+        return bResult;
+    }
+
+    std::size_t depth() const noexcept override
+    {
+        return m_nDepth;
+    }
+
+private:
+    static constexpr auto nFields = codec_field_count<T>;
+    static constexpr auto s_arrayMask = detail_codec::make_array_mask<T>(std::make_index_sequence<nFields>{});
+    static constexpr auto s_clearers = detail_codec::make_array_clearers<T>(std::make_index_sequence<nFields>{});
+    static constexpr auto s_openers = detail_codec::make_object_openers<T>(std::make_index_sequence<nFields>{});
+
+    // Passes an event to the nested object and takes its result once the object is closed
+    template<typename TEvent>
+    bool to_child(TEvent&& event)
+    {
+        auto const bResult = event(*m_pChild);
+        if (m_pChild->depth() == 0)
+        {
+            m_bValid &= m_pChild->is_complete();
+            m_pChild.reset();
+            if (m_nDepth == 1)
+                m_nField = -1;
+        }
+        return bResult;
+    }
+
+    template<typename TValue>
+    bool value(TValue&& val)
+    {
+        using Value = std::remove_reference_t<TValue>;
+
+        if constexpr (!std::is_same_v<std::decay_t<Value>, std::nullptr_t>)
+        {
+            static constexpr auto setters = detail_codec::make_sax_setters<T, Value>(std::make_index_sequence<nFields>{});
+
+            if (m_nDepth == 1 && m_nField >= 0)
+                m_bValid &= setters[m_nField](m_obj, val, false);
+            else if (m_nDepth == 2 && m_nArrayField >= 0)
+                m_bValid &= setters[m_nArrayField](m_obj, val, true);
+        }
+
+        if (m_nDepth == 1)
+            m_nField = -1;
+        return true;
+    }
+
+    T& m_obj;
+    std::unique_ptr<detail_codec::SaxNode> m_pChild;
+    std::array<bool, nFields> m_seen{};
+    std::size_t m_nDepth = 0;
+    int m_nField = -1;
+    int m_nArrayField = -1;
+    bool m_bRootObject = false;
+    bool m_bValid = true;
+};
+
+template<typename T>
+bool codec_sax_parse(nlohmann::detail::input_adapter&& input, T& obj,
+                     nlohmann::detail::input_format_t format = nlohmann::detail::input_format_t::json)
+{
+    auto sax = CodecSax<T>{ obj };
+    return nlohmann::json::sax_parse(std::move(input), &sax, format) && sax.is_complete();
+}
+
+/*************************
+ * MessagePack and CBOR *
+ *************************/
+
+template<typename T>
+std::vector<std::uint8_t> codec_to_msgpack(T const& obj)
+{
+    return nlohmann::json::to_msgpack(codec_to_json(obj));
+}
+
+template<typename T>
+bool codec_from_msgpack(std::uint8_t const* pData, std::size_t nSize, T& obj)
+{
+    return codec_sax_parse({ pData, nSize }, obj, nlohmann::detail::input_format_t::msgpack);
+}
+
+template<typename T>
+std::vector<std::uint8_t> codec_to_cbor(T const& obj)
+{
+    return nlohmann::json::to_cbor(codec_to_json(obj));
+}
+
+template<typename T>
+bool codec_from_cbor(std::uint8_t const* pData, std::size_t nSize, T& obj)
+{
+    return codec_sax_parse({ pData, nSize }, obj, nlohmann::detail::input_format_t::cbor);
+}
+
+/****************
+ * fixed layout *
+ ****************/
+
+// Members in declaration order, little endian: integers and floats at their
+// own width, bool as one byte, strings and vectors as a uint32 count followed
+// by the elements, optionals as a presence byte followed by the value.
+
+template<typename T>
+void codec_to_binary(T const& obj, std::vector<std::uint8_t>& out);
+
+template<typename T>
+bool codec_from_binary(std::uint8_t const*& pData, std::uint8_t const* pEnd, T& obj);
+
+namespace detail_codec
+{
+    template<typename TInt>
+    void put_le(std::vector<std::uint8_t>& out, TInt nValue)
+    {
+        using Unsigned = std::make_unsigned_t<TInt>;
+        auto nBits = static_cast<Unsigned>(nValue);
+        for (std::size_t i = 0; i < sizeof(TInt); ++i, nBits = static_cast<Unsigned>(nBits >> 7 >> 1))
+            out.push_back(static_cast<std::uint8_t>(nBits & 0xFFu));
+    }
+
+    template<typename TInt>
+    bool get_le(std::uint8_t const*& pData, std::uint8_t const* pEnd, TInt& nValue)
+    {
+        using Unsigned = std::make_unsigned_t<TInt>;
+        if (static_cast<std::size_t>(pEnd - pData) < sizeof(TInt))
+            return false;
+
+        auto nBits = Unsigned{ 0 };
+        for (std::size_t i = 0; i < sizeof(TInt); ++i)
+            nBits |= static_cast<Unsigned>(static_cast<Unsigned>(pData[i]) << (8 * i));
+        pData += sizeof(TInt);
+        nValue = static_cast<TInt>(nBits);
+        return true;
+    }
+
+    template<typename T>
+    void put_value(std::vector<std::uint8_t>& out, T const& value)
+    {
+        if constexpr (has_codec_fields<T>::value)
+            codec_to_binary(value, out);
+        else if constexpr (is_std_optional<T>::value)
+        {
+            out.push_back(value ? 1 : 0);
+            if (value)
+                put_value(out, *value);
+        }
+        else if constexpr (is_std_vector<T>::value)
+        {
+            put_le(out, static_cast<std::uint32_t>(value.size()));
+            for (auto const& element : value)
+                put_value(out, element);
+        }
+        else if constexpr (std::is_same_v<T, std::string>)
+        {
+            put_le(out, static_cast<std::uint32_t>(value.size()));
+            out.insert(out.end(), value.begin(), value.end());
+        }
+        else if constexpr (std::is_same_v<T, bool>)
+            out.push_back(value ? 1 : 0);
+        else if constexpr (std::is_integral_v<T>)
+            put_le(out, value);
+        else if constexpr (std::is_same_v<T, double>)
+        {
+            auto nBits = std::uint64_t{};
+            std::memcpy(&nBits, &value, sizeof(nBits));
+            put_le(out, nBits);
+        }
+        else if constexpr (std::is_same_v<T, float>)
+        {
+            auto nBits = std::uint32_t{};
+            std::memcpy(&nBits, &value, sizeof(nBits));
+            put_le(out, nBits);
+        }
+        else
+            static_assert(sizeof(T) == 0, "member type has no binary layout");
+    }
+
+    template<typename T>
+    bool get_value(std::uint8_t const*& pData, std::uint8_t const* pEnd, T& value)
+    {
+        if constexpr (has_codec_fields<T>::value)
+            return codec_from_binary(pData, pEnd, value);
+        else if constexpr (is_std_optional<T>::value)
+        {
+            auto nPresent = std::uint8_t{};
+            if (!get_le(pData, pEnd, nPresent) || nPresent > 1)
+                return false;
+            if (!nPresent)
+            {
+                value.reset();
+                return true;
+            }
+            return get_value(pData, pEnd, value.emplace());
+        }
+        else if constexpr (is_std_vector<T>::value)
+        {
+            auto nCount = std::uint32_t{};
+            if (!get_le(pData, pEnd, nCount))
+                return false;
+
+            value.clear();
+            for (std::uint32_t i = 0; i < nCount; ++i)
+            {
+                if (!get_value(pData, pEnd, value.emplace_back()))
+                    return false;
+            }
+            return true;
+        }
+        else if constexpr (std::is_same_v<T, std::string>)
+        {
+            auto nLength = std::uint32_t{};
+            if (!get_le(pData, pEnd, nLength) || static_cast<std::size_t>(pEnd - pData) < nLength)
+                return false;
+            value.assign(reinterpret_cast<char const*>(pData), nLength);
+            pData += nLength;
+            return true;
+        }
+        else if constexpr (std::is_same_v<T, bool>)
+        {
+            auto nValue = std::uint8_t{};
+            if (!get_le(pData, pEnd, nValue) || nValue > 1)
+                return false;
+            value = nValue != 0;
+            return true;
+        }
+        else if constexpr (std::is_integral_v<T>)
+            return get_le(pData, pEnd, value);
+        else if constexpr (std::is_floating_point_v<T>)
+        {
+            static_assert(std::is_same_v<T, double> || std::is_same_v<T, float>, "member type has no binary layout");
+            using Bits = std::conditional_t<sizeof(T) == 8, std::uint64_t, std::uint32_t>;
+            auto nBits = Bits{};
+            if (!get_le(pData, pEnd, nBits))
+                return false;
+            std::memcpy(&value, &nBits, sizeof(value));
+            return true;
+        }
+        else
+            static_assert(sizeof(T) == 0, "member type has no binary layout");
+    }
+}
+
+template<typename T>
+void codec_to_binary(T const& obj, std::vector<std::uint8_t>& out)
+{
+    std::apply([&](auto const&...fields) { (detail_codec::put_value(out, obj.*fields.member), ...); }, T::fields());
+}
+
+template<typename T>
+std::vector<std::uint8_t> codec_to_binary(T const& obj)
+{
+    auto out = std::vector<std::uint8_t>{};
+    codec_to_binary(obj, out);
+    return out;
+}
+
+template<typename T>
+bool codec_from_binary(std::uint8_t const*& pData, std::uint8_t const* pEnd, T& obj)
+{
+    return std::apply([&](auto const&...fields) { return (detail_codec::get_value(pData, pEnd, obj.*fields.member) && ...); }, T::fields());
+}
+
+template<typename T>
+bool codec_from_binary(std::uint8_t const* pData, std::size_t nSize, T& obj)
+{
+    auto const pEnd = pData + nSize;
+    return codec_from_binary(pData, pEnd, obj) && pData == pEnd;
+}
@@ -0,0 +1,639 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Optional block compression of transfers. A compressed file goes over the
+// wire as frames of
+//     uint32 raw size, uint32 stored size, stored bytes
+// covering kCompressBlockSize bytes of the file each. A frame whose stored size
+// is below its raw size holds an LZ4 block, any other frame holds the raw bytes.
+
+constexpr std::int64_t kCompressBlockSize = 64 * 1024;
+
+namespace detail_lz4
+{
+    constexpr int kHashBits = 12;
+    constexpr std::size_t kMinMatch = 4;
+    constexpr std::size_t kLastLiterals = 5;   // the format ends with at least this many literals
+    constexpr std::size_t kMatchFindLimit = 12;   // no match starts this close to the end
+    constexpr std::size_t kMaxOffset = 65535;
+
+    inline std::uint32_t load32(unsigned char const* p) noexcept
+    {
+        auto n = std::uint32_t{};
+        std::memcpy(&n, p, sizeof(n));
+        return n;
+    }
+
+    inline std::uint64_t load64(unsigned char const* p) noexcept
+    {
+        auto n = std::uint64_t{};
+        std::memcpy(&n, p, sizeof(n));
+        return n;
+    }
+
+    inline std::uint32_t hash(std::uint32_t nSequence) noexcept
+    {
+        return (nSequence * 2654435761u) >> (32 - kHashBits);
+    }
+
+    // Bytes p and pMatch have in common, not reading at or past pLimit
+    inline std::size_t common_length(unsigned char const* p, unsigned char const* pMatch, unsigned char const* pLimit) noexcept
+    {
+        auto const pStart = p;
+        while (pLimit - p >= 8 && load64(p) == load64(pMatch))
+        {
+            p += 8;
+            pMatch += 8;
+        }
+        while (p < pLimit && *p == *pMatch)
+        {
+            ++p;
+            ++pMatch;
+        }
+        return static_cast<std::size_t>(p - pStart);
+    }
+
+    // Length field continuation: 255 per byte until a smaller one
+    inline unsigned char* put_length(unsigned char* p, std::size_t nLength) noexcept
+    {
+        for (; nLength >= 255; nLength -= 255)
+            *p++ = 255;
+        *p++ = static_cast<unsigned char>(nLength);
+        return p;
+    }
+}
+
+// Largest output lz4_compress can produce for nSize input bytes
+constexpr std::size_t lz4_compress_bound(std::size_t nSize) noexcept
+{
+    return nSize + nSize / 255 + 16;
+}
+
+// One LZ4 block (the raw block format, no frame) of [pSource, pSource + nSize)
+// into pDest. Greedy single-probe matching as in LZ4's fast mode, skipping
+// ahead faster the longer nothing matches. Returns the compressed size, 0 if
+// it does not fit into nCapacity bytes.
+inline std::size_t lz4_compress(char const* pSource, std::size_t nSize, char* pDest, std::size_t nCapacity) noexcept
+{
+    using namespace detail_lz4;
+
+    auto const pIn = reinterpret_cast<unsigned char const*>(pSource);
+    auto const pInEnd = pIn + nSize;
+    auto const pOutStart = reinterpret_cast<unsigned char*>(pDest);
+    auto const pOutEnd = pOutStart + nCapacity;
+    auto pOut = pOutStart;
+    auto pAnchor = pIn;
+
+    // A sequence of nLiterals literals and a match takes at most this many bytes besides the match length bytes
+    auto const fits = [&](std::size_t nLiterals, std::size_t nExtra)
+    {
+        return static_cast<std::size_t>(pOutEnd - pOut) >= 1 + nLiterals / 255 + 1 + nLiterals + nExtra;
+    };
+
+    if (nSize > kMatchFindLimit)
+    {
+        auto table = std::vector<std::uint32_t>(std::size_t{ 1 } << kHashBits, 0);
+        auto const pMatchLimit = pInEnd - kLastLiterals;
+        auto const pFindLimit = pInEnd - kMatchFindLimit;
+
+        auto p = pIn + 1;
+        auto nMisses = std::size_t{ 0 };
+        while (p < pFindLimit)
+        {
+            auto const nHash = hash(load32(p));
+            auto pMatch = pIn + table[nHash];
+            table[nHash] = static_cast<std::uint32_t>(p - pIn);
+
+            if (static_cast<std::size_t>(p - pMatch) > kMaxOffset || load32(pMatch) != load32(p))
+            {
+                p += (nMisses++ >> 6) + 1;
+                continue;
+            }
+            nMisses = 0;
+
+            while (p > pAnchor && pMatch > pIn && p[-1] == pMatch[-1])
+            {
+                --p;
+                --pMatch;
+            }
+
+            auto const nLiterals = static_cast<std::size_t>(p - pAnchor);
+            auto const nMatch = kMinMatch + common_length(p + kMinMatch, pMatch + kMinMatch, pMatchLimit);
+            if (!fits(nLiterals, 2 + (nMatch - kMinMatch) / 255 + 1))
+                return 0;
+
+            auto const pToken = pOut++;
+            *pToken = static_cast<unsigned char>(std::min<std::size_t>(nLiterals, 15) << 4);
+            if (nLiterals >= 15)
+                pOut = put_length(pOut, nLiterals - 15);
+            std::memcpy(pOut, pAnchor, nLiterals);
+            pOut += nLiterals;
+
+            auto const nOffset = static_cast<std::uint16_t>(p - pMatch);
+            *pOut++ = static_cast<unsigned char>(nOffset & 0xFF);
+            *pOut++ = static_cast<unsigned char>(nOffset >> 8);
+
+            *pToken |= static_cast<unsigned char>(std::min<std::size_t>(nMatch - kMinMatch, 15));
+            if (nMatch - kMinMatch >= 15)
+                pOut = put_length(pOut, nMatch - kMinMatch - 15);
+
+            p += nMatch;
+            pAnchor = p;
+            if (p < pFindLimit)
+                table[hash(load32(p - 2))] = static_cast<std::uint32_t>(p - 2 - pIn);
+        }
+    }
+
+    auto const nLiterals = static_cast<std::size_t>(pInEnd - pAnchor);
+    if (!fits(nLiterals, 0))
+        return 0;
+
+    *pOut++ = static_cast<unsigned char>(std::min<std::size_t>(nLiterals, 15) << 4);
+    if (nLiterals >= 15)
+        pOut = put_length(pOut, nLiterals - 15);
+    std::memcpy(pOut, pAnchor, nLiterals);
+    pOut += nLiterals;
+
+    return static_cast<std::size_t>(pOut - pOutStart);
+}
+
+// Decodes one LZ4 block that has to expand to exactly nSize bytes. Every
+// length and offset is checked, so a malformed block returns false instead
+// of reading or writing out of bounds.
+inline bool lz4_decompress(char const* pSource, std::size_t nSourceSize, char* pDest, std::size_t nSize) noexcept
+{
+    using namespace detail_lz4;
+
+    auto p = reinterpret_cast<unsigned char const*>(pSource);
+    auto const pEnd = p + nSourceSize;
+    auto const pOutStart = reinterpret_cast<unsigned char*>(pDest);
+    auto const pOutEnd = pOutStart + nSize;
+    auto pOut = pOutStart;
+
+    auto const getLength = [&](std::size_t& nLength)
+    {
+        for (;;)
+        {
+            if (p == pEnd)
+                return false;
+            auto const nByte = *p++;
+            nLength += nByte;
+            if (nByte != 255)
+                return true;
+        }
+    };
+
+    for (;;)
+    {
+        if (p == pEnd)
+            return false;
+        auto const nToken = *p++;
+
+        auto nLiterals = static_cast<std::size_t>(nToken >> 4);
+        if (nLiterals == 15 && !getLength(nLiterals))
+            return false;
+        if (nLiterals > static_cast<std::size_t>(pEnd - p) || nLiterals > static_cast<std::size_t>(pOutEnd - pOut))
+            return false;
+        std::memcpy(pOut, p, nLiterals);
+        p += nLiterals;
+        pOut += nLiterals;
+
+        // The last sequence has no match
+        if (p == pEnd)
+            return pOut == pOutEnd;
+
+        if (pEnd - p < 2)
+            return false;
+        auto const nOffset = static_cast<std::size_t>(p[0] | (p[1] << 8));
+        p += 2;
+        if (nOffset == 0 || nOffset > static_cast<std::size_t>(pOut - pOutStart))
+            return false;
+
+        auto nMatch = static_cast<std::size_t>(nToken & 15u);
+        if (nMatch == 15 && !getLength(nMatch))
+            return false;
+        nMatch += kMinMatch;
+        if (nMatch > static_cast<std::size_t>(pOutEnd - pOut))
+            return false;
+
+        // Overlapping matches repeat the last nOffset bytes; each copy doubles
+        // what is available, so runs need a handful of memcpy calls, not a byte loop
+        auto const pMatch = pOut - nOffset;
+        for (auto nDone = std::size_t{ 0 }; nDone < nMatch; )
+        {
+            auto const nChunk = std::min(nMatch - nDone, nOffset + nDone);
+            std::memcpy(pOut + nDone, pMatch, nChunk);
+            nDone += nChunk;
+        }
+        pOut += nMatch;
+    }
+}
+
+/*******************
+ * BlockCompressor *
+ *******************/
+
+// Sender side: turns a file into frames one block at a time, deciding for
+// every block whether compressing it pays off. Compressing a block of n bytes
+// costs n / codec speed and saves (1 - ratio) * n / link speed, so blocks are
+// compressed while (1 - ratio) * codec speed > link speed. Ratio and codec
+// speed are averaged over the compressed blocks, link speed over the time
+// each frame took to send. Every kProbeInterval-th block is compressed anyway
+// to keep the estimates current once compression is off.
+class BlockCompressor
+{
+public:
+    struct Stats
+    {
+        std::int64_t nRawBytes = 0;
+        std::int64_t nWireBytes = 0;
+        std::int64_t nCodecTime = 0;   // microseconds
+        std::uint32_t nBlocks = 0;
+        std::uint32_t nCompressedBlocks = 0;
+    };
+
+    BlockCompressor()
+        : m_block(static_cast<std::size_t>(kCompressBlockSize))
+        , m_frame(kHeaderSize + lz4_compress_bound(static_cast<std::size_t>(kCompressBlockSize)))
+    {}
+
+    // The estimates carry over from file to file
+    void start(std::int64_t nFileSize) noexcept
+    {
+        m_nFileSize = nFileSize;
+        m_nRawOffset = 0;
+        m_nFrameSize = 0;
+        m_nFrameSent = 0;
+        m_stats = Stats{};
+    }
+
+    // Unsent bytes of the current frame, at most nMax; the next frame is built
+    // from source(nOffset, nMax) -> (char const*, std::int64_t) once it is sent.
+    // Empty if the source could not be read.
+    template<typename TSource>
+    std::pair<char const*, std::int64_t> pending(std::int64_t nMax, TSource&& source)
+    {
+        if (m_nFrameSent == m_nFrameSize && !next_frame(source))
+            return { nullptr, 0 };
+
+        return { m_frame.data() + m_nFrameSent, std::min(nMax, m_nFrameSize - m_nFrameSent) };
+    }
+
+    void consume(std::int64_t nBytes) noexcept
+    {
+        m_nFrameSent += nBytes;
+    }
+
+    bool finished() const noexcept
+    {
+        return m_nRawOffset == m_nFileSize && m_nFrameSent == m_nFrameSize;
+    }
+
+    Stats const& stats() const noexcept { return m_stats; }
+
+private:
+    static constexpr std::int64_t kHeaderSize = 8;
+    static constexpr std::uint32_t kProbeInterval = 32;
+
+    // Weight of a new sample in the running estimates
+    static constexpr double kSmoothing = 0.125;
+
+    static void smooth(double& dEstimate, double dSample) noexcept
+    {
+        dEstimate = dEstimate > 0.0 ? dEstimate + kSmoothing * (dSample - dEstimate) : dSample;
+    }
+
+    bool worth_compressing() const noexcept
+    {
+        if (m_stats.nBlocks % kProbeInterval == 0 || m_dLinkSpeed <= 0.0 || m_dCodecSpeed <= 0.0)
+            return true;
+        return (1.0 - m_dRatio) * m_dCodecSpeed > m_dLinkSpeed;
+    }
+
+    template<typename TSource>
+    bool next_frame(TSource&& source)
+    {
+        using clock = std::chrono::steady_clock;
+
+        // Time since the last frame went out, spent sending the one before
+        auto const now = clock::now();
+        if (m_nFrameSize > 0)
+        {
+            auto const dSeconds = std::chrono::duration<double>(now - m_frameBuilt).count();
+            if (dSeconds > 0.0)
+                smooth(m_dLinkSpeed, static_cast<double>(m_nFrameSize) / dSeconds);
+        }
+
+        // Gathered into one piece when the source hands it out in parts
+        auto const nRaw = std::min(kCompressBlockSize, m_nFileSize - m_nRawOffset);
+        auto pRaw = static_cast<char const*>(nullptr);
+        for (auto nGathered = std::int64_t{ 0 }; nGathered < nRaw; )
+        {
+            auto const slice = source(m_nRawOffset + nGathered, nRaw - nGathered);
+            if (slice.second <= 0)
+                return false;
+            if (nGathered == 0 && slice.second == nRaw)
+            {
+                pRaw = slice.first;
+                break;
+            }
+            std::memcpy(m_block.data() + nGathered, slice.first, static_cast<std::size_t>(slice.second));
+            nGathered += slice.second;
+            pRaw = m_block.data();
+        }
+
+        auto nStored = std::size_t{ 0 };
+        if (worth_compressing())
+        {
+            auto const start = clock::now();
+            nStored = lz4_compress(pRaw, static_cast<std::size_t>(nRaw), m_frame.data() + kHeaderSize, static_cast<std::size_t>(nRaw) - 1);
+            auto const dSeconds = std::chrono::duration<double>(clock::now() - start).count();
+
+            m_stats.nCodecTime += std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count();
+            if (dSeconds > 0.0)
+                smooth(m_dCodecSpeed, static_cast<double>(nRaw) / dSeconds);
+            smooth(m_dRatio, nStored ? static_cast<double>(nStored) / static_cast<double>(nRaw) : 1.0);
+        }
+
+        if (nStored)
+            ++m_stats.nCompressedBlocks;
+        else
+        {
+            nStored = static_cast<std::size_t>(nRaw);
+            std::memcpy(m_frame.data() + kHeaderSize, pRaw, nStored);
+        }
+
+        auto const header = std::array<std::uint32_t, 2>{ static_cast<std::uint32_t>(nRaw), static_cast<std::uint32_t>(nStored) };
+        std::memcpy(m_frame.data(), header.data(), kHeaderSize);
+
+        m_nRawOffset += nRaw;
+        m_nFrameSize = kHeaderSize + static_cast<std::int64_t>(nStored);
+        m_nFrameSent = 0;
+        m_frameBuilt = clock::now();
+
+        ++m_stats.nBlocks;
+        m_stats.nRawBytes += nRaw;
+        m_stats.nWireBytes += m_nFrameSize;
+        return true;
+    }
+
+    std::vector<char> m_block;
+    std::vector<char> m_frame;
+
+    std::int64_t m_nFileSize = 0;
+    std::int64_t m_nRawOffset = 0;
+    std::int64_t m_nFrameSize = 0;
+    std::int64_t m_nFrameSent = 0;
+    std::chrono::steady_clock::time_point m_frameBuilt;
+
+    // Bytes per second; 0 until measured
+    double m_dLinkSpeed = 0.0;
+    double m_dCodecSpeed = 0.0;
+    double m_dRatio = 0.0;
+
+    Stats m_stats;
+};
+
+/*******************
+ * DecompressStage *
+ *******************/
+
+// Receiver side: the receive loop reads frames into a ring of slots and a
+// decoder thread expands them into the file behind it, so decompression
+// overlaps the network instead of adding to the receive time. The thread
+// lives as long as the stage and serves one file after another.
+class DecompressStage
+{
+public:
+    // Where the bytes at a file offset go, and how many fit there
+    using SpanAt = std::function<std::pair<char*, std::int64_t>(std::int64_t)>;
+    // Called with the file bytes complete so far whenever a span was filled
+    using Commit = std::function<void(std::int64_t)>;
+
+    explicit DecompressStage(std::size_t nSlots = 8)
+        : m_slots(std::max<std::size_t>(nSlots, 2), std::vector<char>(static_cast<std::size_t>(kCompressBlockSize)))
+        , m_frames(m_slots.size())
+        , m_scratch(static_cast<std::size_t>(kCompressBlockSize))
+    {
+        m_thread = std::thread{ [this]() { decode_loop(); } };
+    }
+
+    DecompressStage(DecompressStage const&) = delete;
+    DecompressStage& operator=(DecompressStage const&) = delete;
+
+    ~DecompressStage()
+    {
+        {
+            auto const lock = std::lock_guard<std::mutex>{ m_mutex };
+            m_bStop = true;
+        }
+        m_readyCv.notify_one();
+        m_thread.join();
+    }
+
+    // The previous file has to be finish()ed
+    void start(std::int64_t nFileSize, SpanAt spanAt, Commit commit)
+    {
+        m_spanAt = std::move(spanAt);
+        m_commit = std::move(commit);
+        m_nFileSize = nFileSize;
+        m_nFramedBytes = 0;
+        m_nHeaderBytes = 0;
+        m_nStoredBytes = 0;
+        m_bInFrame = false;
+        m_bMalformed = false;
+        m_nWireBytes = 0;
+
+        auto const lock = std::lock_guard<std::mutex>{ m_mutex };
+        m_bFailed = false;
+        m_nCodecTime = 0;
+    }
+
+    // Where the next received bytes go: the rest of a frame header or of its stored bytes.
+    // Blocks while every slot is still waiting for the decoder.
+    std::pair<char*, std::int64_t> recv_span()
+    {
+        if (!m_bInFrame)
+            return { reinterpret_cast<char*>(m_header.data()) + m_nHeaderBytes, kHeaderSize - m_nHeaderBytes };
+
+        auto const& frame = m_frames[slot_index(m_nQueued)];
+        return { m_slots[slot_index(m_nQueued)].data() + m_nStoredBytes, frame.nStored - m_nStoredBytes };
+    }
+
+    // nBytes arrived at recv_span(); false if a frame header is malformed
+    bool received(std::int64_t nBytes)
+    {
+        m_nWireBytes += nBytes;
+        if (!m_bInFrame)
+        {
+            m_nHeaderBytes += nBytes;
+            if (m_nHeaderBytes < kHeaderSize)
+                return true;
+
+            auto const nRaw = static_cast<std::int64_t>(m_header[0]);
+            auto const nStored = static_cast<std::int64_t>(m_header[1]);
+            if (nRaw <= 0 || nRaw > kCompressBlockSize || nRaw > m_nFileSize - m_nFramedBytes || nStored <= 0 || nStored > nRaw)
+            {
+                m_bMalformed = true;
+                return false;
+            }
+
+            // Wait for the slot the next frame goes to
+            {
+                auto lock = std::unique_lock<std::mutex>{ m_mutex };
+                m_spaceCv.wait(lock, [&]() { return m_nQueued - m_nDecoded < static_cast<std::int64_t>(m_slots.size()); });
+            }
+
+            m_frames[slot_index(m_nQueued)] = Frame{ m_nFramedBytes, nRaw, nStored };
+            m_nFramedBytes += nRaw;
+            m_nHeaderBytes = 0;
+            m_nStoredBytes = 0;
+            m_bInFrame = true;
+            return true;
+        }
+
+        m_nStoredBytes += nBytes;
+        if (m_nStoredBytes == m_frames[slot_index(m_nQueued)].nStored)
+        {
+            {
+                auto const lock = std::lock_guard<std::mutex>{ m_mutex };
+                ++m_nQueued;
+            }
+            m_readyCv.notify_one();
+            m_bInFrame = false;
+        }
+        return true;
+    }
+
+    // Every frame of the file is in, or one was malformed
+    bool received_all() const noexcept
+    {
+        return m_bMalformed || (m_nFramedBytes == m_nFileSize && !m_bInFrame);
+    }
+
+    bool malformed() const noexcept { return m_bMalformed; }
+
+    // Waits until every received frame is decoded; false if one did not decode
+    bool finish()
+    {
+        auto lock = std::unique_lock<std::mutex>{ m_mutex };
+        m_spaceCv.wait(lock, [&]() { return m_nDecoded == m_nQueued; });
+        return !m_bFailed;
+    }
+
+    // Of the last file, valid after finish()
+    std::int64_t wire_bytes() const noexcept { return m_nWireBytes; }
+    std::int64_t codec_time() const noexcept { return m_nCodecTime; }   // microseconds
+
+private:
+    static constexpr std::int64_t kHeaderSize = 8;
+
+    struct Frame
+    {
+        std::int64_t nOffset = 0;
+        std::int64_t nRaw = 0;
+        std::int64_t nStored = 0;
+    };
+
+    std::size_t slot_index(std::int64_t nFrame) const noexcept
+    {
+        return static_cast<std::size_t>(nFrame) % m_slots.size();
+    }
+
+    void decode_loop()
+    {
+        for (;;)
+        {
+            {
+                auto lock = std::unique_lock<std::mutex>{ m_mutex };
+                m_readyCv.wait(lock, [&]() { return m_bStop || m_nDecoded < m_nQueued; });
+                if (m_nDecoded == m_nQueued)
+                    return;
+            }
+
+            // The slot is ours until m_nDecoded says otherwise, no lock while decoding
+            auto const start = std::chrono::steady_clock::now();
+            auto const bDecoded = decode(m_frames[slot_index(m_nDecoded)], m_slots[slot_index(m_nDecoded)].data());
+            auto const nTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+            {
+                auto const lock = std::lock_guard<std::mutex>{ m_mutex };
+                m_bFailed |= !bDecoded;
+                m_nCodecTime += nTime;
+                ++m_nDecoded;
+            }
+            m_spaceCv.notify_one();
+        }
+    }
+
+    // Straight into the file when its span holds the whole block, else through scratch
+    bool decode(Frame const& frame, char const* pStored)
+    {
+        auto const bCompressed = frame.nStored < frame.nRaw;
+        auto const target = m_spanAt(frame.nOffset);
+        if (target.second >= frame.nRaw)
+        {
+            if (bCompressed && !lz4_decompress(pStored, static_cast<std::size_t>(frame.nStored), target.first, static_cast<std::size_t>(frame.nRaw)))
+                return false;
+            if (!bCompressed)
+                std::memcpy(target.first, pStored, static_cast<std::size_t>(frame.nRaw));
+            m_commit(frame.nOffset + frame.nRaw);
+            return true;
+        }
+
+        if (bCompressed)
+        {
+            if (!lz4_decompress(pStored, static_cast<std::size_t>(frame.nStored), m_scratch.data(), static_cast<std::size_t>(frame.nRaw)))
+                return false;
+            pStored = m_scratch.data();
+        }
+
+        for (auto nDone = std::int64_t{ 0 }; nDone < frame.nRaw; )
+        {
+            auto const span = m_spanAt(frame.nOffset + nDone);
+            auto const nBytes = std::min(span.second, frame.nRaw - nDone);
+            std::memcpy(span.first, pStored + nDone, static_cast<std::size_t>(nBytes));
+            nDone += nBytes;
+            m_commit(frame.nOffset + nDone);
+        }
+        return true;
+    }
+
+    std::vector<std::vector<char>> m_slots;
+    std::vector<Frame>             m_frames;
+    std::vector<char>              m_scratch;
+    std::thread                    m_thread;
+
+    // Receive side only
+    SpanAt m_spanAt;
+    Commit m_commit;
+    std::array<std::uint32_t, 2> m_header{};
+    std::int64_t m_nFileSize = 0;
+    std::int64_t m_nFramedBytes = 0;
+    std::int64_t m_nHeaderBytes = 0;
+    std::int64_t m_nStoredBytes = 0;
+    std::int64_t m_nWireBytes = 0;
+    bool         m_bInFrame = false;
+    bool         m_bMalformed = false;
+
+    std::mutex              m_mutex;
+    std::condition_variable m_readyCv;
+    std::condition_variable m_spaceCv;
+    std::int64_t            m_nQueued = 0;
+    std::int64_t            m_nDecoded = 0;
+    std::int64_t            m_nCodecTime = 0;
+    bool                    m_bFailed = false;
+    bool                    m_bStop = false;
+};
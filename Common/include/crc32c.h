@@ -0,0 +1,227 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define OS2VAR2_CRC32C_X64 1
+#include <nmmintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+namespace detail_crc32c
+{
+    // Castagnoli polynomial, reflected
+    constexpr std::uint32_t kPolynomial = 0x82F63B78u;
+
+    // Bytes per stream in the three-way interleaved SSE4.2 loop
+    constexpr std::size_t kLane = 4096;
+
+    struct Tables
+    {
+        // slicing-by-8 for the portable path
+        std::array<std::array<std::uint32_t, 256>, 8> slice;
+
+        // Register advanced over kLane zero bytes, one table per register byte
+        std::array<std::array<std::uint32_t, 256>, 4> shift;
+    };
+
+    inline Tables make_tables() noexcept
+    {
+        auto tables = Tables{};
+
+        for (std::uint32_t nByte = 0; nByte < 256; ++nByte)
+        {
+            auto nCrc = nByte;
+            for (int nBit = 0; nBit < 8; ++nBit)
+                nCrc = (nCrc >> 1) ^ (kPolynomial & (0u - (nCrc & 1u)));
+            tables.slice[0][nByte] = nCrc;
+        }
+        for (std::uint32_t nByte = 0; nByte < 256; ++nByte)
+        {
+            for (std::size_t k = 1; k < 8; ++k)
+            {
+                auto const nPrev = tables.slice[k - 1][nByte];
+                tables.slice[k][nByte] = (nPrev >> 8) ^ tables.slice[0][nPrev & 0xFF];
+            }
+        }
+
+        // Feeding zeros is linear in the register, so shifting each single bit is enough
+        auto bits = std::array<std::uint32_t, 32>{};
+        for (std::size_t nBit = 0; nBit < 32; ++nBit)
+        {
+            auto nCrc = std::uint32_t{ 1 } << nBit;
+            for (std::size_t i = 0; i < kLane; ++i)
+                nCrc = tables.slice[0][nCrc & 0xFF] ^ (nCrc >> 8);
+            bits[nBit] = nCrc;
+        }
+        for (std::size_t k = 0; k < 4; ++k)
+        {
+            for (std::uint32_t nByte = 0; nByte < 256; ++nByte)
+            {
+                auto nCrc = std::uint32_t{ 0 };
+                for (std::size_t nBit = 0; nBit < 8; ++nBit)
+                {
+                    if (nByte & (1u << nBit))
+                        nCrc ^= bits[k * 8 + nBit];
+                }
+                tables.shift[k][nByte] = nCrc;
+            }
+        }
+
+        return tables;
+    }
+
+    inline Tables const& tables() noexcept
+    {
+        static auto const s_tables = make_tables();
+        return s_tables;
+    }
+
+    inline std::uint32_t load32(unsigned char const* p) noexcept
+    {
+        auto n = std::uint32_t{};
+        std::memcpy(&n, p, sizeof(n));
+        return n;
+    }
+
+    inline std::uint32_t update_portable(std::uint32_t nCrc, unsigned char const* p, std::size_t nSize) noexcept
+    {
+        auto const& slice = tables().slice;
+
+        // Assumes little endian, as does every target of this project
+        for (; nSize >= 8; p += 8, nSize -= 8)
+        {
+            auto const nLow = load32(p) ^ nCrc;
+            auto const nHigh = load32(p + 4);
+            nCrc = slice[7][nLow & 0xFF] ^ slice[6][(nLow >> 8) & 0xFF] ^ slice[5][(nLow >> 16) & 0xFF] ^ slice[4][nLow >> 24]
+                 ^ slice[3][nHigh & 0xFF] ^ slice[2][(nHigh >> 8) & 0xFF] ^ slice[1][(nHigh >> 16) & 0xFF] ^ slice[0][nHigh >> 24];
+        }
+        for (; nSize > 0; ++p, --nSize)
+            nCrc = slice[0][(nCrc ^ *p) & 0xFF] ^ (nCrc >> 8);
+
+        return nCrc;
+    }
+
+#ifdef OS2VAR2_CRC32C_X64
+
+#if defined(__GNUC__) || defined(__clang__)
+#define OS2VAR2_TARGET_SSE42 __attribute__((target("sse4.2")))
+#else
+#define OS2VAR2_TARGET_SSE42
+#endif
+
+    inline std::uint32_t shift_lane(std::uint32_t nCrc) noexcept
+    {
+        auto const& shift = tables().shift;
+        return shift[0][nCrc & 0xFF] ^ shift[1][(nCrc >> 8) & 0xFF] ^ shift[2][(nCrc >> 16) & 0xFF] ^ shift[3][nCrc >> 24];
+    }
+
+    OS2VAR2_TARGET_SSE42
+    inline std::uint32_t update_sse42(std::uint32_t nCrc, unsigned char const* p, std::size_t nSize) noexcept
+    {
+        // crc32 has a latency of three and a throughput of one, so three
+        // independent streams keep the unit busy; they are joined by shifting
+        // the earlier ones over the later lanes' length.
+        while (nSize >= 3 * kLane)
+        {
+            auto nCrcA = std::uint64_t{ nCrc };
+            auto nCrcB = std::uint64_t{ 0 };
+            auto nCrcC = std::uint64_t{ 0 };
+            for (std::size_t i = 0; i < kLane; i += 8)
+            {
+                auto nA = std::uint64_t{};
+                auto nB = std::uint64_t{};
+                auto nC = std::uint64_t{};
+                std::memcpy(&nA, p + i, 8);
+                std::memcpy(&nB, p + kLane + i, 8);
+                std::memcpy(&nC, p + 2 * kLane + i, 8);
+                nCrcA = _mm_crc32_u64(nCrcA, nA);
+                nCrcB = _mm_crc32_u64(nCrcB, nB);
+                nCrcC = _mm_crc32_u64(nCrcC, nC);
+            }
+
+            nCrc = shift_lane(shift_lane(static_cast<std::uint32_t>(nCrcA)) ^ static_cast<std::uint32_t>(nCrcB))
+                 ^ static_cast<std::uint32_t>(nCrcC);
+            p += 3 * kLane;
+            nSize -= 3 * kLane;
+        }
+
+        auto nCrc64 = std::uint64_t{ nCrc };
+        for (; nSize >= 8; p += 8, nSize -= 8)
+        {
+            auto n = std::uint64_t{};
+            std::memcpy(&n, p, 8);
+            nCrc64 = _mm_crc32_u64(nCrc64, n);
+        }
+
+        nCrc = static_cast<std::uint32_t>(nCrc64);
+        for (; nSize > 0; ++p, --nSize)
+            nCrc = _mm_crc32_u8(nCrc, *p);
+
+        return nCrc;
+    }
+
+#undef OS2VAR2_TARGET_SSE42
+
+    inline bool cpu_has_sse42() noexcept
+    {
+#if defined(_MSC_VER) && !defined(__clang__)
+        int info[4] = {};
+        __cpuid(info, 1);
+        return (info[2] & (1 << 20)) != 0;
+#else
+        return __builtin_cpu_supports("sse4.2");
+#endif
+    }
+
+    inline bool use_sse42() noexcept
+    {
+        static bool const s_bSse42 = cpu_has_sse42();
+        return s_bSse42;
+    }
+
+#endif
+}
+
+/**********
+ * Crc32c *
+ **********/
+
+// Streaming CRC32C (Castagnoli, as in iSCSI and ext4). Uses the SSE4.2 crc32
+// instruction when the CPU has it, slicing-by-8 tables otherwise; both give
+// the same digest.
+class Crc32c
+{
+public:
+    void update(void const* pData, std::size_t nSize) noexcept
+    {
+        auto const p = static_cast<unsigned char const*>(pData);
+#ifdef OS2VAR2_CRC32C_X64
+        if (detail_crc32c::use_sse42())
+        {
+            m_nState = detail_crc32c::update_sse42(m_nState, p, nSize);
+            return;
+        }
+#endif
+        m_nState = detail_crc32c::update_portable(m_nState, p, nSize);
+    }
+
+    std::uint32_t value() const noexcept { return ~m_nState; }
+
+    void reset() noexcept { m_nState = ~std::uint32_t{ 0 }; }
+
+    static std::uint32_t compute(void const* pData, std::size_t nSize) noexcept
+    {
+        auto crc = Crc32c{};
+        crc.update(pData, nSize);
+        return crc.value();
+    }
+
+private:
+    std::uint32_t m_nState = ~std::uint32_t{ 0 };
+};
@@ -0,0 +1,431 @@
+#pragma once
+
+#include "os2var2_common.h"
+#include "buffer_pool.h"
+#include "xxh64.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <utility>
+#include <vector>
+
+// rsync-style delta transfer. The receiver describes its previous copy of a
+// file by block signatures, the sender scans the new file for those blocks and
+// sends a delta stream of
+//     kCopy    uint32 first block, uint32 block count
+//     kLiteral uint32 length, length bytes
+// records that rebuild the new file from the old one.
+
+namespace detail_delta
+{
+    constexpr std::uint8_t kCopy = 1;
+    constexpr std::uint8_t kLiteral = 2;
+
+    constexpr std::uint64_t kStrongSeed = 0x64656C7461ull;
+
+    // Rolling checksum of rsync: a = sum of the bytes, b = sum of (L - i) * byte
+    inline std::uint32_t weak_checksum(unsigned char const* p, std::size_t nSize) noexcept
+    {
+        auto a = std::uint32_t{ 0 };
+        auto b = std::uint32_t{ 0 };
+        for (std::size_t i = 0; i < nSize; ++i)
+        {
+            a += p[i];
+            b += static_cast<std::uint32_t>(nSize - i) * p[i];
+        }
+        return (a & 0xFFFF) | (b << 16);
+    }
+
+    inline void put32(std::vector<char>& out, std::uint32_t n)
+    {
+        char bytes[sizeof(n)];
+        std::memcpy(bytes, &n, sizeof(n));
+        out.insert(out.end(), bytes, bytes + sizeof(n));
+    }
+}
+
+/*******************
+ * DeltaSignatures *
+ *******************/
+
+class DeltaSignatures
+{
+public:
+    struct Block
+    {
+        std::uint32_t nWeak;
+        std::uint64_t nStrong;
+    };
+
+    // About sqrt(size) like rsync, in whole KiB between 2 KiB and 128 KiB
+    static std::uint32_t block_size_for(std::int64_t nSize) noexcept
+    {
+        auto const nRoot = static_cast<std::int64_t>(std::sqrt(static_cast<double>(std::max<std::int64_t>(nSize, 0))));
+        auto const nBlock = (nRoot + 1023) / 1024 * 1024;
+        return static_cast<std::uint32_t>(std::clamp<std::int64_t>(nBlock, 2 * 1024, 128 * 1024));
+    }
+
+    // Signatures of the whole blocks of the previous copy, the tail is always sent literally
+    void compute(char const* pData, std::int64_t nSize)
+    {
+        m_nBlockSize = block_size_for(nSize);
+        m_blocks.clear();
+
+        auto const p = reinterpret_cast<unsigned char const*>(pData);
+        for (auto nOffset = std::int64_t{ 0 }; nSize - nOffset >= m_nBlockSize; nOffset += m_nBlockSize)
+        {
+            m_blocks.push_back(Block{ detail_delta::weak_checksum(p + nOffset, m_nBlockSize),
+                                      xxh64(p + nOffset, m_nBlockSize, detail_delta::kStrongSeed) });
+        }
+    }
+
+    void clear() noexcept
+    {
+        m_blocks.clear();
+    }
+
+    std::uint32_t block_size() const noexcept { return m_nBlockSize; }
+    std::vector<Block> const& blocks() const noexcept { return m_blocks; }
+    bool empty() const noexcept { return m_blocks.empty(); }
+
+    // Block size, count, then weak and strong sum of every block
+    bool send(Connection& connection) const
+    {
+        auto message = std::vector<char>{};
+        message.reserve(8 + m_blocks.size() * 12);
+        detail_delta::put32(message, m_nBlockSize);
+        detail_delta::put32(message, static_cast<std::uint32_t>(m_blocks.size()));
+        for (auto const& block : m_blocks)
+        {
+            detail_delta::put32(message, block.nWeak);
+            detail_delta::put32(message, static_cast<std::uint32_t>(block.nStrong));
+            detail_delta::put32(message, static_cast<std::uint32_t>(block.nStrong >> 32));
+        }
+
+        for (auto nSent = std::size_t{ 0 }; nSent < message.size(); )
+        {
+            connection.send(message.data() + nSent, static_cast<int>(std::min<std::size_t>(message.size() - nSent, 1 << 20)));
+            if (connection.is_socket_error())
+                return false;
+            nSent += static_cast<std::size_t>(connection.getResult());
+        }
+        return true;
+    }
+
+    bool recv(Connection& connection, std::uint32_t nMaxBlocks = 1u << 24)
+    {
+        m_blocks.clear();
+
+        m_nBlockSize = connection.recv_val<std::uint32_t>(MSG_WAITALL);
+        auto const nBlocks = connection.recv_val<std::uint32_t>(MSG_WAITALL);
+        if (connection.getResult() != static_cast<int>(sizeof(nBlocks)) || nBlocks > nMaxBlocks || (nBlocks > 0 && m_nBlockSize == 0))
+            return false;
+
+        auto message = std::vector<char>(static_cast<std::size_t>(nBlocks) * 12);
+        for (auto nReceived = std::size_t{ 0 }; nReceived < message.size(); )
+        {
+            connection.recv(message.data() + nReceived, static_cast<int>(std::min<std::size_t>(message.size() - nReceived, 1 << 20)));
+            if (connection.getResult() <= 0)
+                return false;
+            nReceived += static_cast<std::size_t>(connection.getResult());
+        }
+
+        m_blocks.resize(nBlocks);
+        for (std::size_t i = 0; i < m_blocks.size(); ++i)
+        {
+            auto nLow = std::uint32_t{};
+            auto nHigh = std::uint32_t{};
+            std::memcpy(&m_blocks[i].nWeak, message.data() + i * 12, 4);
+            std::memcpy(&nLow, message.data() + i * 12 + 4, 4);
+            std::memcpy(&nHigh, message.data() + i * 12 + 8, 4);
+            m_blocks[i].nStrong = nLow | (std::uint64_t{ nHigh } << 32);
+        }
+        return true;
+    }
+
+private:
+    std::uint32_t      m_nBlockSize = 0;
+    std::vector<Block> m_blocks;
+};
+
+/****************
+ * DeltaEncoder *
+ ****************/
+
+// Sender side. The weak checksum of a window at k is derived from two prefix
+// sums, S[j] = sum x[m] and T[j] = sum m * x[m] for m < j:
+//     a(k) = S[k+L] - S[k],  b(k) = (L + k) * a(k) - (T[k+L] - T[k])
+// so the checksums of a whole run of positions come out of one loop without
+// a dependency from one position to the next, which the compiler vectorizes.
+// That loop also tests every checksum against a bitmap filter of the signed
+// ones; only the few positions that pass are looked up and confirmed with the
+// strong hash.
+class DeltaEncoder
+{
+public:
+    struct Stats
+    {
+        std::int64_t nCopiedBytes = 0;
+        std::int64_t nLiteralBytes = 0;
+    };
+
+    explicit DeltaEncoder(DeltaSignatures const& signatures)
+        : m_signatures{ signatures }
+        , m_nBlockSize{ signatures.block_size() }
+        , m_filter(kFilterBits / 64)
+    {
+        auto const& blocks = signatures.blocks();
+        m_index.reserve(blocks.size());
+        for (std::uint32_t i = 0; i < blocks.size(); ++i)
+        {
+            m_index.emplace_back(blocks[i].nWeak, i);
+            auto const nBit = filter_bit(blocks[i].nWeak);
+            m_filter[nBit / 64] |= std::uint64_t{ 1 } << (nBit % 64);
+        }
+        std::sort(m_index.begin(), m_index.end());
+    }
+
+    // The delta stream that turns the signed file into [pData, pData + nSize)
+    std::vector<char> encode(char const* pData, std::int64_t nSize, Stats& stats)
+    {
+        auto const p = reinterpret_cast<unsigned char const*>(pData);
+        auto const L = static_cast<std::int64_t>(m_nBlockSize);
+
+        m_delta.clear();
+        m_pData = p;
+        m_nLiteralStart = 0;
+        m_nRunBlock = 0;
+        m_nRunCount = 0;
+        stats = Stats{};
+
+        auto nPos = std::int64_t{ 0 };
+        if (!m_index.empty())
+        {
+            auto sums = std::vector<std::uint32_t>{};
+            auto weightedSums = std::vector<std::uint32_t>{};
+            auto candidates = std::vector<std::uint32_t>{};
+
+            while (nSize - nPos >= L)
+            {
+                // Checksums of the windows starting at nPos .. nPos + nWindows - 1
+                auto const nWindows = std::min<std::int64_t>(kWindows, nSize - nPos - L + 1);
+                auto const nBytes = static_cast<std::size_t>(nWindows + L - 1);
+                auto const pBase = p + nPos;
+
+                sums.resize(nBytes + 1);
+                weightedSums.resize(nBytes + 1);
+                auto nSum = std::uint32_t{ 0 };
+                auto nWeightedSum = std::uint32_t{ 0 };
+                for (std::size_t j = 0; j < nBytes; ++j)
+                {
+                    sums[j] = nSum;
+                    weightedSums[j] = nWeightedSum;
+                    nSum += pBase[j];
+                    nWeightedSum += static_cast<std::uint32_t>(j) * pBase[j];
+                }
+                sums[nBytes] = nSum;
+                weightedSums[nBytes] = nWeightedSum;
+
+                // Only windows that pass the filter are collected
+                candidates.clear();
+                auto const nL = static_cast<std::uint32_t>(L);
+                auto const pFilter = m_filter.data();
+                for (std::uint32_t k = 0; k < static_cast<std::uint32_t>(nWindows); ++k)
+                {
+                    auto const a = sums[k + nL] - sums[k];
+                    auto const b = (nL + k) * a - (weightedSums[k + nL] - weightedSums[k]);
+                    auto const nBit = filter_bit((a & 0xFFFF) | (b << 16));
+                    if (pFilter[nBit / 64] & (std::uint64_t{ 1 } << (nBit % 64)))
+                        candidates.push_back(k);
+                }
+
+                // A match skips the windows overlapping its block
+                auto nNext = std::int64_t{ 0 };
+                for (auto const k : candidates)
+                {
+                    if (k < nNext)
+                        continue;
+
+                    auto const a = sums[k + nL] - sums[k];
+                    auto const b = (nL + k) * a - (weightedSums[k + nL] - weightedSums[k]);
+                    auto const nBlock = match((a & 0xFFFF) | (b << 16), pBase + k);
+                    if (nBlock >= 0)
+                    {
+                        copy_block(nPos + k, static_cast<std::uint32_t>(nBlock), stats);
+                        nNext = k + L;
+                    }
+                }
+                nPos += std::max(nNext, nWindows);
+            }
+        }
+
+        flush_run();
+        flush_literal(nSize, stats);
+        return std::move(m_delta);
+    }
+
+private:
+    static constexpr std::int64_t kWindows = 64 * 1024;
+    static constexpr std::uint32_t kFilterBits = 1u << 20;
+
+    static std::uint32_t filter_bit(std::uint32_t nWeak) noexcept
+    {
+        return static_cast<std::uint32_t>((nWeak * 0x9E3779B1u) >> 12) % kFilterBits;
+    }
+
+    // Block with this content, -1 if none; the block after the last copy is preferred
+    std::int64_t match(std::uint32_t nWeak, unsigned char const* pWindow) const
+    {
+        auto const range = std::equal_range(m_index.begin(), m_index.end(), std::make_pair(nWeak, std::uint32_t{ 0 }),
+                                            [](auto const& lhs, auto const& rhs) { return lhs.first < rhs.first; });
+        if (range.first == range.second)
+            return -1;
+
+        auto const nStrong = xxh64(pWindow, m_nBlockSize, detail_delta::kStrongSeed);
+        auto const& blocks = m_signatures.blocks();
+
+        auto const nNext = m_nRunBlock + m_nRunCount;
+        if (m_nRunCount > 0 && nNext < blocks.size() && blocks[nNext].nWeak == nWeak && blocks[nNext].nStrong == nStrong)
+            return nNext;
+
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (blocks[it->second].nStrong == nStrong)
+                return it->second;
+        }
+        return -1;
+    }
+
+    void copy_block(std::int64_t nOffset, std::uint32_t nBlock, Stats& stats)
+    {
+        if (nOffset > m_nLiteralStart)
+        {
+            flush_run();
+            flush_literal(nOffset, stats);
+        }
+
+        if (m_nRunCount > 0 && nBlock != m_nRunBlock + m_nRunCount)
+            flush_run();
+        if (m_nRunCount == 0)
+            m_nRunBlock = nBlock;
+        ++m_nRunCount;
+
+        m_nLiteralStart = nOffset + m_nBlockSize;
+        stats.nCopiedBytes += m_nBlockSize;
+    }
+
+    void flush_run()
+    {
+        if (m_nRunCount == 0)
+            return;
+
+        m_delta.push_back(static_cast<char>(detail_delta::kCopy));
+        detail_delta::put32(m_delta, m_nRunBlock);
+        detail_delta::put32(m_delta, m_nRunCount);
+        m_nRunCount = 0;
+    }
+
+    // Literal bytes from the last match up to nEnd
+    void flush_literal(std::int64_t nEnd, Stats& stats)
+    {
+        constexpr auto nMaxRecord = std::int64_t{ 1 } << 30;
+        while (m_nLiteralStart < nEnd)
+        {
+            auto const nLength = std::min(nEnd - m_nLiteralStart, nMaxRecord);
+            m_delta.push_back(static_cast<char>(detail_delta::kLiteral));
+            detail_delta::put32(m_delta, static_cast<std::uint32_t>(nLength));
+            m_delta.insert(m_delta.end(), m_pData + m_nLiteralStart, m_pData + m_nLiteralStart + nLength);
+            m_nLiteralStart += nLength;
+            stats.nLiteralBytes += nLength;
+        }
+    }
+
+    DeltaSignatures const& m_signatures;
+    std::uint32_t          m_nBlockSize;
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> m_index;   // weak sum, block
+    std::vector<std::uint64_t> m_filter;
+
+    std::vector<char>    m_delta;
+    unsigned char const* m_pData = nullptr;
+    std::int64_t         m_nLiteralStart = 0;
+    std::uint32_t        m_nRunBlock = 0;
+    std::uint32_t        m_nRunCount = 0;
+};
+
+// Receiver side: rebuilds the new file into out (already sized) from the old
+// copy and a received delta stream. False if the stream is malformed.
+inline bool delta_apply(BufferChain const& delta, char const* pBasis, std::int64_t nBasisSize, std::uint32_t nBlockSize, BufferChain& out)
+{
+    auto nIn = std::int64_t{ 0 };
+    auto nOut = std::int64_t{ 0 };
+
+    // Copies nBytes from the delta stream, or from pSource if set, into out
+    auto const emit = [&](char const* pSource, std::int64_t nBytes)
+    {
+        if (nBytes > out.size() - nOut || (!pSource && nBytes > delta.size() - nIn))
+            return false;
+
+        while (nBytes > 0)
+        {
+            auto const target = out.span_at(nOut);
+            auto nChunk = std::min(nBytes, target.second);
+            if (pSource)
+            {
+                std::memcpy(target.first, pSource, static_cast<std::size_t>(nChunk));
+                pSource += nChunk;
+            }
+            else
+            {
+                auto const source = delta.span_at(nIn);
+                nChunk = std::min(nChunk, source.second);
+                std::memcpy(target.first, source.first, static_cast<std::size_t>(nChunk));
+                nIn += nChunk;
+            }
+            nOut += nChunk;
+            nBytes -= nChunk;
+        }
+        return true;
+    };
+
+    auto const read32 = [&](std::uint32_t& n)
+    {
+        char bytes[sizeof(n)];
+        for (auto& byte : bytes)
+        {
+            if (nIn >= delta.size())
+                return false;
+            byte = *delta.span_at(nIn++).first;
+        }
+        std::memcpy(&n, bytes, sizeof(n));
+        return true;
+    };
+
+    auto const nBasisBlocks = nBlockSize ? static_cast<std::uint64_t>(nBasisSize / nBlockSize) : 0;
+    while (nIn < delta.size())
+    {
+        auto const nType = static_cast<std::uint8_t>(*delta.span_at(nIn++).first);
+        auto nFirst = std::uint32_t{};
+        auto nCount = std::uint32_t{};
+
+        if (nType == detail_delta::kCopy)
+        {
+            if (!read32(nFirst) || !read32(nCount) || std::uint64_t{ nFirst } + nCount > nBasisBlocks
+                || !emit(pBasis + std::int64_t{ nFirst } * nBlockSize, std::int64_t{ nCount } * nBlockSize))
+                return false;
+        }
+        else if (nType == detail_delta::kLiteral)
+        {
+            if (!read32(nCount) || !emit(nullptr, nCount))
+                return false;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return nOut == out.size();
+}
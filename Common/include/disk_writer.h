@@ -0,0 +1,470 @@
+#pragma once
+
+#include "buffer_pool.h"
+#include "chunk_store.h"
+#include "unique_handle.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#undef min
+#undef max
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/****************
+ * BoundedQueue *
+ ****************/
+
+// Lock-free multi producer / multi consumer queue of fixed capacity. Every
+// cell carries a sequence number telling whose turn it is, so producers and
+// consumers only contend on their own position counter.
+template<typename T>
+class BoundedQueue
+{
+public:
+    // Capacity is rounded up to a power of two
+    explicit BoundedQueue(std::size_t nCapacity)
+    {
+        auto nSize = std::size_t{ 2 };
+        while (nSize < nCapacity)
+            nSize *= 2;
+
+        m_nMask = nSize - 1;
+        m_cells = std::make_unique<Cell[]>(nSize);
+        for (std::size_t i = 0; i < nSize; ++i)
+            m_cells[i].nSeq.store(i, std::memory_order_relaxed);
+    }
+
+    bool try_push(T&& value)
+    {
+        auto nPos = m_nEnqueue.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            auto& cell = m_cells[nPos & m_nMask];
+            auto const nSeq = cell.nSeq.load(std::memory_order_acquire);
+            auto const nDiff = static_cast<std::intptr_t>(nSeq) - static_cast<std::intptr_t>(nPos);
+            if (nDiff == 0)
+            {
+                if (m_nEnqueue.compare_exchange_weak(nPos, nPos + 1, std::memory_order_relaxed))
+                {
+                    cell.value = std::move(value);
+                    cell.nSeq.store(nPos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (nDiff < 0)
+            {
+                return false;   // full
+            }
+            else
+            {
+                nPos = m_nEnqueue.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(T& value)
+    {
+        auto nPos = m_nDequeue.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            auto& cell = m_cells[nPos & m_nMask];
+            auto const nSeq = cell.nSeq.load(std::memory_order_acquire);
+            auto const nDiff = static_cast<std::intptr_t>(nSeq) - static_cast<std::intptr_t>(nPos + 1);
+            if (nDiff == 0)
+            {
+                if (m_nDequeue.compare_exchange_weak(nPos, nPos + 1, std::memory_order_relaxed))
+                {
+                    value = std::move(cell.value);
+                    cell.value = T{};
+                    cell.nSeq.store(nPos + m_nMask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (nDiff < 0)
+            {
+                return false;   // empty
+            }
+            else
+            {
+                nPos = m_nDequeue.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<std::size_t> nSeq{ 0 };
+        T value{};
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+    std::size_t m_nMask = 0;
+
+    alignas(64) std::atomic<std::size_t> m_nEnqueue{ 0 };
+    alignas(64) std::atomic<std::size_t> m_nDequeue{ 0 };
+};
+
+/******************
+ * DiskWriteGroup *
+ ******************/
+
+// Completion tracking for the files one session handed to the writer
+class DiskWriteGroup
+{
+public:
+    void add() noexcept
+    {
+        m_nPending.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void done(bool bSuccess)
+    {
+        if (!bSuccess)
+            m_nFailed.fetch_add(1, std::memory_order_relaxed);
+
+        if (m_nPending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            auto const lock = std::lock_guard<std::mutex>{ m_mutex };
+            m_cv.notify_all();
+        }
+    }
+
+    // Blocks until every file is written (and synced, with sync batching), returns the number of failures
+    std::size_t wait()
+    {
+        auto lock = std::unique_lock<std::mutex>{ m_mutex };
+        m_cv.wait(lock, [&]() { return m_nPending.load(std::memory_order_acquire) == 0; });
+        return m_nFailed.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<std::size_t> m_nPending{ 0 };
+    std::atomic<std::size_t> m_nFailed{ 0 };
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+};
+
+/******************
+ * DiskWriterPool *
+ ******************/
+
+// Write-behind for received files. submit() moves the file's pool chunks into
+// a bounded queue and returns at once, unless the files not yet written hold
+// more than nQueueBytes; a few writer threads create the file,
+// preallocate it to its final size and write the chunks out, optionally with
+// unbuffered (O_DIRECT / FILE_FLAG_NO_BUFFERING) writes. With nSyncBatch > 0
+// each writer fdatasyncs its files in batches of that many, or when it runs idle.
+// With a ChunkStore the files go into the store instead and become manifests.
+//
+// Every file name belongs to one writer with its own queue, so writes of the
+// same name never overlap and land in the order they were submitted.
+class DiskWriterPool
+{
+public:
+    struct Options
+    {
+        std::uint32_t nThreads   = 2;
+        std::size_t   nQueueSize = 64;   // per writer
+        std::int64_t  nQueueBytes = std::int64_t{ 256 } << 20;   // file bytes submitted and not yet written
+        bool          bDirectIo  = false;
+        std::uint32_t nSyncBatch = 0;   // 0 leaves flushing to the OS
+        ChunkStore*   pStore     = nullptr;
+    };
+
+    explicit DiskWriterPool(Options const& options)
+        : m_options{ options }
+    {
+        for (std::uint32_t i = 0; i < std::max<std::uint32_t>(options.nThreads, 1); ++i)
+            m_writers.push_back(std::make_unique<Writer>(options.nQueueSize));
+        for (auto& pWriter : m_writers)
+            pWriter->thread = std::thread{ [this, &writer = *pWriter]() { run(writer); } };
+    }
+
+    DiskWriterPool(DiskWriterPool const&) = delete;
+    DiskWriterPool& operator=(DiskWriterPool const&) = delete;
+
+    // Writes everything still queued, then stops the writers
+    ~DiskWriterPool()
+    {
+        {
+            auto const lock = std::lock_guard<std::mutex>{ m_mutex };
+            m_bStop = true;
+        }
+        for (auto& pWriter : m_writers)
+            pWriter->workCv.notify_all();
+
+        for (auto& pWriter : m_writers)
+            pWriter->thread.join();
+    }
+
+    // Blocks while the queue is full or the byte budget is used up
+    void submit(std::string strFileName, BufferChain data, std::shared_ptr<DiskWriteGroup> group)
+    {
+        group->add();
+
+        {
+            // A file larger than the whole budget still goes through, on its own
+            auto const nBytes = data.size();
+            auto lock = std::unique_lock<std::mutex>{ m_mutex };
+            ++m_nFullWaiters;
+            m_spaceCv.wait(lock, [&]()
+            {
+                auto const nQueuedBytes = m_nQueuedBytes.load(std::memory_order_acquire);
+                return nQueuedBytes == 0 || nQueuedBytes + nBytes <= m_options.nQueueBytes;
+            });
+            --m_nFullWaiters;
+            m_nQueuedBytes.fetch_add(nBytes, std::memory_order_acq_rel);
+        }
+
+        auto& writer = *m_writers[std::hash<std::string>{}(strFileName) % m_writers.size()];
+        auto job = Job{ std::move(strFileName), std::move(data), std::move(group) };
+        while (!writer.queue.try_push(std::move(job)))
+        {
+            auto lock = std::unique_lock<std::mutex>{ m_mutex };
+            ++m_nFullWaiters;
+            m_spaceCv.wait(lock, [&]() { return writer.nQueued.load(std::memory_order_acquire) < static_cast<std::ptrdiff_t>(m_options.nQueueSize); });
+            --m_nFullWaiters;
+        }
+
+        writer.nQueued.fetch_add(1, std::memory_order_release);
+        {
+            // A writer between its empty check and wait() holds the mutex, so it cannot miss this wakeup
+            auto const lock = std::lock_guard<std::mutex>{ m_mutex };
+        }
+        writer.workCv.notify_one();
+    }
+
+private:
+    struct Job
+    {
+        std::string strFileName;
+        BufferChain data;
+        std::shared_ptr<DiskWriteGroup> group;
+    };
+
+#ifdef _WIN32
+    using file_handle = unique_handle<win_handle_traits>;
+#else
+    using file_handle = unique_fd;
+#endif
+
+    struct Writer
+    {
+        explicit Writer(std::size_t nQueueSize)
+            : queue{ nQueueSize }
+        {}
+
+        BoundedQueue<Job> queue;
+        // Counted after the push and before the pop, so it may dip below zero for a moment
+        std::atomic<std::ptrdiff_t> nQueued{ 0 };
+        std::condition_variable workCv;
+        std::thread thread;
+    };
+
+    struct Unsynced
+    {
+        std::string strFileName;
+        file_handle file;
+        std::shared_ptr<DiskWriteGroup> group;
+    };
+
+    void run(Writer& writer)
+    {
+        auto unsynced = std::vector<Unsynced>{};
+        auto job = Job{};
+
+        for (;;)
+        {
+            if (writer.queue.try_pop(job))
+            {
+                writer.nQueued.fetch_sub(1, std::memory_order_acq_rel);
+                notify_space();
+
+                // An earlier try of the same file may still be open in the batch; Windows would refuse to reopen it
+                auto const itSame = std::find_if(unsynced.begin(), unsynced.end(), [&](Unsynced const& entry) { return entry.strFileName == job.strFileName; });
+                if (itSame != unsynced.end())
+                {
+                    sync_one(*itSame);
+                    unsynced.erase(itSame);
+                }
+
+                if (m_options.pStore)
+                {
+                    auto const bStored = m_options.pStore->store(job.strFileName, job.data);
+                    release_bytes(job.data);
+                    job.group->done(bStored);
+                    job.group.reset();
+                    continue;
+                }
+
+                auto file = write_file(job.strFileName, job.data);
+                release_bytes(job.data);   // chunks go back to the pool right away
+
+                if (!file || m_options.nSyncBatch == 0)
+                {
+                    job.group->done(static_cast<bool>(file));
+                }
+                else
+                {
+                    unsynced.push_back(Unsynced{ job.strFileName, std::move(file), std::move(job.group) });
+                    if (unsynced.size() >= m_options.nSyncBatch)
+                        sync_all(unsynced);
+                }
+                job.group.reset();
+                continue;
+            }
+
+            // Idle: settle the open batch before sleeping
+            sync_all(unsynced);
+
+            auto lock = std::unique_lock<std::mutex>{ m_mutex };
+            if (writer.nQueued.load(std::memory_order_acquire) > 0)
+                continue;
+            if (m_bStop)
+                return;
+            writer.workCv.wait(lock, [&]() { return m_bStop || writer.nQueued.load(std::memory_order_acquire) > 0; });
+        }
+    }
+
+    void release_bytes(BufferChain& data)
+    {
+        auto const nBytes = data.size();
+        data = BufferChain{};
+        m_nQueuedBytes.fetch_sub(nBytes, std::memory_order_acq_rel);
+        notify_space();
+    }
+
+    void notify_space()
+    {
+        auto const lock = std::lock_guard<std::mutex>{ m_mutex };
+        if (m_nFullWaiters > 0)
+            m_spaceCv.notify_all();
+    }
+
+    static void sync_one(Unsynced& entry)
+    {
+#ifdef _WIN32
+        auto const bSynced = FlushFileBuffers(*entry.file) != 0;
+#else
+        auto const bSynced = ::fdatasync(*entry.file) == 0;
+#endif
+        entry.file.reset();
+        entry.group->done(bSynced);
+    }
+
+    static void sync_all(std::vector<Unsynced>& unsynced)
+    {
+        for (auto& entry : unsynced)
+            sync_one(entry);
+        unsynced.clear();
+    }
+
+    // Returns the still open file on success, an invalid handle on failure
+    file_handle write_file(std::string const& strFileName, BufferChain const& data) const
+    {
+        auto const nSize = data.size();
+        auto const bDirect = m_options.bDirectIo && nSize > 0;
+
+        // The name may be a hard link into a chunk store, which must not be truncated
+        std::remove(strFileName.c_str());
+
+#ifdef _WIN32
+        auto file = file_handle{ CreateFileA(strFileName.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                                             FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN | (bDirect ? FILE_FLAG_NO_BUFFERING : 0), nullptr) };
+        if (!file && bDirect)
+            file.reset(CreateFileA(strFileName.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                                   FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+#else
+        auto file = file_handle{ bDirect ? ::open(strFileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644) : -1 };
+        if (!file)
+            file.reset(::open(strFileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+#endif
+        if (!file)
+        {
+            print_err("Failed to open file ", strFileName);
+            return {};
+        }
+
+        // Reserve the whole extent up front, so the file does not fragment while it grows
+        if (nSize > 0)
+        {
+#ifdef _WIN32
+            auto allocationInfo = FILE_ALLOCATION_INFO{};
+            allocationInfo.AllocationSize.QuadPart = nSize;
+            SetFileInformationByHandle(*file, FileAllocationInfo, &allocationInfo, sizeof(allocationInfo));
+#else
+            ::posix_fallocate(*file, 0, static_cast<off_t>(nSize));
+#endif
+        }
+
+        // Unbuffered writes need whole sectors: the short tail is padded to a page,
+        // which the chunk always has room for, and cut off again below
+        auto const bWritten = data.for_each_span([&](char const* pData, std::int64_t nBytes)
+        {
+            if (bDirect)
+                nBytes = (nBytes + BufferPool::kPageSize - 1) / BufferPool::kPageSize * BufferPool::kPageSize;
+
+            while (nBytes > 0)
+            {
+#ifdef _WIN32
+                auto nWritten = DWORD{ 0 };
+                if (!WriteFile(*file, pData, static_cast<DWORD>(std::min<std::int64_t>(nBytes, 1 << 30)), &nWritten, nullptr))
+                    return false;
+#else
+                auto const nWritten = ::write(*file, pData, static_cast<std::size_t>(nBytes));
+                if (nWritten < 0 && errno == EINTR)
+                    continue;
+                if (nWritten <= 0)
+                    return false;
+#endif
+                pData += nWritten;
+                nBytes -= nWritten;
+            }
+            return true;
+        });
+
+#ifdef _WIN32
+        auto endOfFile = FILE_END_OF_FILE_INFO{};
+        endOfFile.EndOfFile.QuadPart = nSize;
+        auto const bTrimmed = SetFileInformationByHandle(*file, FileEndOfFileInfo, &endOfFile, sizeof(endOfFile)) != 0;
+#else
+        auto const bTrimmed = ::ftruncate(*file, static_cast<off_t>(nSize)) == 0;
+#endif
+
+        if (!bWritten || !bTrimmed)
+        {
+            print_err("Failed to write file ", strFileName);
+            return {};
+        }
+
+        return file;
+    }
+
+    Options m_options;
+    std::vector<std::unique_ptr<Writer>> m_writers;
+
+    std::atomic<std::int64_t> m_nQueuedBytes{ 0 };
+    std::mutex m_mutex;
+    std::condition_variable m_spaceCv;
+    std::size_t m_nFullWaiters = 0;
+    bool m_bStop = false;
+};
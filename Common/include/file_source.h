@@ -0,0 +1,232 @@
+#pragma once
+
+#include "buffer_pool.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*******************
+ * ReadAheadReader *
+ *******************/
+
+// Streams a file front to back through a fixed ring of pool chunks. A reader
+// thread fills chunk N+1.. while the caller sends from chunk N, so memory stays
+// at nBuffers chunks however large the file is, and disk reads overlap the
+// network. Reading an offset releases every chunk before it.
+class ReadAheadReader
+{
+public:
+    ReadAheadReader(BufferPool& bufferPool, std::size_t nBuffers)
+        : m_bufferPool{ bufferPool }
+        , m_buffers(std::max<std::size_t>(nBuffers, 2))
+    {}
+
+    ReadAheadReader(ReadAheadReader const&) = delete;
+    ReadAheadReader& operator=(ReadAheadReader const&) = delete;
+
+    ~ReadAheadReader()
+    {
+        stop();
+    }
+
+    // Restarts reading fileName from its first byte
+    bool start(std::string const& fileName, std::int64_t nSize)
+    {
+        stop();
+
+        auto fin = std::ifstream{ fileName, std::ios::binary };
+        if (!fin)
+            return false;
+
+        for (auto& buffer : m_buffers)
+        {
+            if (!buffer)
+                buffer = m_bufferPool.acquire();
+        }
+
+        m_nSize = nSize;
+        m_nChunkSize = static_cast<std::int64_t>(m_bufferPool.chunk_size());
+        m_nReadChunks = 0;
+        m_nReleasedChunks = 0;
+        m_nCurrentChunk = -1;
+        m_bStop = false;
+        m_bFailed = false;
+
+        m_thread = std::thread{ [this, fin = std::move(fin)]() mutable { read_loop(fin); } };
+        return true;
+    }
+
+    // Contiguous bytes at nOffset, at most nMax; blocks until they are read. Empty on a read error.
+    std::pair<char const*, std::int64_t> slice(std::int64_t nOffset, std::int64_t nMax)
+    {
+        auto const nChunk = nOffset / m_nChunkSize;
+        if (nChunk != m_nCurrentChunk)
+        {
+            auto lock = std::unique_lock<std::mutex>{ m_mutex };
+            if (nChunk > m_nReleasedChunks)
+            {
+                m_nReleasedChunks = nChunk;
+                m_spaceCv.notify_one();
+            }
+
+            m_readyCv.wait(lock, [&]() { return m_nReadChunks > nChunk || m_bFailed; });
+            if (m_nReadChunks <= nChunk)
+                return { nullptr, 0 };
+
+            m_nCurrentChunk = nChunk;
+        }
+
+        auto const nInChunk = nOffset - nChunk * m_nChunkSize;
+        auto const nAvailable = std::min(m_nChunkSize - nInChunk, m_nSize - nOffset);
+        return { slot(nChunk).data() + nInChunk, std::min(nMax, nAvailable) };
+    }
+
+    void stop()
+    {
+        if (!m_thread.joinable())
+            return;
+
+        {
+            auto const lock = std::lock_guard<std::mutex>{ m_mutex };
+            m_bStop = true;
+        }
+        m_spaceCv.notify_one();
+        m_thread.join();
+    }
+
+private:
+    PoolBuffer& slot(std::int64_t nChunk) noexcept
+    {
+        return m_buffers[static_cast<std::size_t>(nChunk) % m_buffers.size()];
+    }
+
+    void read_loop(std::ifstream& fin)
+    {
+        auto const nChunks = (m_nSize + m_nChunkSize - 1) / m_nChunkSize;
+        auto const nBuffers = static_cast<std::int64_t>(m_buffers.size());
+
+        for (auto nChunk = std::int64_t{ 0 }; nChunk < nChunks; ++nChunk)
+        {
+            {
+                // Wait for the sender to move past the chunk this slot held last
+                auto lock = std::unique_lock<std::mutex>{ m_mutex };
+                m_spaceCv.wait(lock, [&]() { return m_bStop || nChunk - m_nReleasedChunks < nBuffers; });
+                if (m_bStop)
+                    return;
+            }
+
+            // The slot is ours until m_nReadChunks says otherwise, no lock while reading
+            auto const nBytes = std::min(m_nChunkSize, m_nSize - nChunk * m_nChunkSize);
+            auto const bRead = static_cast<bool>(fin.read(slot(nChunk).data(), nBytes));
+
+            {
+                auto const lock = std::lock_guard<std::mutex>{ m_mutex };
+                if (bRead)
+                    ++m_nReadChunks;
+                else
+                    m_bFailed = true;
+            }
+            m_readyCv.notify_one();
+
+            if (!bRead)
+                return;
+        }
+    }
+
+    BufferPool&             m_bufferPool;
+    std::vector<PoolBuffer> m_buffers;
+    std::thread             m_thread;
+
+    std::int64_t m_nSize = 0;
+    std::int64_t m_nChunkSize = 1;
+    std::int64_t m_nCurrentChunk = -1;   // sender side only, skips the lock within a chunk
+
+    std::mutex              m_mutex;
+    std::condition_variable m_readyCv;
+    std::condition_variable m_spaceCv;
+    std::int64_t            m_nReadChunks = 0;
+    std::int64_t            m_nReleasedChunks = 0;
+    bool                    m_bStop = false;
+    bool                    m_bFailed = false;
+};
+
+/**************
+ * FileSource *
+ **************/
+
+// Input file for repeated sends. By default the file is mapped once and served
+// in place; open() only looks at size and mtime and keeps the mapping while
+// they match. With nReadAheadBuffers set, or when the file cannot be mapped,
+// every open() streams the file through a ReadAheadReader instead, for inputs
+// larger than memory.
+class FileSource
+{
+public:
+    explicit FileSource(BufferPool& bufferPool
+                       , std::size_t nReadAheadBuffers = 0
+                       , MappedFile::Options const& options = MappedFile::Options{ true, true })
+        : m_readAhead{ bufferPool, std::max<std::size_t>(nReadAheadBuffers, 2) }
+        , m_bStream{ nReadAheadBuffers > 0 }
+        , m_options{ options }
+    {}
+
+    // Makes the file's current content available from its first byte, returns false if it cannot be read
+    bool open(std::string const& fileName)
+    {
+        auto stamp = FileStamp{};
+        if (!file_stamp(fileName, stamp))
+            return false;
+
+        if (!m_bStream)
+        {
+            if (m_file && fileName == m_strFileName && stamp == m_stamp)
+                return true;
+
+            m_strFileName.clear();
+            if (m_file.open(fileName, m_options))
+            {
+                m_readAhead.stop();
+                m_strFileName = fileName;
+                m_stamp = stamp;
+                return true;
+            }
+        }
+
+        m_stamp = stamp;
+        return m_readAhead.start(fileName, stamp.nSize);
+    }
+
+    std::int64_t size() const noexcept
+    {
+        return m_file ? static_cast<std::int64_t>(m_file.size()) : m_stamp.nSize;
+    }
+
+    // Contiguous bytes at nOffset, at most nMax of them; empty if the file could not be read.
+    // Streamed files have to be read front to back.
+    std::pair<char const*, std::int64_t> slice(std::int64_t nOffset, std::int64_t nMax)
+    {
+        if (m_file)
+            return { m_file.data() + nOffset, std::min(nMax, size() - nOffset) };
+
+        return m_readAhead.slice(nOffset, nMax);
+    }
+
+    bool is_mapped() const noexcept { return static_cast<bool>(m_file); }
+
+private:
+    ReadAheadReader     m_readAhead;
+    bool                m_bStream;
+    MappedFile::Options m_options;
+
+    std::string m_strFileName;
+    FileStamp   m_stamp;
+    MappedFile  m_file;
+};
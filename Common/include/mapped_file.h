@@ -0,0 +1,292 @@
+#pragma once
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#undef min
+#undef max
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*************
+ * FileStamp *
+ *************/
+
+// Size and last write time, enough to tell whether a file changed since it was read
+struct FileStamp
+{
+    std::int64_t nSize = -1;
+    std::int64_t nMtime = 0;   // native units: 100 ns FILETIME ticks on Windows, ns since the epoch elsewhere
+
+    bool operator==(FileStamp const& other) const noexcept { return nSize == other.nSize && nMtime == other.nMtime; }
+    bool operator!=(FileStamp const& other) const noexcept { return !(*this == other); }
+};
+
+inline bool file_stamp(std::string const& fileName, FileStamp& stamp)
+{
+#ifdef _WIN32
+    auto attributes = WIN32_FILE_ATTRIBUTE_DATA{};
+    if (!GetFileAttributesExA(fileName.c_str(), GetFileExInfoStandard, &attributes))
+        return false;
+
+    stamp.nSize = (static_cast<std::int64_t>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+    stamp.nMtime = (static_cast<std::int64_t>(attributes.ftLastWriteTime.dwHighDateTime) << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+#else
+    struct stat fileStat{};
+    if (::stat(fileName.c_str(), &fileStat) != 0)
+        return false;
+
+    stamp.nSize = static_cast<std::int64_t>(fileStat.st_size);
+    stamp.nMtime = static_cast<std::int64_t>(fileStat.st_mtim.tv_sec) * 1000000000 + fileStat.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+/**************
+ * MappedFile *
+ **************/
+
+struct MappedFileOptions
+{
+    bool bSequential = false;   // read-ahead hint for front-to-back access
+    bool bPopulate   = false;   // fault the whole file in while mapping
+};
+
+// Read-only view of a whole file. An empty file is open but has no data.
+class MappedFile
+{
+public:
+    using Options = MappedFileOptions;
+
+    MappedFile() noexcept = default;
+
+    explicit MappedFile(std::string const& fileName, Options const& options = Options{})
+    {
+        open(fileName, options);
+    }
+
+    MappedFile(MappedFile&& other) noexcept
+        : m_pData{ std::exchange(other.m_pData, nullptr) }
+        , m_nSize{ std::exchange(other.m_nSize, 0) }
+        , m_bOpen{ std::exchange(other.m_bOpen, false) }
+    {}
+
+    MappedFile& operator=(MappedFile&& other) noexcept
+    {
+        if (this != &other)
+        {
+            close();
+            m_pData = std::exchange(other.m_pData, nullptr);
+            m_nSize = std::exchange(other.m_nSize, 0);
+            m_bOpen = std::exchange(other.m_bOpen, false);
+        }
+        return *this;
+    }
+
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+
+    ~MappedFile() noexcept
+    {
+        close();
+    }
+
+    bool open(std::string const& fileName, Options const& options = Options{})
+    {
+        close();
+
+#ifdef _WIN32
+        auto const hFile = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (hFile == INVALID_HANDLE_VALUE)
+            return false;
+
+        auto fileSize = LARGE_INTEGER{};
+        if (GetFileSizeEx(hFile, &fileSize) && fileSize.QuadPart > 0)
+        {
+            // The view keeps the mapping alive, both handles can go right away
+            auto const hMapping = CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (hMapping)
+            {
+                m_pData = static_cast<char const*>(MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0));
+                CloseHandle(hMapping);
+            }
+            m_nSize = m_pData ? static_cast<std::size_t>(fileSize.QuadPart) : 0;
+            m_bOpen = m_pData != nullptr;
+
+            if (m_pData && options.bPopulate)
+            {
+                // Windows 8+, looked up at run time; the view works without it
+                using PrefetchVirtualMemory_t = BOOL (WINAPI*)(HANDLE, ULONG_PTR, WIN32_MEMORY_RANGE_ENTRY*, ULONG);
+                auto const hKernel = GetModuleHandleA("kernel32.dll");
+                if (auto const pPrefetch = hKernel ? reinterpret_cast<PrefetchVirtualMemory_t>(GetProcAddress(hKernel, "PrefetchVirtualMemory")) : nullptr)
+                {
+                    auto range = WIN32_MEMORY_RANGE_ENTRY{ const_cast<char*>(m_pData), m_nSize };
+                    pPrefetch(GetCurrentProcess(), 1, &range, 0);
+                }
+            }
+        }
+        else
+        {
+            m_bOpen = fileSize.QuadPart == 0;
+        }
+
+        CloseHandle(hFile);
+#else
+        auto const fd = ::open(fileName.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat fileStat{};
+        if (::fstat(fd, &fileStat) == 0 && fileStat.st_size > 0)
+        {
+            auto nFlags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+            if (options.bPopulate)
+                nFlags |= MAP_POPULATE;
+#endif
+            auto const pData = ::mmap(nullptr, static_cast<std::size_t>(fileStat.st_size), PROT_READ, nFlags, fd, 0);
+            if (pData != MAP_FAILED)
+            {
+                m_pData = static_cast<char const*>(pData);
+                m_nSize = static_cast<std::size_t>(fileStat.st_size);
+                m_bOpen = true;
+
+                if (options.bSequential)
+                    ::madvise(pData, m_nSize, MADV_SEQUENTIAL);
+            }
+        }
+        else
+        {
+            m_bOpen = fileStat.st_size == 0;
+        }
+
+        ::close(fd);
+#endif
+
+        return m_bOpen;
+    }
+
+    void close() noexcept
+    {
+        if (m_pData)
+        {
+#ifdef _WIN32
+            UnmapViewOfFile(m_pData);
+#else
+            ::munmap(const_cast<char*>(m_pData), m_nSize);
+#endif
+        }
+
+        m_pData = nullptr;
+        m_nSize = 0;
+        m_bOpen = false;
+    }
+
+    char const* data() const noexcept { return m_pData; }
+    std::size_t size() const noexcept { return m_nSize; }
+    char const* begin() const noexcept { return m_pData; }
+    char const* end() const noexcept { return m_pData + m_nSize; }
+
+    bool is_open() const noexcept { return m_bOpen; }
+    explicit operator bool() const noexcept { return m_bOpen; }
+
+private:
+    char const* m_pData = nullptr;
+    std::size_t m_nSize = 0;
+    bool        m_bOpen = false;
+};
+
+/**************************
+ * MappedFileInputAdapter *
+ **************************/
+
+// Owns the mapping and hands the whole file to the lexer as a single block
+class MappedFileInputAdapter : public nlohmann::detail::input_adapter_protocol
+{
+public:
+    explicit MappedFileInputAdapter(MappedFile file) noexcept
+        : m_file{ std::move(file) }
+        , m_pCursor{ m_file.begin() }
+    {}
+
+    std::char_traits<char>::int_type get_character() noexcept override
+    {
+        if (m_pCursor != m_file.end())
+            return std::char_traits<char>::to_int_type(*m_pCursor++);
+        return std::char_traits<char>::eof();
+    }
+
+    bool has_blocks() const noexcept override
+    {
+        return true;
+    }
+
+    bool get_block(char const*& first, char const*& last) noexcept override
+    {
+        first = m_pCursor;
+        last = m_file.end();
+        m_pCursor = last;
+        return first != last;
+    }
+
+private:
+    MappedFile  m_file;
+    char const* m_pCursor;
+};
+
+// Parses a whole file through the mapping, throws nlohmann::json::parse_error like operator>>
+inline bool parse_mapped_file(std::string const& fileName, nlohmann::json& json)
+{
+    auto file = MappedFile{ fileName };
+    if (!file)
+        return false;
+
+    auto adapter = nlohmann::detail::input_adapter_t{ std::make_shared<MappedFileInputAdapter>(std::move(file)) };
+    json = nlohmann::json::parse(nlohmann::detail::input_adapter{ std::move(adapter) });
+    return true;
+}
+
+// Writes json compactly (or indented for nIndent >= 0) through a large buffer straight to the file descriptor
+inline bool dump_json_file(std::string const& fileName, nlohmann::json const& json, int nIndent = -1)
+{
+#ifdef _WIN32
+    auto const fd = ::_open(fileName.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    auto const fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    if (fd < 0)
+        return false;
+
+    auto bResult = true;
+    {
+        auto const adapter = std::make_shared<nlohmann::detail::output_fd_adapter<char>>(fd);
+        auto serializer = nlohmann::detail::serializer<nlohmann::json>{ adapter, ' ' };
+        serializer.dump(json, nIndent >= 0, false, static_cast<unsigned int>(std::max(nIndent, 0)));
+        bResult &= adapter->flush();
+    }
+
+#ifdef _WIN32
+    bResult &= ::_close(fd) == 0;
+#else
+    bResult &= ::close(fd) == 0;
+#endif
+
+    return bResult;
+}
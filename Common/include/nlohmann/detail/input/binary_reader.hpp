@@ -11,8 +11,13 @@
 #include <iterator> // back_inserter
 #include <limits> // numeric_limits
 #include <string> // char_traits, string
+#include <type_traits> // integral_constant
 #include <utility> // make_pair, move
 
+#if defined(_MSC_VER) && !defined(__clang__)
+    #include <stdlib.h> // _byteswap_ushort, _byteswap_ulong, _byteswap_uint64
+#endif
+
 #include <nlohmann/detail/exceptions.hpp>
 #include <nlohmann/detail/input/input_adapters.hpp>
 #include <nlohmann/detail/input/json_sax.hpp>
@@ -30,6 +35,12 @@ namespace detail
 
 /*!
 @brief deserialization of CBOR, MessagePack, and UBJSON values
+
+With block input (see input_adapter_protocol::has_blocks) fixed-width numbers
+are loaded in one unaligned read plus a byte swap and strings are copied in
+bulk. If the SAX handler has string_ref()/key_ref() (see has_sax_string_ref),
+CBOR and MessagePack strings lying within one block are passed as views into
+the input instead of being copied at all.
 */
 template<typename BasicJsonType, typename SAX = json_sax_dom_parser<BasicJsonType>>
 class binary_reader
@@ -40,13 +51,24 @@ class binary_reader
     using string_t = typename BasicJsonType::string_t;
     using json_sax_t = SAX;
 
+    /// string bytes left in the input, set by get_string() instead of copying
+    struct string_ref
+    {
+        const char* data = nullptr;
+        std::size_t size = 0;
+        bool valid = false;
+    };
+
+    static constexpr bool sax_string_ref = has_sax_string_ref<SAX>::value;
+
   public:
     /*!
     @brief create a binary reader
 
     @param[in] adapter  input adapter to read from
     */
-    explicit binary_reader(input_adapter_t adapter) : ia(std::move(adapter))
+    explicit binary_reader(input_adapter_t adapter)
+        : ia(std::move(adapter)), block_input(ia->has_blocks())
     {
         (void)detail::is_sax_static_asserts<SAX, BasicJsonType> {};
         assert(ia);
@@ -496,7 +518,8 @@ class binary_reader
             case 0x7F: // UTF-8 string (indefinite length)
             {
                 string_t s;
-                return get_cbor_string(s) and sax->string(s);
+                string_ref ref;
+                return get_cbor_string(s, ref_target(ref)) and emit_string(s, ref);
             }
 
             // array (0x00..0x17 data items follow)
@@ -695,7 +718,7 @@ class binary_reader
 
     @return whether string creation completed
     */
-    bool get_cbor_string(string_t& result)
+    bool get_cbor_string(string_t& result, string_ref* ref = nullptr)
     {
         if (JSON_UNLIKELY(not unexpect_eof(input_format_t::cbor, "string")))
         {
@@ -730,31 +753,31 @@ class binary_reader
             case 0x76:
             case 0x77:
             {
-                return get_string(input_format_t::cbor, static_cast<unsigned int>(current) & 0x1Fu, result);
+                return get_string(input_format_t::cbor, static_cast<unsigned int>(current) & 0x1Fu, result, ref);
             }
 
             case 0x78: // UTF-8 string (one-byte uint8_t for n follows)
             {
                 std::uint8_t len;
-                return get_number(input_format_t::cbor, len) and get_string(input_format_t::cbor, len, result);
+                return get_number(input_format_t::cbor, len) and get_string(input_format_t::cbor, len, result, ref);
             }
 
             case 0x79: // UTF-8 string (two-byte uint16_t for n follow)
             {
                 std::uint16_t len;
-                return get_number(input_format_t::cbor, len) and get_string(input_format_t::cbor, len, result);
+                return get_number(input_format_t::cbor, len) and get_string(input_format_t::cbor, len, result, ref);
             }
 
             case 0x7A: // UTF-8 string (four-byte uint32_t for n follow)
             {
                 std::uint32_t len;
-                return get_number(input_format_t::cbor, len) and get_string(input_format_t::cbor, len, result);
+                return get_number(input_format_t::cbor, len) and get_string(input_format_t::cbor, len, result, ref);
             }
 
             case 0x7B: // UTF-8 string (eight-byte uint64_t for n follow)
             {
                 std::uint64_t len;
-                return get_number(input_format_t::cbor, len) and get_string(input_format_t::cbor, len, result);
+                return get_number(input_format_t::cbor, len) and get_string(input_format_t::cbor, len, result, ref);
             }
 
             case 0x7F: // UTF-8 string (indefinite length)
@@ -833,7 +856,8 @@ class binary_reader
             for (std::size_t i = 0; i < len; ++i)
             {
                 get();
-                if (JSON_UNLIKELY(not get_cbor_string(key) or not sax->key(key)))
+                string_ref ref;
+                if (JSON_UNLIKELY(not get_cbor_string(key, ref_target(ref)) or not emit_key(key, ref)))
                 {
                     return false;
                 }
@@ -849,7 +873,8 @@ class binary_reader
         {
             while (get() != 0xFF)
             {
-                if (JSON_UNLIKELY(not get_cbor_string(key) or not sax->key(key)))
+                string_ref ref;
+                if (JSON_UNLIKELY(not get_cbor_string(key, ref_target(ref)) or not emit_key(key, ref)))
                 {
                     return false;
                 }
@@ -1084,7 +1109,8 @@ class binary_reader
             case 0xBF:
             {
                 string_t s;
-                return get_msgpack_string(s) and sax->string(s);
+                string_ref ref;
+                return get_msgpack_string(s, ref_target(ref)) and emit_string(s, ref);
             }
 
             case 0xC0: // nil
@@ -1161,7 +1187,8 @@ class binary_reader
             case 0xDB: // str 32
             {
                 string_t s;
-                return get_msgpack_string(s) and sax->string(s);
+                string_ref ref;
+                return get_msgpack_string(s, ref_target(ref)) and emit_string(s, ref);
             }
 
             case 0xDC: // array 16
@@ -1241,7 +1268,7 @@ class binary_reader
 
     @return whether string creation completed
     */
-    bool get_msgpack_string(string_t& result)
+    bool get_msgpack_string(string_t& result, string_ref* ref = nullptr)
     {
         if (JSON_UNLIKELY(not unexpect_eof(input_format_t::msgpack, "string")))
         {
@@ -1284,25 +1311,25 @@ class binary_reader
             case 0xBE:
             case 0xBF:
             {
-                return get_string(input_format_t::msgpack, static_cast<unsigned int>(current) & 0x1Fu, result);
+                return get_string(input_format_t::msgpack, static_cast<unsigned int>(current) & 0x1Fu, result, ref);
             }
 
             case 0xD9: // str 8
             {
                 std::uint8_t len;
-                return get_number(input_format_t::msgpack, len) and get_string(input_format_t::msgpack, len, result);
+                return get_number(input_format_t::msgpack, len) and get_string(input_format_t::msgpack, len, result, ref);
             }
 
             case 0xDA: // str 16
             {
                 std::uint16_t len;
-                return get_number(input_format_t::msgpack, len) and get_string(input_format_t::msgpack, len, result);
+                return get_number(input_format_t::msgpack, len) and get_string(input_format_t::msgpack, len, result, ref);
             }
 
             case 0xDB: // str 32
             {
                 std::uint32_t len;
-                return get_number(input_format_t::msgpack, len) and get_string(input_format_t::msgpack, len, result);
+                return get_number(input_format_t::msgpack, len) and get_string(input_format_t::msgpack, len, result, ref);
             }
 
             default:
@@ -1350,7 +1377,8 @@ class binary_reader
         for (std::size_t i = 0; i < len; ++i)
         {
             get();
-            if (JSON_UNLIKELY(not get_msgpack_string(key) or not sax->key(key)))
+            string_ref ref;
+            if (JSON_UNLIKELY(not get_msgpack_string(key, ref_target(ref)) or not emit_key(key, ref)))
             {
                 return false;
             }
@@ -1813,9 +1841,143 @@ class binary_reader
     int get()
     {
         ++chars_read;
+
+        if (JSON_LIKELY(block_cursor != block_limit))
+        {
+            return current = std::char_traits<char>::to_int_type(*(block_cursor++));
+        }
+        if (block_input)
+        {
+            return current = get_from_next_block();
+        }
         return current = ia->get_character();
     }
 
+    /// fetch the next non-empty block from a block-oriented adapter
+    int get_from_next_block()
+    {
+        while (ia->get_block(block_cursor, block_limit))
+        {
+            if (block_cursor != block_limit)
+            {
+                return std::char_traits<char>::to_int_type(*(block_cursor++));
+            }
+        }
+
+        block_cursor = block_limit = nullptr;
+        return std::char_traits<char>::eof();
+    }
+
+    /*!
+    @brief consume @a len bytes at once if the current block holds them
+
+    Equivalent to @a len calls of get(). Returns false, consuming nothing, if
+    the bytes are not contiguous in the current block.
+    */
+    bool get_block_bytes(const std::uint64_t len, const char*& first)
+    {
+        if (len > static_cast<std::uint64_t>(block_limit - block_cursor))
+        {
+            return false;
+        }
+
+        first = block_cursor;
+        if (len > 0)
+        {
+            const auto n = static_cast<std::size_t>(len);
+            block_cursor += n;
+            chars_read += n;
+            current = std::char_traits<char>::to_int_type(block_cursor[-1]);
+        }
+        return true;
+    }
+
+    static std::uint8_t byte_swap(std::uint8_t x) noexcept
+    {
+        return x;
+    }
+
+    static std::uint16_t byte_swap(std::uint16_t x) noexcept
+    {
+#if defined(_MSC_VER) && !defined(__clang__)
+        return _byteswap_ushort(x);
+#else
+        return __builtin_bswap16(x);
+#endif
+    }
+
+    static std::uint32_t byte_swap(std::uint32_t x) noexcept
+    {
+#if defined(_MSC_VER) && !defined(__clang__)
+        return _byteswap_ulong(x);
+#else
+        return __builtin_bswap32(x);
+#endif
+    }
+
+    static std::uint64_t byte_swap(std::uint64_t x) noexcept
+    {
+#if defined(_MSC_VER) && !defined(__clang__)
+        return _byteswap_uint64(x);
+#else
+        return __builtin_bswap64(x);
+#endif
+    }
+
+    /// one unaligned load of a number plus a byte swap if needed
+    template<typename NumberType, bool InputIsLittleEndian>
+    void load_number(const char* first, NumberType& result) const noexcept
+    {
+        using bits_t = typename std::conditional<sizeof(NumberType) == 1, std::uint8_t,
+              typename std::conditional<sizeof(NumberType) == 2, std::uint16_t,
+              typename std::conditional<sizeof(NumberType) == 4, std::uint32_t, std::uint64_t>::type>::type>::type;
+        static_assert(sizeof(bits_t) == sizeof(NumberType), "unsupported number size");
+
+        bits_t bits;
+        std::memcpy(&bits, first, sizeof(bits));
+        if (is_little_endian != InputIsLittleEndian)
+        {
+            bits = byte_swap(bits);
+        }
+        std::memcpy(&result, &bits, sizeof(bits));
+    }
+
+    /// target for get_*_string() when the handler takes views
+    static string_ref* ref_target(string_ref& ref) noexcept
+    {
+        return sax_string_ref ? &ref : nullptr;
+    }
+
+    bool emit_string(string_t& s, const string_ref& ref)
+    {
+        return emit_string(s, ref, std::integral_constant<bool, sax_string_ref> {});
+    }
+
+    bool emit_string(string_t& s, const string_ref& ref, std::true_type /*unused*/)
+    {
+        return ref.valid ? sax->string_ref(ref.data, ref.size) : sax->string(s);
+    }
+
+    bool emit_string(string_t& s, const string_ref& /*unused*/, std::false_type /*unused*/)
+    {
+        return sax->string(s);
+    }
+
+    bool emit_key(string_t& key, const string_ref& ref)
+    {
+        return emit_key(key, ref, std::integral_constant<bool, sax_string_ref> {});
+    }
+
+    bool emit_key(string_t& key, const string_ref& ref, std::true_type /*unused*/)
+    {
+        return ref.valid ? sax->key_ref(ref.data, ref.size) : sax->key(key);
+    }
+
+    bool emit_key(string_t& key, const string_ref& /*unused*/, std::false_type /*unused*/)
+    {
+        return sax->key(key);
+    }
+
     /*!
     @return character read from the input after ignoring all 'N' entries
     */
@@ -1846,6 +2008,14 @@ class binary_reader
     template<typename NumberType, bool InputIsLittleEndian = false>
     bool get_number(const input_format_t format, NumberType& result)
     {
+        // fast path: all bytes are in the current block
+        const char* first = nullptr;
+        if (get_block_bytes(sizeof(NumberType), first))
+        {
+            load_number<NumberType, InputIsLittleEndian>(first, result);
+            return true;
+        }
+
         // step 1: read input into array with system's byte order
         std::array<std::uint8_t, sizeof(NumberType)> vec;
         for (std::size_t i = 0; i < sizeof(NumberType); ++i)
@@ -1879,6 +2049,8 @@ class binary_reader
     @param[in] format the current format (for diagnostics)
     @param[in] len number of characters to read
     @param[out] result string created by reading @a len bytes
+    @param[out] ref    if given and the bytes are contiguous in the input,
+                       receives a view of them instead of @a result
 
     @return whether string creation completed
 
@@ -1889,8 +2061,25 @@ class binary_reader
     template<typename NumberType>
     bool get_string(const input_format_t format,
                     const NumberType len,
-                    string_t& result)
+                    string_t& result,
+                    string_ref* ref = nullptr)
     {
+        const char* first = nullptr;
+        if (get_block_bytes(static_cast<std::uint64_t>(len), first))
+        {
+            if (ref != nullptr)
+            {
+                ref->data = first;
+                ref->size = static_cast<std::size_t>(len);
+                ref->valid = true;
+            }
+            else
+            {
+                result.append(first, static_cast<std::size_t>(len));
+            }
+            return true;
+        }
+
         bool success = true;
         std::generate_n(std::back_inserter(result), len, [this, &success, &format]()
         {
@@ -1970,6 +2159,13 @@ class binary_reader
     /// input adapter
     input_adapter_t ia = nullptr;
 
+    /// whether the adapter hands out contiguous blocks
+    const bool block_input = false;
+
+    /// unread part of the current block
+    const char* block_cursor = nullptr;
+    const char* block_limit = nullptr;
+
     /// the current character
     int current = std::char_traits<char>::eof();
 
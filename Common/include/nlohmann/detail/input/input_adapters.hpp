@@ -42,6 +42,28 @@ struct input_adapter_protocol
 {
     /// get a character [0,255] or std::char_traits<char>::eof().
     virtual std::char_traits<char>::int_type get_character() = 0;
+
+    /// whether the adapter supports get_block(); queried once by the lexer
+    virtual bool has_blocks() const noexcept
+    {
+        return false;
+    }
+
+    /*!
+    @brief get the next block of contiguous input as [first, last)
+
+    Lets the lexer consume the input through a pointer range instead of one
+    virtual get_character() call per byte. The range stays valid until the
+    next call or until the adapter is destroyed. Returns false once the input
+    is exhausted. Adapters that return true from has_blocks() are read through
+    this function only.
+    */
+    virtual bool get_block(const char*& first, const char*& last)
+    {
+        first = last = nullptr;
+        return false;
+    }
+
     virtual ~input_adapter_protocol() = default;
 };
 
@@ -151,6 +173,19 @@ class input_buffer_adapter : public input_adapter_protocol
         return std::char_traits<char>::eof();
     }
 
+    bool has_blocks() const noexcept override
+    {
+        return true;
+    }
+
+    bool get_block(const char*& first, const char*& last) noexcept override
+    {
+        first = cursor;
+        last = limit;
+        cursor = limit;
+        return first != last;
+    }
+
   private:
     /// pointer to the current character
     const char* cursor;
@@ -332,6 +367,10 @@ class wide_string_input_adapter : public input_adapter_protocol
 class input_adapter
 {
   public:
+    /// input adapter for a user-provided adapter implementation
+    input_adapter(input_adapter_t adapter) noexcept
+        : ia(std::move(adapter)) {}
+
     // native support
     input_adapter(std::FILE* file)
         : ia(std::make_shared<file_input_adapter>(file)) {}
@@ -12,6 +12,7 @@
 
 #include <nlohmann/detail/input/input_adapters.hpp>
 #include <nlohmann/detail/input/position_t.hpp>
+#include <nlohmann/detail/input/simd_scan.hpp>
 #include <nlohmann/detail/macro_scope.hpp>
 
 namespace nlohmann
@@ -103,7 +104,7 @@ class lexer
     }
 
     explicit lexer(detail::input_adapter_t&& adapter)
-        : ia(std::move(adapter)), decimal_point_char(get_decimal_point()) {}
+        : ia(std::move(adapter)), block_input(ia->has_blocks()), decimal_point_char(get_decimal_point()) {}
 
     // delete because of pointer members
     lexer(const lexer&) = delete;
@@ -239,6 +240,10 @@ class lexer
 
         while (true)
         {
+            // copy plain content up to the next quote, escape, control
+            // character or ill-formed UTF-8 byte in bulk
+            skip_string_content();
+
             // get next character
             switch (get())
             {
@@ -1247,6 +1252,15 @@ scan_number_done:
             // just reset the next_unget variable and work with current
             next_unget = false;
         }
+        else if (JSON_LIKELY(block_cursor != block_limit))
+        {
+            // fast path: contiguous input without a virtual call per byte
+            current = std::char_traits<char>::to_int_type(*(block_cursor++));
+        }
+        else if (block_input)
+        {
+            current = get_from_next_block();
+        }
         else
         {
             current = ia->get_character();
@@ -1266,6 +1280,21 @@ scan_number_done:
         return current;
     }
 
+    /// fetch the next non-empty block from a block-oriented adapter
+    std::char_traits<char>::int_type get_from_next_block()
+    {
+        while (ia->get_block(block_cursor, block_limit))
+        {
+            if (block_cursor != block_limit)
+            {
+                return std::char_traits<char>::to_int_type(*(block_cursor++));
+            }
+        }
+
+        block_cursor = block_limit = nullptr;
+        return std::char_traits<char>::eof();
+    }
+
     /*!
     @brief unget current character (read it again on next get)
 
@@ -1306,6 +1335,77 @@ scan_number_done:
         token_buffer.push_back(std::char_traits<char>::to_char_type(c));
     }
 
+    /*!
+    @brief consume a run of block input in one step
+
+    Equivalent to calling get() for each of the n bytes at block_cursor. The
+    run must not contain a newline unless count_lines is set.
+    */
+    void consume_block_run(std::size_t n, bool count_lines)
+    {
+        const char* first = block_cursor;
+        const char* last = block_cursor + n;
+
+        token_string.insert(token_string.end(), first, last);
+        position.chars_read_total += n;
+
+        auto line_start = first;
+        if (count_lines)
+        {
+            for (auto p = first; p != last; ++p)
+            {
+                if (*p == '\n')
+                {
+                    ++position.lines_read;
+                    line_start = p + 1;
+                }
+            }
+        }
+
+        if (line_start == first)
+        {
+            position.chars_read_current_line += n;
+        }
+        else
+        {
+            position.chars_read_current_line = static_cast<std::size_t>(last - line_start);
+        }
+
+        current = std::char_traits<char>::to_int_type(*(last - 1));
+        block_cursor = last;
+    }
+
+    /// bulk path of scan_string for contiguous input
+    void skip_string_content()
+    {
+        if (next_unget or block_cursor == block_limit)
+        {
+            return;
+        }
+
+        const auto n = simd::string_content_run(block_cursor, block_limit);
+        if (n != 0)
+        {
+            token_buffer.append(block_cursor, n);
+            consume_block_run(n, false);
+        }
+    }
+
+    /// bulk path of the whitespace loop in scan for contiguous input
+    void skip_whitespace()
+    {
+        if (next_unget or block_cursor == block_limit)
+        {
+            return;
+        }
+
+        const auto n = simd::whitespace_run(block_cursor, block_limit);
+        if (n != 0)
+        {
+            consume_block_run(n, true);
+        }
+    }
+
   public:
     /////////////////////
     // value getters
@@ -1409,6 +1509,7 @@ scan_number_done:
         }
 
         // read next character and ignore whitespace
+        skip_whitespace();
         do
         {
             get();
@@ -1474,6 +1575,12 @@ scan_number_done:
     /// input adapter
     detail::input_adapter_t ia = nullptr;
 
+    /// whether the adapter is read through get_block()
+    const bool block_input = false;
+    /// the unread part of the current input block
+    const char* block_cursor = nullptr;
+    const char* block_limit = nullptr;
+
     /// the current character
     std::char_traits<char>::int_type current = std::char_traits<char>::eof();
 
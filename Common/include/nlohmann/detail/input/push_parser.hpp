@@ -0,0 +1,393 @@
+#pragma once
+
+#include <cstddef> // size_t
+#include <string> // string
+#include <utility> // forward
+
+#include <nlohmann/detail/input/input_adapters.hpp>
+#include <nlohmann/detail/input/simd_scan.hpp>
+
+namespace nlohmann
+{
+namespace detail
+{
+/*!
+@brief incremental parser for a stream of concatenated JSON documents
+
+Bytes are pushed in chunks of any size, e.g. straight from recv(). A small
+structural scanner (nesting depth, inside string, pending escape) carries
+over between chunks and finds the end of each top-level document, which is
+then handed to the regular SAX parser or DOM parser. Objects, arrays and
+strings end at their closing byte. Numbers and literals end at the next
+whitespace or structural byte, or at finish(). Whitespace between documents,
+including the newlines of NDJSON, is skipped.
+
+A document that lies within one chunk is parsed in place. Only a document
+that spans chunks is collected into an internal buffer first. Documents
+larger than the max_document_size given to the constructor are reported as
+malformed and skipped without being collected, so a peer that never closes
+a document cannot grow the buffer without limit.
+
+Malformed documents are reported through the usual channels: the SAX
+parse_error() event, or a discarded value from the DOM overloads. The stream
+continues with the next document.
+*/
+template<typename BasicJsonType>
+class push_parser
+{
+  public:
+    explicit push_parser(std::size_t max_document_size_ = std::size_t(16) << 20) noexcept
+        : max_document_size(max_document_size_)
+    {}
+
+    /*!
+    @brief push a chunk, call @a callback with every completed document
+
+    @param[in] callback  invoked as callback(BasicJsonType&&); the value is
+                         discarded (see is_discarded()) for a malformed
+                         document
+    @return number of documents completed by this chunk
+    */
+    template<typename Callback>
+    std::size_t parse_chunk(const char* data, std::size_t length, Callback&& callback)
+    {
+        return scan(data, length, [&](const char* first, const char* last)
+        {
+            callback(BasicJsonType::parse(input_adapter(first, static_cast<std::size_t>(last - first)), nullptr, false));
+        });
+    }
+
+    /*!
+    @brief push a chunk, replay every completed document as SAX events
+
+    @return false if the handler rejected any document completed by this
+            chunk; later documents in the chunk are still processed
+    */
+    template<typename SAX>
+    bool sax_parse_chunk(const char* data, std::size_t length, SAX* sax)
+    {
+        bool result = true;
+        scan(data, length, [&](const char* first, const char* last)
+        {
+            result = BasicJsonType::sax_parse(input_adapter(first, static_cast<std::size_t>(last - first)), sax) and result;
+        });
+        return result;
+    }
+
+    /*!
+    @brief push a chunk, but stop right after the first completed document
+
+    For a document followed by data in another format, e.g. a JSON header in
+    front of a binary body. The bytes after the document are left alone.
+
+    @param[out] consumed  bytes of the chunk up to the end of the document,
+                          or @a length if no document was completed
+    @param[out] accepted  whether the handler accepted the document
+    @return true if a document was completed
+    */
+    template<typename SAX>
+    bool sax_parse_prefix(const char* data, std::size_t length, SAX* sax, std::size_t& consumed, bool& accepted)
+    {
+        accepted = false;
+        return scan(data, length, [&](const char* first, const char* last)
+        {
+            accepted = BasicJsonType::sax_parse(input_adapter(first, static_cast<std::size_t>(last - first)), sax);
+        }, 1, &consumed) == 1;
+    }
+
+    /*!
+    @brief end of stream: complete a trailing number or literal
+
+    An unfinished object, array or string is handed over as well and is
+    reported as malformed.
+    */
+    template<typename Callback>
+    bool finish(Callback&& callback)
+    {
+        return flush([&](const char* first, const char* last)
+        {
+            callback(BasicJsonType::parse(input_adapter(first, static_cast<std::size_t>(last - first)), nullptr, false));
+        });
+    }
+
+    template<typename SAX>
+    bool sax_finish(SAX* sax)
+    {
+        bool result = true;
+        flush([&](const char* first, const char* last)
+        {
+            result = BasicJsonType::sax_parse(input_adapter(first, static_cast<std::size_t>(last - first)), sax) and result;
+        });
+        return result;
+    }
+
+    /// true while a document has been started but not completed
+    bool in_document() const noexcept
+    {
+        return state != scan_state::between;
+    }
+
+    /// bytes of the current document held back from earlier chunks
+    std::size_t pending_size() const noexcept
+    {
+        return pending.size();
+    }
+
+    /// forget the current partial document
+    void reset() noexcept
+    {
+        state = scan_state::between;
+        depth = 0;
+        pending.clear();
+        discarding = false;
+    }
+
+  private:
+    enum class scan_state
+    {
+        between,    ///< whitespace before the next document
+        container,  ///< inside an object or array, outside strings
+        string,     ///< inside a string
+        escape,     ///< inside a string, after a backslash
+        scalar      ///< inside a top-level number or literal
+    };
+
+    static bool is_delimiter(char c) noexcept
+    {
+        switch (c)
+        {
+            case ' ':
+            case '\t':
+            case '\n':
+            case '\r':
+            case '{':
+            case '}':
+            case '[':
+            case ']':
+            case ',':
+            case ':':
+            case '\"':
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    /// advance through string content, return the position after the closing quote or last
+    const char* scan_string(const char* p, const char* last) noexcept
+    {
+        while (p != last)
+        {
+            if (state == scan_state::escape)
+            {
+                state = scan_state::string;
+                ++p;
+                continue;
+            }
+
+            p += simd::plain_string_run(p, last);
+            if (p == last)
+            {
+                break;
+            }
+
+            const char c = *p++;
+            if (c == '\\')
+            {
+                state = scan_state::escape;
+            }
+            else if (c == '\"')
+            {
+                state = depth == 0 ? scan_state::between : scan_state::container;
+                return p;
+            }
+        }
+        return last;
+    }
+
+    /// report an oversized document as malformed (an empty input) and drop the rest of it
+    template<typename OnDocument>
+    void overflow(const char* at, OnDocument&& on_document)
+    {
+        on_document(at, at);
+        pending.clear();
+        discarding = true;
+    }
+
+    template<typename OnDocument>
+    std::size_t scan(const char* data, std::size_t length, OnDocument&& on_document,
+                     std::size_t max_documents = static_cast<std::size_t>(-1), std::size_t* consumed = nullptr)
+    {
+        const char* const last = data + length;
+        const char* p = data;
+        const char* start = data;
+        std::size_t documents = 0;
+
+        const auto complete = [&](const char* end)
+        {
+            if (discarding)
+            {
+                // already reported when it outgrew the limit
+                discarding = false;
+                return;
+            }
+
+            if (pending.size() + static_cast<std::size_t>(end - start) > max_document_size)
+            {
+                overflow(end, on_document);
+                discarding = false;
+            }
+            else if (pending.empty())
+            {
+                on_document(start, end);
+            }
+            else
+            {
+                pending.append(start, end);
+                on_document(pending.data(), pending.data() + pending.size());
+                pending.clear();
+            }
+            ++documents;
+        };
+
+        while (p != last and documents < max_documents)
+        {
+            switch (state)
+            {
+                case scan_state::between:
+                {
+                    p += simd::whitespace_run(p, last);
+                    if (p == last)
+                    {
+                        break;
+                    }
+
+                    start = p;
+                    switch (*p++)
+                    {
+                        case '{':
+                        case '[':
+                            depth = 1;
+                            state = scan_state::container;
+                            break;
+
+                        case '\"':
+                            state = scan_state::string;
+                            break;
+
+                        // a stray structural byte is a (malformed) document on its own
+                        case '}':
+                        case ']':
+                        case ',':
+                        case ':':
+                            complete(p);
+                            break;
+
+                        default:
+                            state = scan_state::scalar;
+                            break;
+                    }
+                    break;
+                }
+
+                case scan_state::container:
+                {
+                    switch (*p++)
+                    {
+                        case '{':
+                        case '[':
+                            ++depth;
+                            break;
+
+                        case '}':
+                        case ']':
+                            if (--depth == 0)
+                            {
+                                state = scan_state::between;
+                                complete(p);
+                            }
+                            break;
+
+                        case '\"':
+                            state = scan_state::string;
+                            break;
+
+                        default:
+                            break;
+                    }
+                    break;
+                }
+
+                case scan_state::string:
+                case scan_state::escape:
+                {
+                    p = scan_string(p, last);
+                    if (state == scan_state::between)
+                    {
+                        complete(p);
+                    }
+                    break;
+                }
+
+                case scan_state::scalar:
+                {
+                    while (p != last and not is_delimiter(*p))
+                    {
+                        ++p;
+                    }
+                    if (p != last)
+                    {
+                        state = scan_state::between;
+                        complete(p);
+                    }
+                    break;
+                }
+            }
+        }
+
+        if (consumed != nullptr)
+        {
+            *consumed = static_cast<std::size_t>(p - data);
+        }
+
+        if (state != scan_state::between and not discarding)
+        {
+            if (pending.size() + static_cast<std::size_t>(last - start) > max_document_size)
+            {
+                overflow(last, on_document);
+                ++documents;
+            }
+            else
+            {
+                pending.append(start, last);
+            }
+        }
+
+        return documents;
+    }
+
+    template<typename OnDocument>
+    bool flush(OnDocument&& on_document)
+    {
+        if (state == scan_state::between)
+        {
+            return false;
+        }
+
+        const bool reported = not discarding;
+        if (reported)
+        {
+            on_document(pending.data(), pending.data() + pending.size());
+        }
+        reset();
+        return reported;
+    }
+
+    std::size_t max_document_size;
+    scan_state state = scan_state::between;
+    std::size_t depth = 0;
+    std::string pending;
+    bool discarding = false;  ///< inside a document that outgrew max_document_size
+};
+}  // namespace detail
+}  // namespace nlohmann
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <cstddef> // size_t
+#include <cstdint> // uint32_t
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define NLOHMANN_JSON_SIMD_X86 1
+    #include <immintrin.h>
+    #if defined(_MSC_VER) && !defined(__clang__)
+        #include <intrin.h>
+    #endif
+#endif
+
+namespace nlohmann
+{
+namespace detail
+{
+/*!
+@brief bulk scanning helpers for the lexer
+
+Each function returns the length of the longest prefix of [first, last) whose
+bytes all belong to a class. The x86 versions test 16 (SSE2) or 32 (AVX2) bytes
+per step; AVX2 is selected at runtime. Other targets use the scalar loops.
+*/
+namespace simd
+{
+/// string content that needs no handling: 0x20..0x7F except '"' and '\\'
+inline bool is_plain_string_char(char c) noexcept
+{
+    const auto u = static_cast<unsigned char>(c);
+    return u >= 0x20 and u < 0x80 and u != '\"' and u != '\\';
+}
+
+inline bool is_whitespace_char(char c) noexcept
+{
+    return c == ' ' or c == '\t' or c == '\n' or c == '\r';
+}
+
+template<typename Predicate>
+std::size_t scalar_run(const char* first, const char* last, Predicate predicate) noexcept
+{
+    auto p = first;
+    while (p != last and predicate(*p))
+    {
+        ++p;
+    }
+    return static_cast<std::size_t>(p - first);
+}
+
+#ifdef NLOHMANN_JSON_SIMD_X86
+
+inline unsigned count_trailing_zeros(std::uint32_t x) noexcept
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index = 0;
+    _BitScanForward(&index, x);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctz(x));
+#endif
+}
+
+// bytes are compared as signed: 0x80..0xFF are negative and fail "> 0x1F"
+inline __m128i plain_mask_sse2(__m128i v) noexcept
+{
+    const auto printable = _mm_cmpgt_epi8(v, _mm_set1_epi8(0x1F));
+    const auto special = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\"')),
+                                      _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+    return _mm_andnot_si128(special, printable);
+}
+
+inline __m128i whitespace_mask_sse2(__m128i v) noexcept
+{
+    return _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+}
+
+template<typename Mask, typename Predicate>
+std::size_t run_sse2(const char* first, const char* last, Mask mask, Predicate predicate) noexcept
+{
+    auto p = first;
+    while (last - p >= 16)
+    {
+        const auto bits = static_cast<std::uint32_t>(_mm_movemask_epi8(mask(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)))));
+        if (bits != 0xFFFFu)
+        {
+            return static_cast<std::size_t>(p - first) + count_trailing_zeros(~bits);
+        }
+        p += 16;
+    }
+    return static_cast<std::size_t>(p - first) + scalar_run(p, last, predicate);
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+    #define NLOHMANN_JSON_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+    #define NLOHMANN_JSON_TARGET_AVX2
+#endif
+
+NLOHMANN_JSON_TARGET_AVX2
+inline std::size_t plain_string_run_avx2(const char* first, const char* last) noexcept
+{
+    auto p = first;
+    while (last - p >= 32)
+    {
+        const auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        const auto printable = _mm256_cmpgt_epi8(v, _mm256_set1_epi8(0x1F));
+        const auto special = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\"')),
+                                             _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+        const auto bits = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_andnot_si256(special, printable)));
+        if (bits != 0xFFFFFFFFu)
+        {
+            return static_cast<std::size_t>(p - first) + count_trailing_zeros(~bits);
+        }
+        p += 32;
+    }
+    return static_cast<std::size_t>(p - first) + run_sse2(p, last, plain_mask_sse2, is_plain_string_char);
+}
+
+NLOHMANN_JSON_TARGET_AVX2
+inline std::size_t whitespace_run_avx2(const char* first, const char* last) noexcept
+{
+    auto p = first;
+    while (last - p >= 32)
+    {
+        const auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        const auto space = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+                                           _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+        const auto bits = static_cast<std::uint32_t>(_mm256_movemask_epi8(space));
+        if (bits != 0xFFFFFFFFu)
+        {
+            return static_cast<std::size_t>(p - first) + count_trailing_zeros(~bits);
+        }
+        p += 32;
+    }
+    return static_cast<std::size_t>(p - first) + run_sse2(p, last, whitespace_mask_sse2, is_whitespace_char);
+}
+
+#undef NLOHMANN_JSON_TARGET_AVX2
+
+inline bool cpu_has_avx2() noexcept
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4] = {};
+    __cpuid(info, 0);
+    if (info[0] < 7)
+    {
+        return false;
+    }
+
+    // AVX and OSXSAVE, and the OS saves the YMM state
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 27)) == 0 or (info[2] & (1 << 28)) == 0 or (_xgetbv(0) & 6) != 6)
+    {
+        return false;
+    }
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+inline bool use_avx2() noexcept
+{
+    static const bool avx2 = cpu_has_avx2();
+    return avx2;
+}
+
+inline std::size_t plain_string_run(const char* first, const char* last) noexcept
+{
+    return use_avx2() ? plain_string_run_avx2(first, last)
+           : run_sse2(first, last, plain_mask_sse2, is_plain_string_char);
+}
+
+inline std::size_t whitespace_run(const char* first, const char* last) noexcept
+{
+    return use_avx2() ? whitespace_run_avx2(first, last)
+           : run_sse2(first, last, whitespace_mask_sse2, is_whitespace_char);
+}
+
+#else
+
+inline std::size_t plain_string_run(const char* first, const char* last) noexcept
+{
+    return scalar_run(first, last, is_plain_string_char);
+}
+
+inline std::size_t whitespace_run(const char* first, const char* last) noexcept
+{
+    return scalar_run(first, last, is_whitespace_char);
+}
+
+#endif
+
+/*!
+@brief length of the well-formed UTF-8 sequence starting at first
+
+Accepts exactly the byte ranges the lexer accepts (RFC 3629, no overlong
+forms, no surrogates, nothing above U+10FFFF). Returns 0 for anything else,
+including a sequence cut off by last.
+*/
+inline std::size_t utf8_sequence_length(const char* first, const char* last) noexcept
+{
+    const auto byte = [first](std::size_t i)
+    {
+        return static_cast<unsigned char>(first[i]);
+    };
+    const auto available = static_cast<std::size_t>(last - first);
+    const auto lead = byte(0);
+
+    std::size_t length = 0;
+    unsigned char low = 0x80;
+    unsigned char high = 0xBF;
+
+    if (0xC2 <= lead and lead <= 0xDF)
+    {
+        length = 2;
+    }
+    else if (0xE0 <= lead and lead <= 0xEF)
+    {
+        length = 3;
+        low = lead == 0xE0 ? 0xA0 : 0x80;
+        high = lead == 0xED ? 0x9F : 0xBF;
+    }
+    else if (0xF0 <= lead and lead <= 0xF4)
+    {
+        length = 4;
+        low = lead == 0xF0 ? 0x90 : 0x80;
+        high = lead == 0xF4 ? 0x8F : 0xBF;
+    }
+    else
+    {
+        return 0;
+    }
+
+    if (available < length or byte(1) < low or byte(1) > high)
+    {
+        return 0;
+    }
+
+    for (std::size_t i = 2; i < length; ++i)
+    {
+        if (byte(i) < 0x80 or byte(i) > 0xBF)
+        {
+            return 0;
+        }
+    }
+
+    return length;
+}
+
+/// plain string content including well-formed multi-byte UTF-8 sequences
+inline std::size_t string_content_run(const char* first, const char* last) noexcept
+{
+    auto p = first;
+    while (true)
+    {
+        p += plain_string_run(p, last);
+        if (p == last or static_cast<unsigned char>(*p) < 0x80)
+        {
+            break;
+        }
+
+        const auto length = utf8_sequence_length(p, last);
+        if (length == 0)
+        {
+            break;
+        }
+        p += length;
+    }
+    return static_cast<std::size_t>(p - first);
+}
+}  // namespace simd
+}  // namespace detail
+}  // namespace nlohmann
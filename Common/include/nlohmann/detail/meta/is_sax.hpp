@@ -57,6 +57,30 @@ using parse_error_function_t = decltype(std::declval<T &>().parse_error(
     std::declval<std::size_t>(), std::declval<const std::string &>(),
     std::declval<const Exception &>()));
 
+template <typename T>
+using string_ref_function_t = decltype(std::declval<T &>().string_ref(
+    std::declval<const char *>(), std::declval<std::size_t>()));
+
+template <typename T>
+using key_ref_function_t = decltype(std::declval<T &>().key_ref(
+    std::declval<const char *>(), std::declval<std::size_t>()));
+
+/*!
+@brief whether a SAX handler takes strings as views
+
+Such a handler also provides bool string_ref(const char*, std::size_t) and
+bool key_ref(const char*, std::size_t). The binary reader calls them instead of
+string() and key() when the bytes are contiguous in the input. The view is only
+valid during the call.
+*/
+template <typename SAX>
+struct has_sax_string_ref
+{
+  static constexpr bool value =
+      is_detected_exact<bool, string_ref_function_t, SAX>::value &&
+      is_detected_exact<bool, key_ref_function_t, SAX>::value;
+};
+
 template <typename SAX, typename BasicJsonType>
 struct is_sax
 {
@@ -0,0 +1,584 @@
+#pragma once
+
+#include <algorithm> // min, minmax_element
+#include <array> // array
+#include <cstddef> // size_t, nullptr_t
+#include <cstdint> // uint8_t, uint16_t, uint32_t, uint64_t, int64_t
+#include <cstring> // memcpy
+#include <limits> // numeric_limits
+#include <string> // string
+#include <type_traits> // enable_if, is_arithmetic, is_floating_point, is_signed, is_same
+
+#include <nlohmann/detail/exceptions.hpp>
+#include <nlohmann/detail/input/input_adapters.hpp>
+#include <nlohmann/detail/macro_scope.hpp>
+#include <nlohmann/detail/output/output_adapters.hpp>
+
+namespace nlohmann
+{
+namespace detail
+{
+//////////////////////////
+// binary stream writer //
+//////////////////////////
+
+/*!
+@brief writes MessagePack or CBOR value by value, without a basic_json
+
+Containers are opened with their element count (begin_array(n),
+begin_object(n)) and then filled by appending exactly that many values, or
+key/value pairs for objects. Numbers and strings get the same encodings that
+binary_writer picks for equal basic_json values, so the output reads back with
+from_msgpack()/from_cbor(). CBOR additionally allows arrays of unknown length
+via begin_array() ... end_array().
+
+Bytes are staged in a small buffer and handed to the output adapter in
+blocks. Call flush() before reading the output, the destructor flushes too.
+*/
+template<typename CharType>
+class binary_stream_writer
+{
+  public:
+    binary_stream_writer(output_adapter_t<CharType> adapter, const input_format_t format_)
+        : oa(std::move(adapter)), format(format_)
+    {
+        if (JSON_UNLIKELY(format != input_format_t::msgpack and format != input_format_t::cbor))
+        {
+            JSON_THROW(type_error::create(317, "streaming is only supported for MessagePack and CBOR"));
+        }
+    }
+
+    binary_stream_writer(const binary_stream_writer&) = delete;
+    binary_stream_writer& operator=(const binary_stream_writer&) = delete;
+
+    ~binary_stream_writer()
+    {
+        flush();
+    }
+
+    /// open an array of @a n elements
+    void begin_array(const std::size_t n)
+    {
+        if (format == input_format_t::cbor)
+        {
+            write_cbor_header(0x80, n);
+        }
+        else if (n <= 15)
+        {
+            put(static_cast<std::uint8_t>(0x90 | n));
+        }
+        else if (n <= (std::numeric_limits<std::uint16_t>::max)())
+        {
+            put(0xDC);
+            put_number(static_cast<std::uint16_t>(n));
+        }
+        else
+        {
+            put(0xDD);
+            put_number(static_cast<std::uint32_t>(n));
+        }
+    }
+
+    /// open an array of unknown length (CBOR only), close it with end_array()
+    void begin_array()
+    {
+        if (JSON_UNLIKELY(format != input_format_t::cbor))
+        {
+            JSON_THROW(type_error::create(317, "MessagePack arrays need their size up front"));
+        }
+        put(0x9F);
+    }
+
+    /// close an array opened with begin_array()
+    void end_array()
+    {
+        put(0xFF);
+    }
+
+    /// open an object of @a n key/value pairs; append a string key before each value
+    void begin_object(const std::size_t n)
+    {
+        if (format == input_format_t::cbor)
+        {
+            write_cbor_header(0xA0, n);
+        }
+        else if (n <= 15)
+        {
+            put(static_cast<std::uint8_t>(0x80 | n));
+        }
+        else if (n <= (std::numeric_limits<std::uint16_t>::max)())
+        {
+            put(0xDE);
+            put_number(static_cast<std::uint16_t>(n));
+        }
+        else
+        {
+            put(0xDF);
+            put_number(static_cast<std::uint32_t>(n));
+        }
+    }
+
+    void append(std::nullptr_t /*unused*/)
+    {
+        put(format == input_format_t::cbor ? 0xF6 : 0xC0);
+    }
+
+    void append(const bool value)
+    {
+        if (format == input_format_t::cbor)
+        {
+            put(value ? 0xF5 : 0xF4);
+        }
+        else
+        {
+            put(value ? 0xC3 : 0xC2);
+        }
+    }
+
+    /// integers and floating-point numbers
+    template<typename NumberType, typename std::enable_if<
+                 std::is_arithmetic<NumberType>::value and not std::is_same<NumberType, bool>::value, int>::type = 0>
+    void append(const NumberType value)
+    {
+        append_number(value, number_kind<NumberType>());
+    }
+
+    void append(const char* s, const std::size_t length)
+    {
+        if (format == input_format_t::cbor)
+        {
+            write_cbor_header(0x60, length);
+        }
+        else if (length <= 31)
+        {
+            put(static_cast<std::uint8_t>(0xA0 | length));
+        }
+        else if (length <= (std::numeric_limits<std::uint8_t>::max)())
+        {
+            put(0xD9);
+            put_number(static_cast<std::uint8_t>(length));
+        }
+        else if (length <= (std::numeric_limits<std::uint16_t>::max)())
+        {
+            put(0xDA);
+            put_number(static_cast<std::uint16_t>(length));
+        }
+        else
+        {
+            put(0xDB);
+            put_number(static_cast<std::uint32_t>(length));
+        }
+
+        put_bytes(s, length);
+    }
+
+    void append(const std::string& s)
+    {
+        append(s.data(), s.size());
+    }
+
+    void append(const char* s)
+    {
+        append(s, std::char_traits<char>::length(s));
+    }
+
+    /*!
+    @brief a whole array of numbers in one pass
+
+    Unlike n calls to append(), every element gets the same width: the
+    narrowest one that holds the largest element. The run is written straight
+    into the staging buffer, as many elements at a time as fit in it. Values
+    read back the same, only small elements of a wide run take more bytes than
+    append() would give them.
+    */
+    template<typename NumberType, typename std::enable_if<
+                 std::is_arithmetic<NumberType>::value and not std::is_same<NumberType, bool>::value, int>::type = 0>
+    void append_array(const NumberType* values, const std::size_t n)
+    {
+        begin_array(n);
+        if (n > 0)
+        {
+            append_run(values, n, number_kind<NumberType>());
+        }
+    }
+
+    /// hand the staged bytes to the output adapter
+    void flush()
+    {
+        if (used > 0)
+        {
+            oa->write_characters(reinterpret_cast<const CharType*>(buffer.data()), used);
+            used = 0;
+        }
+    }
+
+  private:
+    using signed_kind = std::integral_constant<int, 0>;
+    using unsigned_kind = std::integral_constant<int, 1>;
+    using float_kind = std::integral_constant<int, 2>;
+
+    template<typename NumberType>
+    static constexpr auto number_kind() -> std::integral_constant<int,
+            std::is_floating_point<NumberType>::value ? 2 : (std::is_signed<NumberType>::value ? 0 : 1)>
+    {
+        return {};
+    }
+
+    void append_number(const std::int64_t value, signed_kind /*unused*/)
+    {
+        if (value >= 0)
+        {
+            append_number(static_cast<std::uint64_t>(value), unsigned_kind());
+        }
+        else if (format == input_format_t::cbor)
+        {
+            // the sign lives in the major type, the payload is -1 - value
+            write_cbor_header(0x20, static_cast<std::uint64_t>(-1 - value));
+        }
+        else if (value >= -32)
+        {
+            put(static_cast<std::uint8_t>(value));
+        }
+        else if (value >= (std::numeric_limits<std::int8_t>::min)())
+        {
+            put(0xD0);
+            put_number(static_cast<std::int8_t>(value));
+        }
+        else if (value >= (std::numeric_limits<std::int16_t>::min)())
+        {
+            put(0xD1);
+            put_number(static_cast<std::int16_t>(value));
+        }
+        else if (value >= (std::numeric_limits<std::int32_t>::min)())
+        {
+            put(0xD2);
+            put_number(static_cast<std::int32_t>(value));
+        }
+        else
+        {
+            put(0xD3);
+            put_number(value);
+        }
+    }
+
+    void append_number(const std::uint64_t value, unsigned_kind /*unused*/)
+    {
+        if (format == input_format_t::cbor)
+        {
+            write_cbor_header(0x00, value);
+        }
+        else if (value < 128)
+        {
+            put(static_cast<std::uint8_t>(value));
+        }
+        else if (value <= (std::numeric_limits<std::uint8_t>::max)())
+        {
+            put(0xCC);
+            put_number(static_cast<std::uint8_t>(value));
+        }
+        else if (value <= (std::numeric_limits<std::uint16_t>::max)())
+        {
+            put(0xCD);
+            put_number(static_cast<std::uint16_t>(value));
+        }
+        else if (value <= (std::numeric_limits<std::uint32_t>::max)())
+        {
+            put(0xCE);
+            put_number(static_cast<std::uint32_t>(value));
+        }
+        else
+        {
+            put(0xCF);
+            put_number(value);
+        }
+    }
+
+    void append_number(const float value, float_kind /*unused*/)
+    {
+        put(format == input_format_t::cbor ? 0xFA : 0xCA);
+        put_number(value);
+    }
+
+    void append_number(const double value, float_kind /*unused*/)
+    {
+        put(format == input_format_t::cbor ? 0xFB : 0xCB);
+        put_number(value);
+    }
+
+    void append_number(const long double value, float_kind /*unused*/)
+    {
+        append_number(static_cast<double>(value), float_kind());
+    }
+
+    template<typename NumberType>
+    void append_run(const NumberType* values, const std::size_t n, float_kind /*unused*/)
+    {
+        // long double goes out as double, like append() does
+        using wire_type = typename std::conditional<std::is_same<NumberType, float>::value, float, double>::type;
+        const bool cbor = format == input_format_t::cbor;
+        const std::uint8_t prefix = std::is_same<wire_type, float>::value ? (cbor ? 0xFA : 0xCA) : (cbor ? 0xFB : 0xCB);
+        put_run<1 + sizeof(wire_type)>(values, n, [&](std::uint8_t* out, const NumberType value)
+        {
+            out[0] = prefix;
+            store_number(out + 1, static_cast<wire_type>(value));
+        });
+    }
+
+    template<typename NumberType>
+    void append_run(const NumberType* values, const std::size_t n, unsigned_kind /*unused*/)
+    {
+        const std::uint64_t max_value = *std::max_element(values, values + n);
+        if (format == input_format_t::cbor)
+        {
+            append_cbor_run(values, n, 0, max_value);
+        }
+        else if (max_value < 128)
+        {
+            put_run<1>(values, n, [](std::uint8_t* out, const NumberType value)
+            {
+                out[0] = static_cast<std::uint8_t>(value);
+            });
+        }
+        else if (max_value <= (std::numeric_limits<std::uint8_t>::max)())
+        {
+            put_prefixed_run<std::uint8_t>(values, n, 0xCC);
+        }
+        else if (max_value <= (std::numeric_limits<std::uint16_t>::max)())
+        {
+            put_prefixed_run<std::uint16_t>(values, n, 0xCD);
+        }
+        else if (max_value <= (std::numeric_limits<std::uint32_t>::max)())
+        {
+            put_prefixed_run<std::uint32_t>(values, n, 0xCE);
+        }
+        else
+        {
+            put_prefixed_run<std::uint64_t>(values, n, 0xCF);
+        }
+    }
+
+    template<typename NumberType>
+    void append_run(const NumberType* values, const std::size_t n, signed_kind /*unused*/)
+    {
+        const auto range = std::minmax_element(values, values + n);
+        const std::int64_t min_value = *range.first;
+        const std::int64_t max_value = *range.second;
+        if (min_value >= 0)
+        {
+            // the unsigned encodings, as append() picks for non-negative values
+            append_run_as_unsigned(values, n);
+        }
+        else if (format == input_format_t::cbor)
+        {
+            append_cbor_run(values, n, static_cast<std::uint64_t>(-1 - min_value), static_cast<std::uint64_t>(max_value > 0 ? max_value : 0));
+        }
+        else if (min_value >= -32 and max_value < 128)
+        {
+            put_run<1>(values, n, [](std::uint8_t* out, const NumberType value)
+            {
+                out[0] = static_cast<std::uint8_t>(value);
+            });
+        }
+        else if (min_value >= (std::numeric_limits<std::int8_t>::min)() and max_value <= (std::numeric_limits<std::int8_t>::max)())
+        {
+            put_prefixed_run<std::int8_t>(values, n, 0xD0);
+        }
+        else if (min_value >= (std::numeric_limits<std::int16_t>::min)() and max_value <= (std::numeric_limits<std::int16_t>::max)())
+        {
+            put_prefixed_run<std::int16_t>(values, n, 0xD1);
+        }
+        else if (min_value >= (std::numeric_limits<std::int32_t>::min)() and max_value <= (std::numeric_limits<std::int32_t>::max)())
+        {
+            put_prefixed_run<std::int32_t>(values, n, 0xD2);
+        }
+        else
+        {
+            put_prefixed_run<std::int64_t>(values, n, 0xD3);
+        }
+    }
+
+    template<typename NumberType>
+    void append_run_as_unsigned(const NumberType* values, const std::size_t n)
+    {
+        using unsigned_type = typename std::make_unsigned<NumberType>::type;
+        append_run(reinterpret_cast<const unsigned_type*>(values), n, unsigned_kind());
+    }
+
+    /// CBOR integers: the sign picks the major type, the argument width is shared by the run
+    template<typename NumberType>
+    void append_cbor_run(const NumberType* values, const std::size_t n, const std::uint64_t max_negative, const std::uint64_t max_positive)
+    {
+        const std::uint64_t max_argument = (std::max)(max_negative, max_positive);
+        if (max_argument <= 0x17)
+        {
+            put_run<1>(values, n, [](std::uint8_t* out, const NumberType value)
+            {
+                out[0] = cbor_run_header(value, 0);
+            });
+        }
+        else if (max_argument <= (std::numeric_limits<std::uint8_t>::max)())
+        {
+            put_cbor_run<std::uint8_t>(values, n, 0x18);
+        }
+        else if (max_argument <= (std::numeric_limits<std::uint16_t>::max)())
+        {
+            put_cbor_run<std::uint16_t>(values, n, 0x19);
+        }
+        else if (max_argument <= (std::numeric_limits<std::uint32_t>::max)())
+        {
+            put_cbor_run<std::uint32_t>(values, n, 0x1A);
+        }
+        else
+        {
+            put_cbor_run<std::uint64_t>(values, n, 0x1B);
+        }
+    }
+
+    /// initial byte of a CBOR integer, @a additional 0 puts the argument itself in it
+    template<typename NumberType>
+    static std::uint8_t cbor_run_header(const NumberType value, const std::uint8_t additional)
+    {
+        const std::uint8_t major_type = value < 0 ? 0x20 : 0x00;
+        return static_cast<std::uint8_t>(major_type + (additional != 0 ? additional : cbor_argument(value)));
+    }
+
+    template<typename NumberType>
+    static std::uint64_t cbor_argument(const NumberType value)
+    {
+        return value < 0 ? static_cast<std::uint64_t>(-1 - static_cast<std::int64_t>(value)) : static_cast<std::uint64_t>(value);
+    }
+
+    template<typename WireType, typename NumberType>
+    void put_cbor_run(const NumberType* values, const std::size_t n, const std::uint8_t additional)
+    {
+        put_run<1 + sizeof(WireType)>(values, n, [&](std::uint8_t* out, const NumberType value)
+        {
+            out[0] = cbor_run_header(value, additional);
+            store_number(out + 1, static_cast<WireType>(cbor_argument(value)));
+        });
+    }
+
+    template<typename WireType, typename NumberType>
+    void put_prefixed_run(const NumberType* values, const std::size_t n, const std::uint8_t prefix)
+    {
+        put_run<1 + sizeof(WireType)>(values, n, [&](std::uint8_t* out, const NumberType value)
+        {
+            out[0] = prefix;
+            store_number(out + 1, static_cast<WireType>(value));
+        });
+    }
+
+    /// writes every element as @a Stride bytes, a buffer's worth at a time
+    template<std::size_t Stride, typename NumberType, typename Encode>
+    void put_run(const NumberType* values, const std::size_t n, Encode encode)
+    {
+        for (std::size_t i = 0; i < n;)
+        {
+            if (buffer.size() - used < Stride)
+            {
+                flush();
+            }
+
+            const std::size_t count = (std::min)(n - i, (buffer.size() - used) / Stride);
+            std::uint8_t* out = buffer.data() + used;
+            for (const std::size_t end = i + count; i < end; ++i, out += Stride)
+            {
+                encode(out, values[i]);
+            }
+            used += count * Stride;
+        }
+    }
+
+    /// CBOR initial byte of @a major_type with the shortest argument for @a n
+    void write_cbor_header(const std::uint8_t major_type, const std::uint64_t n)
+    {
+        if (n <= 0x17)
+        {
+            put(static_cast<std::uint8_t>(major_type + n));
+        }
+        else if (n <= (std::numeric_limits<std::uint8_t>::max)())
+        {
+            put(static_cast<std::uint8_t>(major_type + 0x18));
+            put_number(static_cast<std::uint8_t>(n));
+        }
+        else if (n <= (std::numeric_limits<std::uint16_t>::max)())
+        {
+            put(static_cast<std::uint8_t>(major_type + 0x19));
+            put_number(static_cast<std::uint16_t>(n));
+        }
+        else if (n <= (std::numeric_limits<std::uint32_t>::max)())
+        {
+            put(static_cast<std::uint8_t>(major_type + 0x1A));
+            put_number(static_cast<std::uint32_t>(n));
+        }
+        else
+        {
+            put(static_cast<std::uint8_t>(major_type + 0x1B));
+            put_number(n);
+        }
+    }
+
+    void put(const std::uint8_t byte)
+    {
+        if (used == buffer.size())
+        {
+            flush();
+        }
+        buffer[used++] = byte;
+    }
+
+    /// big-endian copy of a number
+    template<typename NumberType>
+    void put_number(const NumberType n)
+    {
+        if (buffer.size() - used < sizeof(NumberType))
+        {
+            flush();
+        }
+
+        store_number(buffer.data() + used, n);
+        used += sizeof(NumberType);
+    }
+
+    /// big-endian copy of a number to @a out
+    template<typename NumberType>
+    void store_number(std::uint8_t* out, const NumberType n) const
+    {
+        std::array<std::uint8_t, sizeof(NumberType)> bytes;
+        std::memcpy(bytes.data(), &n, sizeof(NumberType));
+        for (std::size_t i = 0; i < sizeof(NumberType); ++i)
+        {
+            out[i] = bytes[is_little_endian ? sizeof(NumberType) - 1 - i : i];
+        }
+    }
+
+    void put_bytes(const char* s, const std::size_t length)
+    {
+        if (length > buffer.size() - used)
+        {
+            flush();
+            if (length >= buffer.size())
+            {
+                oa->write_characters(reinterpret_cast<const CharType*>(s), length);
+                return;
+            }
+        }
+
+        std::memcpy(buffer.data() + used, s, length);
+        used += length;
+    }
+
+    static bool little_endianess(int num = 1) noexcept
+    {
+        return *reinterpret_cast<char*>(&num) == 1;
+    }
+
+    output_adapter_t<CharType> oa = nullptr;
+    const input_format_t format;
+    const bool is_little_endian = little_endianess();
+
+    std::array<std::uint8_t, 4096> buffer{{}};
+    std::size_t used = 0;
+};
+}  // namespace detail
+}  // namespace nlohmann
@@ -1,7 +1,9 @@
 #pragma once
 
-#include <algorithm> // copy
+#include <algorithm> // copy, min
+#include <cerrno> // errno, EINTR
 #include <cstddef> // size_t
+#include <cstring> // memcpy
 #include <ios> // streamsize
 #include <iterator> // back_inserter
 #include <memory> // shared_ptr, make_shared
@@ -9,6 +11,12 @@
 #include <string> // basic_string
 #include <vector> // vector
 
+#ifdef _WIN32
+    #include <io.h> // _write
+#else
+    #include <unistd.h> // write
+#endif
+
 namespace nlohmann
 {
 namespace detail
@@ -94,6 +102,99 @@ class output_string_adapter : public output_adapter_protocol<CharType>
     StringType& str;
 };
 
+/*!
+@brief output adapter for raw file descriptors
+
+Collects output in a large buffer and hands it to write() in big blocks,
+bypassing iostreams. The descriptor is not owned. Remaining data is written
+on flush() or destruction; good() reports whether every write succeeded.
+*/
+template<typename CharType>
+class output_fd_adapter : public output_adapter_protocol<CharType>
+{
+  public:
+    explicit output_fd_adapter(int fd, std::size_t capacity = 1u << 20u)
+        : descriptor(fd), buffer(std::max<std::size_t>(capacity, 64))
+    {}
+
+    output_fd_adapter(const output_fd_adapter&) = delete;
+    output_fd_adapter& operator=(const output_fd_adapter&) = delete;
+
+    ~output_fd_adapter() override
+    {
+        flush();
+    }
+
+    void write_character(CharType c) override
+    {
+        if (used == buffer.size())
+        {
+            flush();
+        }
+        buffer[used++] = c;
+    }
+
+    void write_characters(const CharType* s, std::size_t length) override
+    {
+        if (length > buffer.size() - used)
+        {
+            flush();
+
+            // large blocks skip the buffer
+            if (length >= buffer.size())
+            {
+                write_all(s, length);
+                return;
+            }
+        }
+
+        std::memcpy(buffer.data() + used, s, length * sizeof(CharType));
+        used += length;
+    }
+
+    bool flush()
+    {
+        write_all(buffer.data(), used);
+        used = 0;
+        return ok;
+    }
+
+    bool good() const noexcept
+    {
+        return ok;
+    }
+
+  private:
+    void write_all(const CharType* s, std::size_t length)
+    {
+        auto first = reinterpret_cast<const char*>(s);
+        auto remaining = length * sizeof(CharType);
+
+        while (ok and remaining > 0)
+        {
+            const auto chunk = std::min<std::size_t>(remaining, 1u << 30u);
+#ifdef _WIN32
+            const auto written = ::_write(descriptor, first, static_cast<unsigned int>(chunk));
+#else
+            const auto written = ::write(descriptor, first, chunk);
+#endif
+            if (written < 0)
+            {
+                ok = (errno == EINTR);
+                continue;
+            }
+
+            first += written;
+            remaining -= static_cast<std::size_t>(written);
+        }
+    }
+
+    int descriptor;
+    std::vector<CharType> buffer;
+    std::size_t used = 0;
+    bool ok = true;
+};
+
 template<typename CharType, typename StringType = std::basic_string<CharType>>
 class output_adapter
 {
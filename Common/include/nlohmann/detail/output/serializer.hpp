@@ -9,6 +9,7 @@
 #include <cstddef> // size_t, ptrdiff_t
 #include <cstdint> // uint8_t
 #include <cstdio> // snprintf
+#include <cstring> // memchr, memcpy
 #include <limits> // numeric_limits
 #include <string> // string
 #include <type_traits> // is_same
@@ -16,6 +17,7 @@
 
 #include <nlohmann/detail/conversions/to_chars.hpp>
 #include <nlohmann/detail/exceptions.hpp>
+#include <nlohmann/detail/input/simd_scan.hpp>
 #include <nlohmann/detail/macro_scope.hpp>
 #include <nlohmann/detail/meta/cpp_future.hpp>
 #include <nlohmann/detail/output/binary_writer.hpp>
@@ -311,6 +313,35 @@ class serializer
 
         for (std::size_t i = 0; i < s.size(); ++i)
         {
+            // between code points, copy runs that need no escaping in bulk
+            if (state == UTF8_ACCEPT)
+            {
+                const auto run = plain_run(s.data() + i, s.data() + s.size(), ensure_ascii);
+                if (run > 0)
+                {
+                    if (run <= string_buffer.size() - 13 - bytes)
+                    {
+                        std::memcpy(string_buffer.data() + bytes, s.data() + i, run);
+                        bytes += run;
+                    }
+                    else
+                    {
+                        o->write_characters(string_buffer.data(), bytes);
+                        o->write_characters(s.data() + i, run);
+                        bytes = 0;
+                    }
+
+                    bytes_after_last_accept = bytes;
+                    undumped_chars = 0;
+
+                    i += run;
+                    if (i == s.size())
+                    {
+                        break;
+                    }
+                }
+            }
+
             const auto byte = static_cast<uint8_t>(s[i]);
 
             switch (decode(state, codepoint, byte))
@@ -547,6 +578,26 @@ class serializer
         }
     }
 
+    /*!
+    @brief length of the prefix of [first, last) that is copied verbatim
+
+    These are the printable ASCII characters except '"' and '\\'; with
+    ensure_ascii, DEL (0x7F) is escaped as well.
+    */
+    static std::size_t plain_run(const char* first, const char* last, const bool ensure_ascii) noexcept
+    {
+        auto run = simd::plain_string_run(first, last);
+        if (ensure_ascii and run > 0)
+        {
+            const auto del = static_cast<const char*>(std::memchr(first, 0x7F, run));
+            if (del != nullptr)
+            {
+                run = static_cast<std::size_t>(del - first);
+            }
+        }
+        return run;
+    }
+
     /*!
     @brief count digits
 
@@ -56,6 +56,7 @@ SOFTWARE.
 #include <nlohmann/detail/input/input_adapters.hpp>
 #include <nlohmann/detail/input/lexer.hpp>
 #include <nlohmann/detail/input/parser.hpp>
+#include <nlohmann/detail/input/push_parser.hpp>
 #include <nlohmann/detail/iterators/internal_iterator.hpp>
 #include <nlohmann/detail/iterators/iter_impl.hpp>
 #include <nlohmann/detail/iterators/iteration_proxy.hpp>
@@ -67,6 +68,7 @@ SOFTWARE.
 #include <nlohmann/detail/meta/cpp_future.hpp>
 #include <nlohmann/detail/meta/type_traits.hpp>
 #include <nlohmann/detail/output/binary_writer.hpp>
+#include <nlohmann/detail/output/binary_stream_writer.hpp>
 #include <nlohmann/detail/output/output_adapters.hpp>
 #include <nlohmann/detail/output/serializer.hpp>
 #include <nlohmann/detail/value_t.hpp>
@@ -218,6 +220,10 @@ class basic_json
     using input_format_t = detail::input_format_t;
     /// SAX interface type, see @ref nlohmann::json_sax
     using json_sax_t = json_sax<basic_json>;
+    /// incremental parser for chunked input, see @ref nlohmann::detail::push_parser
+    using push_parser = ::nlohmann::detail::push_parser<basic_json>;
+    /// DOM-free MessagePack/CBOR writer, see @ref nlohmann::detail::binary_stream_writer
+    template<typename CharType> using binary_stream_writer = ::nlohmann::detail::binary_stream_writer<CharType>;
 
     ////////////////
     // exceptions //
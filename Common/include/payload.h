@@ -0,0 +1,334 @@
+#pragma once
+
+#include "buffer_pool.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+
+/***************
+ * PayloadKind *
+ ***************/
+
+enum class PayloadKind
+{
+    file,      // the contents of file_name
+    zeros,
+    pattern,   // payload_pattern repeated
+    xoshiro    // seeded pseudo random bytes
+};
+
+// "file" | "zeros" | "pattern" | "xoshiro"
+inline bool payload_kind(std::string const& strKind, PayloadKind& kind)
+{
+    if (strKind == "file")
+        kind = PayloadKind::file;
+    else if (strKind == "zeros")
+        kind = PayloadKind::zeros;
+    else if (strKind == "pattern")
+        kind = PayloadKind::pattern;
+    else if (strKind == "xoshiro")
+        kind = PayloadKind::xoshiro;
+    else
+        return false;
+    return true;
+}
+
+/********************
+ * PayloadGenerator *
+ ********************/
+
+// Deterministic byte stream for a payload kind; sender and verifier run the
+// same generator from reset() and compare nothing but the bytes.
+//
+// xoshiro interleaves four xoshiro256++ streams 64 bits at a time. The lane
+// loops have no dependencies between lanes, so compilers turn each step into
+// a handful of 256-bit vector operations.
+class PayloadGenerator
+{
+public:
+    PayloadGenerator(PayloadKind kind, std::uint64_t nSeed, std::string strPattern)
+        : m_kind{ kind }
+        , m_nSeed{ nSeed }
+        , m_strPattern{ std::move(strPattern) }
+    {
+        if (m_kind == PayloadKind::pattern && m_strPattern.empty())
+            m_kind = PayloadKind::zeros;
+        reset();
+    }
+
+    // Back to the first byte of the stream
+    void reset() noexcept
+    {
+        m_nPatternPos = 0;
+        m_nBlockPos = kBlockSize;
+
+        auto nState = m_nSeed;
+        for (std::size_t nLane = 0; nLane < kLanes; ++nLane)
+        {
+            m_s0[nLane] = splitmix64(nState);
+            m_s1[nLane] = splitmix64(nState);
+            m_s2[nLane] = splitmix64(nState);
+            m_s3[nLane] = splitmix64(nState);
+        }
+    }
+
+    // The next nSize bytes of the stream
+    void generate(char* pData, std::size_t nSize) noexcept
+    {
+        switch (m_kind)
+        {
+            case PayloadKind::file:
+            case PayloadKind::zeros:
+                std::memset(pData, 0, nSize);
+                break;
+
+            case PayloadKind::pattern:
+                while (nSize > 0)
+                {
+                    auto const nCopy = std::min(nSize, m_strPattern.size() - m_nPatternPos);
+                    std::memcpy(pData, m_strPattern.data() + m_nPatternPos, nCopy);
+                    m_nPatternPos = (m_nPatternPos + nCopy) % m_strPattern.size();
+                    pData += nCopy;
+                    nSize -= nCopy;
+                }
+                break;
+
+            case PayloadKind::xoshiro:
+                generate_xoshiro(pData, nSize);
+                break;
+        }
+    }
+
+    // Length after which the stream repeats, 0 if it does not
+    std::size_t period() const noexcept
+    {
+        switch (m_kind)
+        {
+            case PayloadKind::pattern:
+                return m_strPattern.size();
+            case PayloadKind::xoshiro:
+                return 0;
+            default:
+                return 1;
+        }
+    }
+
+private:
+    static constexpr std::size_t kLanes = 4;
+    static constexpr std::size_t kBlockSize = kLanes * sizeof(std::uint64_t);
+
+    static std::uint64_t splitmix64(std::uint64_t& nState) noexcept
+    {
+        auto z = (nState += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    static std::uint64_t rotl(std::uint64_t x, int k) noexcept
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    // One step of every lane, 32 bytes of output
+    void next_block(char* pBlock) noexcept
+    {
+        auto result = std::array<std::uint64_t, kLanes>{};
+        for (std::size_t i = 0; i < kLanes; ++i)
+        {
+            result[i] = rotl(m_s0[i] + m_s3[i], 23) + m_s0[i];
+
+            auto const t = m_s1[i] << 17;
+            m_s2[i] ^= m_s0[i];
+            m_s3[i] ^= m_s1[i];
+            m_s1[i] ^= m_s2[i];
+            m_s0[i] ^= m_s3[i];
+            m_s2[i] ^= t;
+            m_s3[i] = rotl(m_s3[i], 45);
+        }
+        std::memcpy(pBlock, result.data(), kBlockSize);
+    }
+
+    void generate_xoshiro(char* pData, std::size_t nSize) noexcept
+    {
+        // Leftover of the last partial block first
+        auto const nLeft = std::min(nSize, kBlockSize - m_nBlockPos);
+        std::memcpy(pData, m_block.data() + m_nBlockPos, nLeft);
+        m_nBlockPos += nLeft;
+        pData += nLeft;
+        nSize -= nLeft;
+
+        for (; nSize >= kBlockSize; pData += kBlockSize, nSize -= kBlockSize)
+            next_block(pData);
+
+        if (nSize > 0)
+        {
+            next_block(m_block.data());
+            std::memcpy(pData, m_block.data(), nSize);
+            m_nBlockPos = nSize;
+        }
+    }
+
+    PayloadKind   m_kind;
+    std::uint64_t m_nSeed;
+    std::string   m_strPattern;
+    std::size_t   m_nPatternPos = 0;
+
+    alignas(32) std::array<std::uint64_t, kLanes> m_s0{};
+    alignas(32) std::array<std::uint64_t, kLanes> m_s1{};
+    alignas(32) std::array<std::uint64_t, kLanes> m_s2{};
+    alignas(32) std::array<std::uint64_t, kLanes> m_s3{};
+    std::array<char, kBlockSize> m_block{};
+    std::size_t m_nBlockPos = kBlockSize;
+};
+
+namespace detail_payload
+{
+    // Fills one pool chunk with the next part of the stream. A stream whose
+    // period divides the chunk size looks the same in every chunk, so it is
+    // generated only once.
+    class ChunkFiller
+    {
+    public:
+        ChunkFiller(BufferPool& bufferPool, PayloadGenerator generator)
+            : m_chunk{ bufferPool.acquire() }
+            , m_generator{ std::move(generator) }
+        {
+            auto const nPeriod = m_generator.period();
+            m_bRepeats = nPeriod > 0 && m_chunk.size() % nPeriod == 0;
+        }
+
+        void reset() noexcept
+        {
+            m_generator.reset();
+            m_nChunk = -1;
+        }
+
+        // Chunk number nChunk, nBytes long; chunks come in increasing order
+        char* fill(std::int64_t nChunk, std::size_t nBytes) noexcept
+        {
+            if (nChunk != m_nChunk)
+            {
+                if (!m_bRepeats || !m_bFilled)
+                    m_generator.generate(m_chunk.data(), m_bRepeats ? m_chunk.size() : nBytes);
+                m_bFilled = true;
+                m_nChunk = nChunk;
+            }
+            return m_chunk.data();
+        }
+
+        std::int64_t chunk_size() const noexcept { return static_cast<std::int64_t>(m_chunk.size()); }
+
+    private:
+        PoolBuffer       m_chunk;
+        PayloadGenerator m_generator;
+        std::int64_t     m_nChunk = -1;
+        bool             m_bRepeats = false;
+        bool             m_bFilled = false;
+    };
+}
+
+/*****************
+ * PayloadSource *
+ *****************/
+
+// Sender side: serves a generated file of nSize bytes package by package,
+// front to back, with the same interface as FileSource.
+class PayloadSource
+{
+public:
+    PayloadSource(BufferPool& bufferPool, PayloadGenerator generator, std::int64_t nSize)
+        : m_filler{ bufferPool, std::move(generator) }
+        , m_nSize{ nSize }
+    {}
+
+    // Restarts the stream for the next file
+    bool open() noexcept
+    {
+        m_filler.reset();
+        return true;
+    }
+
+    std::int64_t size() const noexcept { return m_nSize; }
+
+    std::pair<char const*, std::int64_t> slice(std::int64_t nOffset, std::int64_t nMax) noexcept
+    {
+        auto const nChunkSize = m_filler.chunk_size();
+        auto const nChunk = nOffset / nChunkSize;
+        auto const nInChunk = nOffset - nChunk * nChunkSize;
+        auto const nChunkBytes = std::min(nChunkSize, m_nSize - nChunk * nChunkSize);
+
+        auto const pChunk = m_filler.fill(nChunk, static_cast<std::size_t>(nChunkBytes));
+        return { pChunk + nInChunk, std::min(nMax, nChunkBytes - nInChunk) };
+    }
+
+private:
+    detail_payload::ChunkFiller m_filler;
+    std::int64_t m_nSize;
+};
+
+/*******************
+ * PayloadVerifier *
+ *******************/
+
+// Receiver side: data is received into one pool chunk and compared with the
+// generated stream whenever the chunk fills up, so nothing is kept or written.
+class PayloadVerifier
+{
+public:
+    PayloadVerifier(BufferPool& bufferPool, PayloadGenerator generator)
+        : m_chunk{ bufferPool.acquire() }
+        , m_filler{ bufferPool, std::move(generator) }
+    {}
+
+    void start(std::int64_t nSize) noexcept
+    {
+        m_filler.reset();
+        m_nSize = nSize;
+        m_nChecked = 0;
+        m_nMismatch = -1;
+    }
+
+    // Where the bytes at nOffset have to be received, and how many fit
+    std::pair<char*, std::int64_t> span_at(std::int64_t nOffset) noexcept
+    {
+        auto const nChunkSize = m_filler.chunk_size();
+        auto const nInChunk = nOffset % nChunkSize;
+        return { m_chunk.data() + nInChunk, std::min(nChunkSize - nInChunk, m_nSize - nOffset) };
+    }
+
+    // nReceived bytes of the file are in; checks the chunk once it is complete
+    void commit(std::int64_t nReceived) noexcept
+    {
+        auto const nChunkSize = m_filler.chunk_size();
+        if (nReceived != m_nSize && nReceived % nChunkSize != 0)
+            return;
+
+        auto const nChunk = m_nChecked / nChunkSize;
+        auto const nBytes = static_cast<std::size_t>(nReceived - m_nChecked);
+        auto const pExpected = m_filler.fill(nChunk, nBytes);
+
+        if (m_nMismatch < 0 && std::memcmp(m_chunk.data(), pExpected, nBytes) != 0)
+        {
+            auto const pDiff = std::mismatch(m_chunk.data(), m_chunk.data() + nBytes, pExpected).first;
+            m_nMismatch = m_nChecked + (pDiff - m_chunk.data());
+        }
+        m_nChecked = nReceived;
+    }
+
+    // Offset of the first wrong byte, -1 if everything so far matched
+    std::int64_t mismatch() const noexcept { return m_nMismatch; }
+    bool complete() const noexcept { return m_nChecked == m_nSize; }
+
+private:
+    PoolBuffer                  m_chunk;
+    detail_payload::ChunkFiller m_filler;
+    std::int64_t m_nSize = 0;
+    std::int64_t m_nChecked = 0;
+    std::int64_t m_nMismatch = -1;
+};
@@ -0,0 +1,316 @@
+#pragma once
+
+#include "os2var2_common.h"
+#include "buffer_pool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**************
+ * ByteRanges *
+ **************/
+
+// Ordered, disjoint [offset, offset + size) ranges of a file. A transfer sends
+// them back to back, so a position in the transfer maps to a file offset.
+class ByteRanges
+{
+public:
+    struct Range
+    {
+        std::int64_t nOffset;
+        std::int64_t nSize;
+    };
+
+    ByteRanges() noexcept = default;
+
+    explicit ByteRanges(std::int64_t nFileSize)
+    {
+        add(0, nFileSize);
+    }
+
+    // Ranges have to be added in increasing order, touching ones are merged
+    void add(std::int64_t nOffset, std::int64_t nSize)
+    {
+        if (nSize <= 0)
+            return;
+
+        if (!m_ranges.empty() && m_ranges.back().nOffset + m_ranges.back().nSize == nOffset)
+            m_ranges.back().nSize += nSize;
+        else
+            m_ranges.push_back(Range{ nOffset, nSize });
+        m_nTotal += nSize;
+    }
+
+    // Bytes in all ranges together
+    std::int64_t total() const noexcept { return m_nTotal; }
+
+    std::vector<Range> const& items() const noexcept { return m_ranges; }
+
+    // File offset of transfer position nPos and the bytes left in its range.
+    // Cheap when positions only grow, as they do in a send or recv loop.
+    std::pair<std::int64_t, std::int64_t> locate(std::int64_t nPos) const noexcept
+    {
+        if (nPos < m_nCursorStart)
+            m_nCursor = m_nCursorStart = 0;
+
+        while (m_nCursor < m_ranges.size() && nPos - m_nCursorStart >= m_ranges[m_nCursor].nSize)
+            m_nCursorStart += m_ranges[m_nCursor++].nSize;
+
+        if (m_nCursor == m_ranges.size())
+            return { 0, 0 };
+
+        auto const& range = m_ranges[m_nCursor];
+        auto const nInRange = nPos - m_nCursorStart;
+        return { range.nOffset + nInRange, range.nSize - nInRange };
+    }
+
+    // The first nPos bytes of the transfer as file ranges
+    ByteRanges prefix(std::int64_t nPos) const
+    {
+        auto result = ByteRanges{};
+        for (auto const& range : m_ranges)
+        {
+            if (nPos <= 0)
+                break;
+            result.add(range.nOffset, std::min(range.nSize, nPos));
+            nPos -= range.nSize;
+        }
+        return result;
+    }
+
+    // Count, then offset and size of every range
+    bool send(Connection& connection) const
+    {
+        connection.send_val(static_cast<std::uint32_t>(m_ranges.size()));
+        for (auto const& range : m_ranges)
+        {
+            if (connection.is_socket_error())
+                return false;
+            connection.send_val(range.nOffset);
+            connection.send_val(range.nSize);
+        }
+        return !connection.is_socket_error();
+    }
+
+    // Rejects anything that is not ordered and inside [0, nFileSize)
+    bool recv(Connection& connection, std::int64_t nFileSize)
+    {
+        *this = ByteRanges{};
+
+        auto const nCount = connection.recv_val<std::uint32_t>(MSG_WAITALL);
+        if (connection.getResult() != static_cast<int>(sizeof(nCount)))
+            return false;
+
+        auto nEnd = std::int64_t{ 0 };
+        for (std::uint32_t i = 0; i < nCount; ++i)
+        {
+            auto const nOffset = connection.recv_val<std::int64_t>(MSG_WAITALL);
+            if (connection.getResult() != static_cast<int>(sizeof(nOffset)))
+                return false;
+            auto const nSize = connection.recv_val<std::int64_t>(MSG_WAITALL);
+            if (connection.getResult() != static_cast<int>(sizeof(nSize)))
+                return false;
+
+            if (nOffset < nEnd || nSize < 0 || nSize > nFileSize - nOffset)
+                return false;
+            add(nOffset, nSize);
+            nEnd = nOffset + nSize;
+        }
+        return true;
+    }
+
+private:
+    std::vector<Range> m_ranges;
+    std::int64_t       m_nTotal = 0;
+
+    // Last range located and the transfer position it starts at
+    mutable std::size_t  m_nCursor = 0;
+    mutable std::int64_t m_nCursorStart = 0;
+};
+
+// Writes the ranges of buffer into fileName in place, creating the file if needed
+inline bool write_ranges(std::string const& fileName, BufferChain const& buffer, ByteRanges const& ranges)
+{
+    auto file = std::fstream{ fileName, std::ios::binary | std::ios::in | std::ios::out };
+    if (!file.is_open())
+        file.open(fileName, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+    if (!file.is_open())
+        return false;
+
+    for (auto const& range : ranges.items())
+    {
+        file.seekp(range.nOffset);
+        for (auto nOffset = range.nOffset; nOffset < range.nOffset + range.nSize; )
+        {
+            auto const span = buffer.span_at(nOffset);
+            auto const nBytes = std::min(span.second, range.nOffset + range.nSize - nOffset);
+            file.write(span.first, nBytes);
+            nOffset += nBytes;
+        }
+    }
+    return static_cast<bool>(file.flush());
+}
+
+// Transfer IDs name files on the server, so they are kept to [A-Za-z0-9_-]
+inline bool is_valid_transfer_id(std::string const& strTransferId)
+{
+    return !strTransferId.empty() && strTransferId.size() <= 64
+        && std::all_of(strTransferId.cbegin(), strTransferId.cend(), [](char c)
+        {
+            return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-';
+        });
+}
+
+/*****************
+ * ResumeJournal *
+ *****************/
+
+// Server side progress of a resumable session: the file in progress, named by
+// its try and timeout index, and a bitmap of the chunks of it that are already
+// in its partial out_ file. It is saved after every file and on every
+// disconnect, so a client reconnecting with the same transfer ID can continue
+// where the last connection stopped.
+class ResumeJournal
+{
+public:
+    static constexpr std::int64_t kChunkSize = 1024 * 1024;
+
+    // A missing or unreadable journal starts from the beginning
+    void load(std::string const& fileName)
+    {
+        m_strFileName = fileName;
+        m_header = Header{};
+        m_bitmap.clear();
+
+        auto fin = std::ifstream{ fileName, std::ios::binary };
+        auto header = Header{};
+        if (!fin.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.nMagic != kMagic || header.nChunkSize <= 0)
+            return;
+
+        auto const nChunks = std::max<std::int64_t>((header.nFileSize + header.nChunkSize - 1) / header.nChunkSize, 0);
+        if (header.nBitmapBytes != static_cast<std::uint64_t>((nChunks + 7) / 8))
+            return;
+
+        auto bitmap = std::vector<std::uint8_t>(static_cast<std::size_t>(header.nBitmapBytes));
+        if (!fin.read(reinterpret_cast<char*>(bitmap.data()), static_cast<std::streamsize>(bitmap.size())))
+            return;
+
+        m_header = header;
+        m_bitmap = std::move(bitmap);
+    }
+
+    bool save() const
+    {
+        auto fout = std::ofstream{ m_strFileName, std::ios::binary | std::ios::trunc };
+        fout.write(reinterpret_cast<char const*>(&m_header), sizeof(m_header));
+        fout.write(reinterpret_cast<char const*>(m_bitmap.data()), static_cast<std::streamsize>(m_bitmap.size()));
+        return static_cast<bool>(fout.flush());
+    }
+
+    // The session is complete, nothing left to resume
+    void remove() const
+    {
+        std::remove(m_strFileName.c_str());
+    }
+
+    // Where a reconnecting client continues
+    std::uint32_t try_index() const noexcept { return m_header.nTry; }
+    std::uint32_t file_index() const noexcept { return m_header.nFile; }
+
+    // Ranges of the file still to be sent. Any other file than the one in the
+    // journal, or a different size, starts over with an empty bitmap.
+    ByteRanges missing(std::uint32_t nTry, std::uint32_t nFile, std::int64_t nFileSize)
+    {
+        if (nTry != m_header.nTry || nFile != m_header.nFile || nFileSize != m_header.nFileSize
+            || m_bitmap.size() != static_cast<std::size_t>((chunk_count() + 7) / 8))
+        {
+            m_header.nTry = nTry;
+            m_header.nFile = nFile;
+            m_header.nFileSize = nFileSize;
+            m_header.nChunkSize = kChunkSize;
+            m_header.nBitmapBytes = static_cast<std::uint64_t>((chunk_count() + 7) / 8);
+            m_bitmap.assign(static_cast<std::size_t>(m_header.nBitmapBytes), 0);
+        }
+
+        auto ranges = ByteRanges{};
+        for (auto nChunk = std::int64_t{ 0 }; nChunk < chunk_count(); ++nChunk)
+        {
+            if (!is_done(nChunk))
+                ranges.add(nChunk * m_header.nChunkSize, chunk_bytes(nChunk));
+        }
+        return ranges;
+    }
+
+    // Some of the file came in over an earlier connection
+    bool has_progress() const noexcept
+    {
+        return std::any_of(m_bitmap.cbegin(), m_bitmap.cend(), [](std::uint8_t nBits) { return nBits != 0; });
+    }
+
+    // Marks every chunk that received covers completely, returns those chunks
+    ByteRanges mark(ByteRanges const& received)
+    {
+        auto done = ByteRanges{};
+        for (auto const& range : received.items())
+        {
+            auto const nFirst = (range.nOffset + m_header.nChunkSize - 1) / m_header.nChunkSize;
+            auto nLast = (range.nOffset + range.nSize) / m_header.nChunkSize;
+            if (range.nOffset + range.nSize == m_header.nFileSize)
+                nLast = chunk_count();
+
+            for (auto nChunk = nFirst; nChunk < nLast; ++nChunk)
+            {
+                m_bitmap[static_cast<std::size_t>(nChunk / 8)] |= static_cast<std::uint8_t>(1u << (nChunk % 8));
+                done.add(nChunk * m_header.nChunkSize, chunk_bytes(nChunk));
+            }
+        }
+        return done;
+    }
+
+    // The current file is complete, (nTry, nFile) is next
+    void advance(std::uint32_t nTry, std::uint32_t nFile)
+    {
+        m_header = Header{};
+        m_header.nTry = nTry;
+        m_header.nFile = nFile;
+        m_bitmap.clear();
+    }
+
+private:
+    static constexpr std::uint32_t kMagic = 0x53523230;   // "02RS"
+
+    struct Header
+    {
+        std::uint32_t nMagic = kMagic;
+        std::uint32_t nTry = 0;
+        std::uint32_t nFile = 0;
+        std::uint32_t nReserved = 0;
+        std::int64_t  nFileSize = -1;
+        std::int64_t  nChunkSize = kChunkSize;
+        std::uint64_t nBitmapBytes = 0;
+    };
+
+    std::int64_t chunk_count() const noexcept
+    {
+        return (m_header.nFileSize + m_header.nChunkSize - 1) / m_header.nChunkSize;
+    }
+
+    std::int64_t chunk_bytes(std::int64_t nChunk) const noexcept
+    {
+        return std::min(m_header.nChunkSize, m_header.nFileSize - nChunk * m_header.nChunkSize);
+    }
+
+    bool is_done(std::int64_t nChunk) const noexcept
+    {
+        return (m_bitmap[static_cast<std::size_t>(nChunk / 8)] >> (nChunk % 8)) & 1u;
+    }
+
+    std::string               m_strFileName;
+    Header                    m_header;
+    std::vector<std::uint8_t> m_bitmap;
+};
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+/*****************
+ * quantile_norm *
+ *****************/
+
+// Inverse of the standard normal CDF (Acklam), relative error below 1.2e-9
+inline double quantile_norm(double p)
+{
+    constexpr double a[] = { -3.969683028665376e+01,  2.209460984245205e+02, -2.759285104469687e+02,
+                              1.383577518672690e+02, -3.066479806614716e+01,  2.506628277459239e+00 };
+    constexpr double b[] = { -5.447609879822406e+01,  1.615858368580409e+02, -1.556989798598866e+02,
+                              6.680131188771972e+01, -1.328068155288572e+01 };
+    constexpr double c[] = { -7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+                             -2.549732539343734e+00,  4.374664141464968e+00,  2.938163982698783e+00 };
+    constexpr double d[] = {  7.784695709041462e-03,  3.224671290700398e-01,  2.445134137142996e+00,
+                              3.754408661907416e+00 };
+    constexpr double fLow = 0.02425;
+
+    if (p <= 0.0)
+        return -std::numeric_limits<double>::infinity();
+    if (p >= 1.0)
+        return std::numeric_limits<double>::infinity();
+
+    if (p < fLow)
+    {
+        auto const q = std::sqrt(-2.0 * std::log(p));
+        return (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5])
+               / ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1.0);
+    }
+    if (p > 1.0 - fLow)
+        return -quantile_norm(1.0 - p);
+
+    auto const q = p - 0.5;
+    auto const r = q * q;
+    return (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q
+           / (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1.0);
+}
+
+/**************
+ * quantile_t *
+ **************/
+
+// Inverse of the Student t CDF with nDof degrees of freedom (Hill's expansion),
+// exact for 1 and 2 degrees of freedom, within 0.15% of the tables above that
+inline double quantile_t(double p, std::uint64_t nDof)
+{
+    constexpr auto fPi = 3.14159265358979323846;
+
+    if (nDof == 0)
+        return std::numeric_limits<double>::quiet_NaN();
+    if (nDof == 1)
+        return std::tan(fPi * (p - 0.5));
+    if (nDof == 2)
+        return (2.0 * p - 1.0) / std::sqrt(2.0 * p * (1.0 - p));
+
+    auto const n = static_cast<double>(nDof);
+    auto const z = quantile_norm(p);
+    auto const z2 = z * z;
+
+    auto const g1 = (z2 + 1.0) * z / 4.0;
+    auto const g2 = ((5.0 * z2 + 16.0) * z2 + 3.0) * z / 96.0;
+    auto const g3 = (((3.0 * z2 + 19.0) * z2 + 17.0) * z2 - 15.0) * z / 384.0;
+    auto const g4 = ((((79.0 * z2 + 776.0) * z2 + 1482.0) * z2 - 1920.0) * z2 - 945.0) * z / 92160.0;
+
+    return z + g1 / n + g2 / (n * n) + g3 / (n * n * n) + g4 / (n * n * n * n);
+}
+
+/****************
+ * RunningStats *
+ ****************/
+
+// Constant memory online statistics: Welford mean/variance, min/max and a
+// Student t confidence interval for the mean.
+class RunningStats
+{
+public:
+    void push(double fValue) noexcept
+    {
+        ++m_nCount;
+        auto const fDelta = fValue - m_fMean;
+        m_fMean += fDelta / static_cast<double>(m_nCount);
+        m_fM2 += fDelta * (fValue - m_fMean);
+        m_fMin = std::min(m_fMin, fValue);
+        m_fMax = std::max(m_fMax, fValue);
+    }
+
+    std::uint64_t count() const noexcept { return m_nCount; }
+    double mean() const noexcept { return m_fMean; }
+    double min() const noexcept { return m_nCount ? m_fMin : 0.0; }
+    double max() const noexcept { return m_nCount ? m_fMax : 0.0; }
+
+    // Sample variance (n - 1)
+    double variance() const noexcept
+    {
+        return m_nCount > 1 ? m_fM2 / static_cast<double>(m_nCount - 1) : 0.0;
+    }
+
+    double stddev() const noexcept
+    {
+        return std::sqrt(variance());
+    }
+
+    // Half width of the two-sided confidence interval for the mean, infinite below two samples
+    double ci_half_width(double fConfidence = 0.95) const noexcept
+    {
+        if (m_nCount < 2)
+            return std::numeric_limits<double>::infinity();
+
+        auto const t = quantile_t(0.5 + fConfidence / 2.0, m_nCount - 1);
+        return t * stddev() / std::sqrt(static_cast<double>(m_nCount));
+    }
+
+    // True once the interval is narrower than fTargetRelative * |mean| on each side
+    bool is_precise(double fTargetRelative, double fConfidence = 0.95, std::uint64_t nMinCount = 2) const noexcept
+    {
+        if (m_nCount < std::max<std::uint64_t>(nMinCount, 2))
+            return false;
+
+        return ci_half_width(fConfidence) <= fTargetRelative * std::abs(m_fMean);
+    }
+
+private:
+    std::uint64_t m_nCount = 0;
+    double        m_fMean  = 0.0;
+    double        m_fM2    = 0.0;
+    double        m_fMin   = std::numeric_limits<double>::infinity();
+    double        m_fMax   = -std::numeric_limits<double>::infinity();
+};
@@ -0,0 +1,223 @@
+#pragma once
+
+#include "os2var2_common.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*************
+ * SweepCell *
+ *************/
+
+struct SweepCell
+{
+    std::string   transport;
+    std::uint32_t package_size;
+    std::uint32_t timeout;
+    std::string   wait_strategy;
+    std::uint32_t buffer_size;   // SO_SNDBUF/SO_RCVBUF, 0 keeps the system default
+};
+
+// "select" | "socket" | "both" | "none"
+inline bool wait_strategy_flags(std::string const& strategy, bool& bApplySocketTimeout, bool& bApplySelectTimeout)
+{
+    bApplySocketTimeout = strategy == "socket" || strategy == "both";
+    bApplySelectTimeout = strategy == "select" || strategy == "both";
+    return bApplySocketTimeout || bApplySelectTimeout || strategy == "none";
+}
+
+inline bool is_supported_transport(std::string const& transport)
+{
+    return transport == "tcp";
+}
+
+/*************
+ * SweepGrid *
+ *************/
+
+struct SweepGrid
+{
+    static constexpr auto fields()
+    {
+        return std::make_tuple(
+                codec_field   ("package_size"  , &SweepGrid::package_size  ),
+                codec_field   ("timeout"       , &SweepGrid::timeout       ),
+                codec_optional("wait_strategy" , &SweepGrid::wait_strategy ),
+                codec_optional("buffer_size"   , &SweepGrid::buffer_size   ),
+                codec_optional("transport"     , &SweepGrid::transport     ),
+                codec_optional("warmup_runs"   , &SweepGrid::warmup_runs   ),
+                codec_optional("repetitions"   , &SweepGrid::repetitions   ),
+                codec_optional("outlier_mad"   , &SweepGrid::outlier_mad   ),
+                codec_optional("parallel_lanes", &SweepGrid::parallel_lanes),
+                codec_optional("seed"          , &SweepGrid::seed          ),
+                codec_optional("output"        , &SweepGrid::output        ));
+    }
+
+    // Cartesian product of all dimensions in randomized order
+    std::vector<SweepCell> plan() const
+    {
+        auto cells = std::vector<SweepCell>{};
+        cells.reserve(transport.size() * package_size.size() * timeout.size() * wait_strategy.size() * buffer_size.size());
+
+        for (auto const& strTransport : transport)
+            for (auto const nPackageSize : package_size)
+                for (auto const nTimeout : timeout)
+                    for (auto const& strWaitStrategy : wait_strategy)
+                        for (auto const nBufferSize : buffer_size)
+                            cells.push_back(SweepCell{ strTransport, nPackageSize, nTimeout, strWaitStrategy, nBufferSize });
+
+        auto engine = std::mt19937{ seed != 0 ? seed : std::random_device{}() };
+        std::shuffle(cells.begin(), cells.end(), engine);
+
+        return cells;
+    }
+
+    // Client and server share the machine on loopback, so leave a core for each side
+    std::uint32_t lanes(std::size_t nCells) const
+    {
+        auto const nCores = std::max(1u, std::thread::hardware_concurrency() / 2u);
+        auto const nLanes = std::min<std::size_t>({ std::max(1u, parallel_lanes), nCores, std::max<std::size_t>(1, nCells) });
+        return static_cast<std::uint32_t>(nLanes);
+    }
+
+    // Only the package sizes and timeouts have to be given, every other knob has a default
+    std::vector<std::uint32_t> package_size;
+    std::vector<std::uint32_t> timeout;
+    std::vector<std::string>   wait_strategy  = { "select" };
+    std::vector<std::uint32_t> buffer_size    = { 0 };
+    std::vector<std::string>   transport      = { "tcp" };
+    std::uint32_t              warmup_runs    = 1;
+    std::uint32_t              repetitions    = 10;
+    double                     outlier_mad    = 3.5;   // rejection threshold in scaled MADs, 0 disables it
+    std::uint32_t              parallel_lanes = 1;     // lane i talks to server_port + i
+    std::uint32_t              seed           = 0;     // 0 picks a random order every run
+    std::string                output         = "sweep.csv";
+};
+
+/****************
+ * SweepSummary *
+ ****************/
+
+struct SweepSummary
+{
+    std::size_t samples;
+    std::size_t kept;
+    double      mean;
+    double      median;
+    double      min;
+    double      max;
+};
+
+namespace detail_sweep
+{
+    inline double median(std::vector<double> values)
+    {
+        if (values.empty())
+            return 0.0;
+
+        auto const itMiddle = std::next(values.begin(), values.size() / 2);
+        std::nth_element(values.begin(), itMiddle, values.end());
+        auto const fUpper = *itMiddle;
+        if (values.size() % 2 != 0)
+            return fUpper;
+
+        auto const fLower = *std::max_element(values.begin(), itMiddle);
+        return (fLower + fUpper) / 2.0;
+    }
+}
+
+// Drops samples further than fThreshold scaled median absolute deviations from the median
+inline SweepSummary summarize(std::vector<std::int64_t> const& samples, double fThreshold)
+{
+    auto summary = SweepSummary{ samples.size(), 0, 0.0, 0.0, 0.0, 0.0 };
+    if (samples.empty())
+        return summary;
+
+    auto values = std::vector<double>(samples.begin(), samples.end());
+    auto const fMedian = detail_sweep::median(values);
+
+    if (fThreshold > 0.0)
+    {
+        auto deviations = std::vector<double>{};
+        deviations.reserve(values.size());
+        std::transform(values.begin(), values.end(), std::back_inserter(deviations),
+                       [fMedian](double fValue) { return std::abs(fValue - fMedian); });
+
+        auto const fScaledMad = 1.4826 * detail_sweep::median(std::move(deviations));
+        if (fScaledMad > 0.0)
+        {
+            values.erase(std::remove_if(values.begin(), values.end(),
+                                        [&](double fValue) { return std::abs(fValue - fMedian) > fThreshold * fScaledMad; }),
+                         values.end());
+        }
+    }
+
+    summary.kept = values.size();
+    summary.mean = std::accumulate(values.begin(), values.end(), 0.0) / values.size();
+    summary.median = detail_sweep::median(values);
+    summary.min = *std::min_element(values.begin(), values.end());
+    summary.max = *std::max_element(values.begin(), values.end());
+
+    return summary;
+}
+
+/****************
+ * SweepDataset *
+ ****************/
+
+// One row per cell, appended concurrently by the sweep lanes
+class SweepDataset
+{
+public:
+    void append(SweepCell const& cell, std::uint32_t nLane, SweepSummary const& summary)
+    {
+        auto const lock = std::lock_guard{ m_mutex };
+        m_rows.push_back(Row{ cell, nLane, summary });
+    }
+
+    bool write(std::string const& fileName) const
+    {
+        auto fout = std::ofstream{ fileName };
+        if (!fout)
+            return false;
+
+        fout << "transport,package_size,timeout,wait_strategy,buffer_size,lane,samples,kept,mean_us,median_us,min_us,max_us\n";
+
+        auto const lock = std::lock_guard{ m_mutex };
+        for (auto const& row : m_rows)
+        {
+            fout << row.cell.transport << ','
+                 << row.cell.package_size << ','
+                 << row.cell.timeout << ','
+                 << row.cell.wait_strategy << ','
+                 << row.cell.buffer_size << ','
+                 << row.lane << ','
+                 << row.summary.samples << ','
+                 << row.summary.kept << ','
+                 << row.summary.mean << ','
+                 << row.summary.median << ','
+                 << row.summary.min << ','
+                 << row.summary.max << '\n';
+        }
+
+        return static_cast<bool>(fout);
+    }
+
+private:
+    struct Row
+    {
+        SweepCell     cell;
+        std::uint32_t lane;
+        SweepSummary  summary;
+    };
+
+    mutable std::mutex m_mutex;
+    std::vector<Row> m_rows;
+};
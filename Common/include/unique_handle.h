@@ -0,0 +1,199 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#undef min
+#undef max
+#else
+#include <netdb.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/*****************
+ * unique_handle *
+ *****************/
+
+// Owns one OS handle, stored inline. TTraits supplies the handle type, the
+// invalid value and the close function as statics, so there is no heap
+// allocation and no indirect call:
+//
+//     struct traits
+//     {
+//         using handle_type = ...;
+//         static handle_type invalid() noexcept;
+//         static void close(handle_type h) noexcept;   // only called for valid handles
+//     };
+template<typename TTraits>
+class unique_handle
+{
+public:
+    using traits_type = TTraits;
+    using handle_type = typename TTraits::handle_type;
+
+    unique_handle() noexcept = default;
+
+    explicit unique_handle(handle_type handle) noexcept
+        : m_handle{ handle }
+    {}
+
+    unique_handle(unique_handle&& other) noexcept
+        : m_handle{ other.release() }
+    {}
+
+    unique_handle& operator=(unique_handle&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset(other.release());
+        }
+        return *this;
+    }
+
+    unique_handle(unique_handle const&) = delete;
+    unique_handle& operator=(unique_handle const&) = delete;
+
+    ~unique_handle() noexcept
+    {
+        reset();
+    }
+
+    handle_type get() const noexcept
+    {
+        return m_handle;
+    }
+
+    handle_type const& operator*() const noexcept
+    {
+        return m_handle;
+    }
+
+    // Only usable when handle_type is a pointer
+    handle_type operator->() const noexcept
+    {
+        return m_handle;
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return m_handle != TTraits::invalid();
+    }
+
+    handle_type release() noexcept
+    {
+        return std::exchange(m_handle, TTraits::invalid());
+    }
+
+    void reset(handle_type handle = TTraits::invalid()) noexcept
+    {
+        auto const old = std::exchange(m_handle, handle);
+        if (old != TTraits::invalid() && old != handle)
+            TTraits::close(old);
+    }
+
+    // Out parameter for C APIs, closes the current handle first
+    handle_type* put() noexcept
+    {
+        reset();
+        return &m_handle;
+    }
+
+private:
+    handle_type m_handle = TTraits::invalid();
+};
+
+/**********
+ * traits *
+ **********/
+
+struct addrinfo_traits
+{
+    using handle_type = addrinfo*;
+    static constexpr handle_type invalid() noexcept { return nullptr; }
+    static void close(handle_type h) noexcept { freeaddrinfo(h); }
+};
+
+#ifdef _WIN32
+
+struct socket_traits
+{
+    using handle_type = SOCKET;
+    static constexpr handle_type invalid() noexcept { return INVALID_SOCKET; }
+    static void close(handle_type h) noexcept { closesocket(h); }
+};
+
+// CreateFile, CreateEvent and friends; CreateFileMapping reports failure as nullptr instead
+struct win_handle_traits
+{
+    using handle_type = HANDLE;
+    static handle_type invalid() noexcept { return INVALID_HANDLE_VALUE; }
+    static void close(handle_type h) noexcept { CloseHandle(h); }
+};
+
+struct file_mapping_traits
+{
+    using handle_type = HANDLE;
+    static constexpr handle_type invalid() noexcept { return nullptr; }
+    static void close(handle_type h) noexcept { CloseHandle(h); }
+};
+
+struct mapped_view_traits
+{
+    using handle_type = void const*;
+    static constexpr handle_type invalid() noexcept { return nullptr; }
+    static void close(handle_type h) noexcept { UnmapViewOfFile(h); }
+};
+
+#else
+
+struct fd_traits
+{
+    using handle_type = int;
+    static constexpr handle_type invalid() noexcept { return -1; }
+    static void close(handle_type h) noexcept { ::close(h); }
+};
+
+// Distinct types for the fd flavours, so an epoll fd is not passed where a socket is expected
+struct socket_traits : fd_traits {};
+struct epoll_traits : fd_traits {};
+struct eventfd_traits : fd_traits {};
+struct timerfd_traits : fd_traits {};
+
+// mmap region: the length has to travel with the address for munmap
+struct mapped_region
+{
+    void* pData = MAP_FAILED;
+    std::size_t nSize = 0;
+
+    friend bool operator==(mapped_region const& lhs, mapped_region const& rhs) noexcept
+    {
+        return lhs.pData == rhs.pData && lhs.nSize == rhs.nSize;
+    }
+    friend bool operator!=(mapped_region const& lhs, mapped_region const& rhs) noexcept
+    {
+        return !(lhs == rhs);
+    }
+};
+
+struct mapped_region_traits
+{
+    using handle_type = mapped_region;
+    static handle_type invalid() noexcept { return mapped_region{}; }
+    static void close(handle_type h) noexcept { munmap(h.pData, h.nSize); }
+};
+
+using unique_fd = unique_handle<fd_traits>;
+using unique_epoll = unique_handle<epoll_traits>;
+using unique_eventfd = unique_handle<eventfd_traits>;
+using unique_timerfd = unique_handle<timerfd_traits>;
+using unique_mapping = unique_handle<mapped_region_traits>;
+
+#endif
+
+using unique_socket = unique_handle<socket_traits>;
+using unique_addrinfo = unique_handle<addrinfo_traits>;
@@ -1,31 +1,27 @@
 #pragma once
 
+#include "async_log.h"
+
 #include <iostream>
 #include <memory>
-#include <functional>
 #include <string>
 #include <chrono>
+#include <utility>
 
-/****************
- * print_stream *
- ****************/
-
-template<typename T, typename...Ts>
-void print_stream(T& stream, Ts&&...args)
-{
-    (stream << ... << std::forward<Ts>(args)) << std::endl;
-}
+/*************
+ * print_std *
+ *************/
 
 template<typename...Ts>
 void print_std(Ts&&...args)
 {
-    print_stream(std::cout, std::forward<Ts>(args) ...);
+    log_write<log_level::info>(log_sink::out, std::forward<Ts>(args) ...);
 }
 
 template<typename...Ts>
 void print_err(Ts&&...args)
 {
-    print_stream(std::cerr, std::forward<Ts>(args) ...);
+    log_write<log_level::error>(log_sink::err, std::forward<Ts>(args) ...);
 }
 
 template<typename...Ts>
@@ -36,33 +32,6 @@ int print_error(int error_number, Ts&&...args)
 }
 
 
-/********************
- * createRaiiObject *
- ********************/
-
-template<typename T>
-auto createRaiiObject(std::function<bool(T*)> initializer, std::function<void(T*)> deinitializer)
-{
-    return std::unique_ptr<T, std::function<void(T*)>>
-            {
-                    [initializer]() -> T*
-                    {
-                        auto ptr = new T{};
-                        if (ptr && initializer(ptr))
-                            return ptr;
-                        return nullptr;
-                    } ()
-                    , [deinitializer](T* ptr)
-                    {
-                        if (ptr)
-                        {
-                            deinitializer(ptr);
-                            delete ptr;
-                        }
-                    }
-            };
-}
-
 /***************
  * from_string *
  ***************/
@@ -97,6 +66,31 @@ T from_string(std::string const& str)
     return text<T>::from_string(str);
 }
 
+/*************
+ * ScopeExit *
+ *************/
+
+// Calls func when the scope is left, early returns included
+template<typename TFunc>
+class ScopeExit
+{
+public:
+    explicit ScopeExit(TFunc func) noexcept
+        : m_func{ std::move(func) }
+    {}
+
+    ScopeExit(ScopeExit const&) = delete;
+    ScopeExit& operator=(ScopeExit const&) = delete;
+
+    ~ScopeExit()
+    {
+        m_func();
+    }
+
+private:
+    TFunc m_func;
+};
+
 /*****************
  * exec_duration *
  *****************/
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace detail_xxh64
+{
+    constexpr std::uint64_t P1 = 11400714785074694791ull;
+    constexpr std::uint64_t P2 = 14029467366897019727ull;
+    constexpr std::uint64_t P3 = 1609587929392839161ull;
+    constexpr std::uint64_t P4 = 9650029242287828579ull;
+    constexpr std::uint64_t P5 = 2870177450012600261ull;
+
+    inline std::uint64_t rotl(std::uint64_t x, int k) noexcept
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    inline std::uint64_t load64(unsigned char const* p) noexcept
+    {
+        auto n = std::uint64_t{};
+        std::memcpy(&n, p, sizeof(n));
+        return n;
+    }
+
+    inline std::uint32_t load32(unsigned char const* p) noexcept
+    {
+        auto n = std::uint32_t{};
+        std::memcpy(&n, p, sizeof(n));
+        return n;
+    }
+
+    inline std::uint64_t round(std::uint64_t nAcc, std::uint64_t nInput) noexcept
+    {
+        return rotl(nAcc + nInput * P2, 31) * P1;
+    }
+
+    inline std::uint64_t merge(std::uint64_t nHash, std::uint64_t nAcc) noexcept
+    {
+        return (nHash ^ round(0, nAcc)) * P1 + P4;
+    }
+}
+
+// XXH64 of a buffer, little endian
+inline std::uint64_t xxh64(void const* pData, std::size_t nSize, std::uint64_t nSeed) noexcept
+{
+    using namespace detail_xxh64;
+
+    auto p = static_cast<unsigned char const*>(pData);
+    auto const pEnd = p + nSize;
+    auto nHash = std::uint64_t{};
+
+    if (nSize >= 32)
+    {
+        auto v1 = nSeed + P1 + P2;
+        auto v2 = nSeed + P2;
+        auto v3 = nSeed;
+        auto v4 = nSeed - P1;
+        for (; pEnd - p >= 32; p += 32)
+        {
+            v1 = round(v1, load64(p));
+            v2 = round(v2, load64(p + 8));
+            v3 = round(v3, load64(p + 16));
+            v4 = round(v4, load64(p + 24));
+        }
+        nHash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        nHash = merge(nHash, v1);
+        nHash = merge(nHash, v2);
+        nHash = merge(nHash, v3);
+        nHash = merge(nHash, v4);
+    }
+    else
+    {
+        nHash = nSeed + P5;
+    }
+
+    nHash += nSize;
+    for (; pEnd - p >= 8; p += 8)
+        nHash = rotl(nHash ^ round(0, load64(p)), 27) * P1 + P4;
+    if (pEnd - p >= 4)
+    {
+        nHash = rotl(nHash ^ (load32(p) * P1), 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < pEnd; ++p)
+        nHash = rotl(nHash ^ (*p * P5), 11) * P1;
+
+    nHash ^= nHash >> 33;
+    nHash *= P2;
+    nHash ^= nHash >> 29;
+    nHash *= P3;
+    nHash ^= nHash >> 32;
+    return nHash;
+}
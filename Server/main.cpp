@@ -1,4 +1,14 @@
 #include <os2var2_common.h>
+#include <buffer_pool.h>
+#include <chunk_store.h>
+#include <compression.h>
+#include <crc32c.h>
+#include <delta.h>
+#include <disk_writer.h>
+#include <mapped_file.h>
+#include <payload.h>
+#include <resume_journal.h>
+#include <statistics.h>
 #include <utils.h>
 
 
@@ -34,18 +44,11 @@ struct ServerConfig
     {
         auto bResult = true;
 
-        auto configFile = std::ifstream{ configName };
-        bResult &= configFile.is_open();
+        auto serverConfigJson = nlohmann::json{};
+        bResult &= parse_mapped_file(configName, serverConfigJson);
         if (bResult)
         {
-            auto serverConfigJson = nlohmann::json{};
-            configFile >> serverConfigJson;
-
-            bResult &= !configFile.fail();
-
-            bResult &= JSON_GET_AND_PARSE(serverConfigJson, server_port         , is_string);
-            bResult &= JSON_GET_AND_PARSE(serverConfigJson, apply_socket_timeout, is_boolean);
-            bResult &= JSON_GET_AND_PARSE(serverConfigJson, apply_select_timeout, is_boolean);
+            bResult &= codec_from_json(serverConfigJson, *this);
         }
 
         return bResult;
@@ -53,158 +56,181 @@ struct ServerConfig
 
     bool serialize(std::string const& configName)
     {
-        auto bResult = true;
-
-        auto confgFile = std::ofstream{ configName };
-
-        bResult &= confgFile.is_open();
-
-        if (bResult)
-        {
-            confgFile << nlohmann::json
-                {
-                    {"server_port"          , server_port         },
-                    {"apply_socket_timeout" , apply_socket_timeout},
-                    {"apply_select_timeout" , apply_select_timeout}
-                };
-        }
-
-        return bResult;
+        return dump_json_file(configName, codec_to_json(*this));
     }
 
-    std::string server_port;
-    bool        apply_socket_timeout;
-    bool        apply_select_timeout;
+    std::string   server_port;
+    bool          apply_socket_timeout;
+    bool          apply_select_timeout;
+    std::uint32_t number_of_sessions = 1;   // optional, 0 keeps accepting until the process is stopped
+    bool          stream_samples = false;   // optional, every sample is appended to <file_name>.samples.cbor
+    bool          huge_pages = false;       // optional, back the receive buffer pool with huge pages
+    std::uint32_t writer_threads = 2;       // optional, threads writing out_ files behind the transfers
+    bool          direct_io = false;        // optional, unbuffered out_ file writes
+    std::uint32_t sync_batch = 0;           // optional, fdatasync out_ files in batches of this many, 0 never
+    std::string   dedup_store;              // optional, directory of a chunk store; out_ files become manifests in it
+    std::string   psk;                      // optional, 64 hex digits shared with the clients, sessions are encrypted
+
+    static constexpr auto fields()
+    {
+        return std::make_tuple(
+                codec_field   ("server_port"         , &ServerConfig::server_port         ),
+                codec_field   ("apply_socket_timeout", &ServerConfig::apply_socket_timeout),
+                codec_field   ("apply_select_timeout", &ServerConfig::apply_select_timeout),
+                codec_optional("number_of_sessions"  , &ServerConfig::number_of_sessions  ),
+                codec_optional("stream_samples"      , &ServerConfig::stream_samples      ),
+                codec_optional("huge_pages"          , &ServerConfig::huge_pages          ),
+                codec_optional("writer_threads"      , &ServerConfig::writer_threads      ),
+                codec_optional("direct_io"           , &ServerConfig::direct_io           ),
+                codec_optional("sync_batch"          , &ServerConfig::sync_batch          ),
+                codec_optional("dedup_store"         , &ServerConfig::dedup_store         ),
+                codec_optional("psk"                 , &ServerConfig::psk                 ));
+    }
 };
 
 struct TimeData
 {
     std::uint32_t timeout;
-    std::int64_t recv_time;
+    RunningStats recv_time;
+    RunningStats codec_time;          // compressed files only
+    RunningStats compression_ratio;   // wire bytes / file bytes
+    RunningStats crypto_time;         // encrypted sessions only, not part of recv_time
 };
 
-int main(int argc, char** argv)
+int run_session(ServerConfig const& serverConfig, Connection& connection, BufferPool& bufferPool, DiskWriterPool& diskWriter)
 {
-    auto const serverConfig = []()
-    {
-        auto const configName = std::string{"config_server.json"};
+    // Received files land in pool chunks, which are handed on to the disk writer
+    auto buffer = BufferChain{};
+    auto const writeGroup = std::make_shared<DiskWriteGroup>();
 
-        auto config = std::optional<ServerConfig>{ ServerConfig{} };
-        if (!config->deserialize(configName)) {
-            config->server_port = "9999";
-            config->apply_socket_timeout = true;
-            config->apply_select_timeout = true;
-            config->serialize(configName);
+    auto nRecvCounter = std::uint32_t{ 0 };
+    auto nSendCounter = std::uint32_t{ 0 };
 
-            print_std("Generated default config: ", configName);
-            config = std::nullopt;
+    // Everything after the salts, the handshake included, travels in records
+    if (!serverConfig.psk.empty())
+    {
+        auto psk = ChaCha20Poly1305::Key{};
+        if (!parse_psk(serverConfig.psk, psk) || !secure_connection(connection, psk, false)) {
+            print_err("Failed to set up encryption: ", WSAGetLastError());
+            return 1;
         }
+    }
 
-        return config;
-    } ();
-
-    if(!serverConfig.has_value())
-        return 0;
-
-    // Initialize Winsock
-    auto const wsaData = createWSADataRaii();
-    if (!wsaData) {
-        print_err("WSAStartup failed");
+    auto fileProcessConfig = FileProcessConfig{};
+    if (!recv_file_process_config(connection, fileProcessConfig)) {
+        print_err("Failed to receive file process config: ", WSAGetLastError());
         return 1;
     }
 
-    print_std("using config:");
-    print_std("server_port:        ", serverConfig->server_port);
+    // The client may override the wait strategy per session (sweep mode)
+    auto const bApplySocketTimeout = fileProcessConfig.apply_socket_timeout.value_or(serverConfig.apply_socket_timeout);
+    auto const bApplySelectTimeout = fileProcessConfig.apply_select_timeout.value_or(serverConfig.apply_select_timeout);
 
-    auto const hints = []()
-    {
-        auto _hints = addrinfo{};
-        ZeroMemory(&_hints, sizeof(_hints));
-        _hints.ai_family = AF_INET;
-        _hints.ai_socktype = SOCK_STREAM;
-        _hints.ai_protocol = IPPROTO_TCP;
-        _hints.ai_flags = AI_PASSIVE;
-
-        return _hints;
-    } ();
-
-    // Resolve the server address and port
-    auto const clientAddrinfo = getaddrinfoRaii(nullptr, serverConfig->server_port.c_str(), &hints);
-    if (!clientAddrinfo) {
-        print_err("getaddrinfo failed");
+    // Generated payloads are compared chunk by chunk as they arrive and never written
+    auto payloadKind = PayloadKind::file;
+    if (!payload_kind(fileProcessConfig.payload, payloadKind)) {
+        print_err("Unknown payload: ", fileProcessConfig.payload);
         return 1;
     }
 
-    // Create a SOCKET for connecting to server
-    auto ListenSocket = createSocketRaii(clientAddrinfo->ai_family, clientAddrinfo->ai_socktype, clientAddrinfo->ai_protocol);
-    if (!ListenSocket) {
-        print_err("Failed to create listen socket: ", WSAGetLastError());
-        return 1;
+    auto verifier = std::optional<PayloadVerifier>{};
+    if (payloadKind != PayloadKind::file)
+    {
+        verifier.emplace(bufferPool, PayloadGenerator{ payloadKind, fileProcessConfig.payload_seed, fileProcessConfig.payload_pattern });
     }
+    auto nMismatchedFiles = std::uint32_t{ 0 };
+    auto nCorruptFiles = std::uint32_t{ 0 };
 
+    // Resumable sessions keep their progress in <file_name>.<transfer_id>.resume
+    auto journal = std::optional<ResumeJournal>{};
+    auto bInterrupted = false;
+    if (!fileProcessConfig.transfer_id.empty())
     {
-        // Setup the TCP listening socket
-        auto const iResult = bind(*ListenSocket, clientAddrinfo->ai_addr, (int)clientAddrinfo->ai_addrlen);
-        if (iResult == SOCKET_ERROR) {
-            print_err("Failed to bind listen socket with error: ", WSAGetLastError());
+        if (!is_valid_transfer_id(fileProcessConfig.transfer_id)) {
+            print_err("Invalid transfer id: ", fileProcessConfig.transfer_id);
+            return 1;
+        }
+        if (verifier) {
+            print_err("Generated payloads cannot be resumed");
             return 1;
         }
-    }
 
-    {
-        auto const iResult = listen(*ListenSocket, SOMAXCONN);
-        if (iResult == SOCKET_ERROR) {
-            print_err("listen failed with error: ", WSAGetLastError());
+        journal.emplace();
+        journal->load(fileProcessConfig.file_name + "."s + fileProcessConfig.transfer_id + ".resume"s);
+
+        connection.send_val(journal->try_index());
+        connection.send_val(journal->file_index());
+        if (connection.is_socket_error()) {
+            print_err("Failed to send resume point: ", WSAGetLastError());
             return 1;
         }
+        if (journal->try_index() > 0 || journal->file_index() > 0)
+            print_std(":: resuming ", fileProcessConfig.transfer_id, " at try: ", journal->try_index(), ", file: ", journal->file_index());
     }
-
-    // Waiting for client and Accept socket
-    auto connection = Connection{};
-    connection.setSocket(accept(*ListenSocket, nullptr, nullptr));
-    if (connection.is_socket_error()) {
-        print_err("accept failed with error: ", WSAGetLastError());
+    if (fileProcessConfig.delta && (verifier || journal)) {
+        print_err("Delta transfers cannot be combined with generated payloads or transfer_id");
+        return 1;
+    }
+    if (fileProcessConfig.compression && (journal || fileProcessConfig.delta)) {
+        print_err("Compression cannot be combined with transfer_id or delta transfers");
         return 1;
     }
 
-    // No longer need server socket
-    ListenSocket.reset();
-
-    // Buffer for Recieving/Sending data
-    auto constexpr nBufferSize{ 1024u };
-    auto buffer = std::vector<char>(nBufferSize);
+    // Compressed files are expanded on their own thread behind the receive loop
+    auto decompressor = std::optional<DecompressStage>{};
+    if (fileProcessConfig.compression)
+        decompressor.emplace();
 
-    auto nRecvCounter = std::uint32_t{ 0 };
-    auto nSendCounter = std::uint32_t{ 0 };
+    // Delta transfers land here and are applied to the previous out_ file into buffer
+    auto deltaBuffer = BufferChain{};
 
-    auto const fileProcessConfig = [&]()
-    {
-        auto _fileProcessConfig = FileProcessConfig{};
+    auto const nResumeTry = journal ? journal->try_index() : std::uint32_t{ 0 };
+    auto const nResumeFile = journal ? journal->file_index() : std::uint32_t{ 0 };
 
-        auto const nSize = connection.recv_val<std::uint32_t>();
-        connection.recv(buffer.data(), nSize);
+    auto timeData = std::vector<TimeData>{};
+    timeData.resize(fileProcessConfig.timeouts);
 
-        auto jsonFileProcessConfig = nlohmann::json::parse(buffer.begin(), std::next(buffer.begin(), nSize));
-        JSON_GET_AND_PARSE_MEMBER(jsonFileProcessConfig, _fileProcessConfig, timeouts, is_number_unsigned);
-        JSON_GET_AND_PARSE_MEMBER(jsonFileProcessConfig, _fileProcessConfig, package_size, is_number_unsigned);
-        JSON_GET_AND_PARSE_MEMBER(jsonFileProcessConfig, _fileProcessConfig, file_name, is_string);
+    // Raw samples go to disk as they arrive, [try, file, timeout, recv_time] per record
+    auto samplesFile = std::ofstream{};
+    auto samplesWriter = std::optional<nlohmann::json::binary_stream_writer<char>>{};
+    if (serverConfig.stream_samples)
+    {
+        auto const strSamplesName = fileProcessConfig.file_name + ".samples.cbor"s;
+        samplesFile.open(strSamplesName, std::ios::binary | std::ios::out);
+        if (!samplesFile) {
+            print_err("Failed to open file ", strSamplesName);
+            return 1;
+        }
 
-        return _fileProcessConfig;
-    } ();
+        // the number of tries is open-ended with target_ci, so the outer array has no length
+        samplesWriter.emplace(nlohmann::detail::output_adapter<char>(samplesFile), nlohmann::json::input_format_t::cbor);
+        samplesWriter->begin_array();
+    }
 
-    auto timeData = std::vector<TimeData>{};
-    timeData.resize(fileProcessConfig.timeouts);
+    // Every way out of the session closes the array, or the file would not be valid CBOR
+    auto const closeSamples = ScopeExit{ [&]()
+    {
+        if (samplesWriter)
+        {
+            samplesWriter->end_array();
+            samplesWriter->flush();
+        }
+    } };
 
     auto const defaultRecvTime = static_cast<int>( std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::seconds{30}).count() );
 
-//    connection.setsockopt(SOL_SOCKET, SO_RCVBUF, static_cast<int>(fileProcessConfig.package_size));
+    if (fileProcessConfig.buffer_size)
+    {
+        connection.setsockopt(SOL_SOCKET, SO_RCVBUF, static_cast<int>(fileProcessConfig.buffer_size));
+    }
 
     auto const nTries = connection.recv_val<std::uint32_t>();
-    for(int nTry = 0; nTry < nTries; ++nTry)
+    for(int nTry = static_cast<int>(nResumeTry); nTry < nTries; ++nTry)
     {
-        auto itTimeData = timeData.begin();
+        auto const nFirstFile = std::size_t{ nTry == static_cast<int>(nResumeTry) ? nResumeFile : 0u };
+        auto itTimeData = std::next(timeData.begin(), static_cast<std::ptrdiff_t>(std::min<std::size_t>(nFirstFile, timeData.size())));
 
-        for (std::size_t i{ 0 }; i < fileProcessConfig.timeouts; ++i)
+        for (std::size_t i{ nFirstFile }; i < fileProcessConfig.timeouts; ++i)
         {
             auto const nTimeout = connection.recv_val<std::uint32_t>();
 
@@ -217,36 +243,155 @@ int main(int argc, char** argv)
             } ();
 
             auto const nFileSize = connection.recv_val<std::int64_t>();
-            if(connection.is_socket_error())
+            if(connection.is_socket_error() || connection.is_closed())
             {
+                bInterrupted = true;
                 break;
             }
 
-            buffer.resize(nFileSize);
+            if (nFileSize < 0 || (!verifier && !buffer.assign(bufferPool, nFileSize)))
+            {
+                print_err("Unexpected file size: ", nFileSize);
+                return 1;
+            }
+            if (verifier)
+                verifier->start(nFileSize);
+
+            // The client flags every file it sends as frames
+            auto const bCompressed = decompressor && connection.recv_val<std::uint8_t>(MSG_WAITALL) != 0;
+            if (decompressor && connection.getResult() != static_cast<int>(sizeof(std::uint8_t)))
+            {
+                bInterrupted = true;
+                break;
+            }
+            // The client's digest covers the file itself, so it is checked against the
+            // rebuilt bytes: decoded, delta applied, resumed parts included
+            auto crc = Crc32c{};
+            auto nDigested = std::int64_t{ 0 };
+            auto const digestSpans = [&](auto&& spanAt, std::int64_t nDone)
+            {
+                while (fileProcessConfig.digest && nDigested < nDone)
+                {
+                    auto const span = spanAt(nDigested);
+                    auto const nBytes = std::min(span.second, nDone - nDigested);
+                    crc.update(span.first, static_cast<std::size_t>(nBytes));
+                    nDigested += nBytes;
+                }
+            };
+
+            if (bCompressed)
+            {
+                // Decoded bytes are hashed on the decoder thread while they are in cache
+                if (verifier)
+                    decompressor->start(nFileSize, [&](std::int64_t nOffset) { return verifier->span_at(nOffset); },
+                                        [&](std::int64_t nDone)
+                                        {
+                                            digestSpans([&](std::int64_t nOffset) { return verifier->span_at(nOffset); }, nDone);
+                                            verifier->commit(nDone);
+                                        });
+                else
+                    decompressor->start(nFileSize, [&](std::int64_t nOffset) { return buffer.span_at(nOffset); },
+                                        [&](std::int64_t nDone) { digestSpans([&](std::int64_t nOffset) { return buffer.span_at(nOffset); }, nDone); });
+            }
 
             itTimeData->timeout = nTimeout;
 
             auto const strOutFileName = "out_"s + std::to_string(i) + "_"s + fileProcessConfig.file_name;
+            auto const strPartFileName = strOutFileName + ".part"s;
+
+            // Only the ranges the journal does not have are sent, back to back
+            auto ranges = journal ? journal->missing(static_cast<std::uint32_t>(nTry), static_cast<std::uint32_t>(i), nFileSize) : ByteRanges{ nFileSize };
+            if (journal)
+            {
+                if (!ranges.send(connection)) {
+                    print_err("Failed to send missing ranges: ", WSAGetLastError());
+                    bInterrupted = true;
+                    break;
+                }
+                if (!journal->has_progress())
+                    std::remove(strPartFileName.c_str());
+                else
+                    print_std(":: resuming file, ", ranges.total(), " of ", nFileSize, " bytes missing");
+            }
+
+            // The previous out_ file is signed block by block, the client answers with
+            // the size of its delta against it, or -1 to send the file as is
+            auto basis = MappedFile{};
+            auto nBlockSize = std::uint32_t{ 0 };
+            if (fileProcessConfig.delta)
+            {
+                // The last write of this out_ file may still be queued; chunk store
+                // out_ files are manifests, not content, and are never a basis
+                auto signatures = DeltaSignatures{};
+                if (serverConfig.dedup_store.empty() && writeGroup->wait() == 0 && basis.open(strOutFileName))
+                    signatures.compute(basis.data(), static_cast<std::int64_t>(basis.size()));
+                nBlockSize = signatures.block_size();
+
+                auto const nDeltaSize = signatures.send(connection) ? connection.recv_val<std::int64_t>(MSG_WAITALL) : std::int64_t{ 0 };
+                if (connection.getResult() != static_cast<int>(sizeof(nDeltaSize))) {
+                    print_err("Failed to exchange block signatures: ", WSAGetLastError());
+                    bInterrupted = true;
+                    break;
+                }
+
+                // Records add at most 14 bytes per block to the file's size
+                if (nDeltaSize > 2 * nFileSize + 64 || (nDeltaSize >= 0 && signatures.empty())) {
+                    print_err("Unexpected delta of ", nDeltaSize, " bytes for a file of ", nFileSize, " bytes");
+                    return 1;
+                }
+
+                if (nDeltaSize >= 0)
+                {
+                    deltaBuffer.assign(bufferPool, nDeltaSize);
+                    ranges = ByteRanges{ nDeltaSize };
+                    print_std(":: delta: ", nDeltaSize, " of ", nFileSize, " bytes to receive");
+                }
+                else
+                {
+                    basis.close();
+                }
+            }
+            auto& target = basis ? deltaBuffer : buffer;
+
+            // Received bytes are the file itself only when it comes whole, front to back, as is
+            auto const bStreamDigest = !bCompressed && !basis && ranges.total() == nFileSize;
+            auto nDigest = std::uint32_t{ 0 };
+            auto bIntact = true;
 
             print_std(":: try: ", nTry, ", file: ", std::to_string(i), " - ", strOutFileName, ", file size: ",  nFileSize, " bytes", ", timeout: ", nTimeout);
 
+            auto nRecvTime = std::int64_t{ 0 };
 
             {
-                if(serverConfig->apply_socket_timeout)
+                if(bApplySocketTimeout)
                 {
                     connection.setsockopt(SOL_SOCKET, SO_RCVTIMEO, static_cast<int>(nTimeout));
                 }
 
                 auto nCurFileSize = std::int64_t{ 0 };
 
-                itTimeData->recv_time += exec_duration_windows<std::chrono::microseconds>(
+                // Whole chunks received before a drop go to the partial file for the next connection
+                auto const keepPartial = [&]()
+                {
+                    bInterrupted = true;
+                    if (!journal)
+                        return;
+
+                    auto const done = journal->mark(ranges.prefix(nCurFileSize));
+                    if (!write_ranges(strPartFileName, buffer, done) || !journal->save())
+                        print_err("Failed to save resume state for ", strOutFileName);
+                };
+
+                auto const nCryptoTimeBefore = connection.crypto_time();
+                nRecvTime = exec_duration_windows<std::chrono::microseconds>(
                         [&]()
                         {
-                            while (nCurFileSize < nFileSize)
+                            while (bCompressed ? !decompressor->received_all() : nCurFileSize < ranges.total())
                             {
                                 auto const iRet = [&]()
                                 {
-                                    if(serverConfig->apply_select_timeout)
+                                    // Bytes already decrypted would never wake select
+                                    if(bApplySelectTimeout && !connection.has_pending())
                                     {
                                         fd_set fdRead;
                                         FD_ZERO(&fdRead);
@@ -262,19 +407,44 @@ int main(int argc, char** argv)
 
                                 if(iRet > 0)
                                 {
-                                    auto const nPackageSize = std::min<std::int64_t>(fileProcessConfig.package_size, nFileSize - nCurFileSize);
+                                    auto const span = [&]()
+                                    {
+                                        if (bCompressed)
+                                            return decompressor->recv_span();
+
+                                        auto const location = ranges.locate(nCurFileSize);
+                                        auto const _span = verifier ? verifier->span_at(location.first) : target.span_at(location.first);
+                                        return std::make_pair(_span.first, std::min(_span.second, location.second));
+                                    } ();
+                                    auto const nPackageSize = std::min<std::int64_t>(fileProcessConfig.package_size, span.second);
 
-                                    connection.recv(buffer.data() + nCurFileSize, nPackageSize);
+                                    connection.recv(span.first, static_cast<int>(nPackageSize));
 
-                                    if(!connection.is_socket_error())
+                                    if(connection.getResult() > 0)
                                     {
 //                                    print_std(":: !! recv: ", connection.getResult(), ", size: ", nCurFileSize);
+                                        // Hashed while the package is still in cache
+                                        if (fileProcessConfig.digest && bStreamDigest)
+                                            crc.update(span.first, static_cast<std::size_t>(connection.getResult()));
                                         nCurFileSize += connection.getResult();
+                                        if (bCompressed)
+                                        {
+                                            if (!decompressor->received(connection.getResult()))
+                                                break;
+                                        }
+                                        else if (verifier)
+                                        {
+                                            verifier->commit(nCurFileSize);
+                                        }
                                     }
                                     else
                                     {
 //                                    print_std(":: ?? error");
-                                        print_err(":: connection.getResult(): ", connection.getResult(), " : ", WSAGetLastError());
+                                        // A closed connection is a drop too, or the loop would spin on it
+                                        if (connection.is_closed())
+                                            print_err(":: connection closed by the client");
+                                        else
+                                            print_err(":: connection.getResult(): ", connection.getResult(), " : ", WSAGetLastError());
                                         break;
                                     }
                                 }
@@ -285,19 +455,68 @@ int main(int argc, char** argv)
                             }
                         }).count();
 
-                if(serverConfig->apply_socket_timeout && !connection.is_socket_error())
+                // Decrypting is measured on its own, recv_time stays comparable with plaintext runs
+                auto const nCryptoTime = connection.crypto_time() - nCryptoTimeBefore;
+                nRecvTime = std::max<std::int64_t>(nRecvTime - nCryptoTime, 0);
+                itTimeData->recv_time.push(static_cast<double>(nRecvTime));
+                if (connection.is_secure())
+                {
+                    itTimeData->crypto_time.push(static_cast<double>(nCryptoTime));
+                    print_std("-- Decryption: ", nCryptoTime, " us");
+                }
+
+                // Frames still queued are expanded outside the timed loop, before anything reads the file
+                auto const bDecoded = !bCompressed || decompressor->finish();
+                if (bCompressed)
+                {
+                    if (decompressor->malformed()) {
+                        print_err("Malformed compressed frame in ", strOutFileName);
+                        return 1;
+                    }
+
+                    itTimeData->codec_time.push(static_cast<double>(decompressor->codec_time()));
+                    itTimeData->compression_ratio.push(static_cast<double>(decompressor->wire_bytes()) / static_cast<double>(nFileSize));
+                    print_std("-- Compression: ", nFileSize, " bytes in ", decompressor->wire_bytes(), " on the wire, decoded in ", decompressor->codec_time(), " us");
+                }
+
+                if (samplesWriter)
+                {
+                    samplesWriter->begin_array(4);
+                    samplesWriter->append(nTry);
+                    samplesWriter->append(i);
+                    samplesWriter->append(nTimeout);
+                    samplesWriter->append(nRecvTime);
+                }
+
+                auto const bDropped = connection.is_socket_error() || connection.is_closed();
+                if(bApplySocketTimeout && !bDropped)
                 {
                     connection.setsockopt(SOL_SOCKET, SO_RCVTIMEO, defaultRecvTime);
                 }
 
-                if(connection.is_socket_error())
+                if(bDropped)
                 {
                     print_err("?? File not received");
+                    keepPartial();
                     break;
                 }
-                else
+
+                if (!bDecoded)
+                {
+                    print_err("?? Compressed frame does not decode");
+                    ++nCorruptFiles;
+                    bIntact = false;
+                }
+
+                if (fileProcessConfig.digest)
                 {
-                    print_std("!! File received successfully");
+                    // The trailer is read outside the timed loop, and checked once the file is rebuilt
+                    nDigest = connection.recv_val<std::uint32_t>(MSG_WAITALL);
+                    if (connection.getResult() != static_cast<int>(sizeof(nDigest))) {
+                        print_err("?? File digest not received: ", WSAGetLastError());
+                        keepPartial();
+                        break;
+                    }
                 }
 
                 print_std("-- Recieved: ", nCurFileSize, " bytes");
@@ -305,37 +524,167 @@ int main(int argc, char** argv)
                 print_std();
             }
 
+            if (basis)
             {
-                auto fout = std::ofstream{ strOutFileName, std::ios::binary | std::ios::out };
-                if (!fout) {
-                    print_err("Failed to open file ", strOutFileName);
+                // Rebuilt outside the timed loop; the mapping has to go before the writer replaces the file
+                auto const bApplied = delta_apply(deltaBuffer, basis.data(), static_cast<std::int64_t>(basis.size()), nBlockSize, buffer);
+                basis.close();
+                if (!bApplied)
+                {
+                    print_err("?? Delta does not apply to ", strOutFileName);
+                    ++nCorruptFiles;
+                    bIntact = false;
+                }
+                else
+                {
+                    digestSpans([&](std::int64_t nOffset) { return buffer.span_at(nOffset); }, nFileSize);
+                }
+            }
+
+            if (verifier)
+            {
+                if (verifier->mismatch() >= 0)
+                {
+                    print_err("?? Payload mismatch at byte ", verifier->mismatch());
+                    ++nMismatchedFiles;
+                }
+                else if (verifier->complete())
+                {
+                    print_std("!! Payload verified");
+                }
+            }
+            else if (journal && journal->has_progress())
+            {
+                // The rest of the file is already in the partial file from earlier connections
+                std::remove(strOutFileName.c_str());
+                if (!write_ranges(strPartFileName, buffer, ranges) || std::rename(strPartFileName.c_str(), strOutFileName.c_str()) != 0) {
+                    print_err("Failed to complete resumed file ", strOutFileName);
                     return 1;
                 }
 
-                fout.write(buffer.data(), nFileSize);
+                // Earlier connections' bytes are only on disk
+                if (fileProcessConfig.digest && !bStreamDigest && nFileSize > 0)
+                {
+                    auto resumed = MappedFile{};
+                    if (!resumed.open(strOutFileName) || static_cast<std::int64_t>(resumed.size()) != nFileSize) {
+                        print_err("Failed to read back resumed file ", strOutFileName);
+                        return 1;
+                    }
+                    digestSpans([&](std::int64_t nOffset) { return std::make_pair(resumed.data() + nOffset, nFileSize - nOffset); }, nFileSize);
+                }
+            }
+            else
+            {
+                // Hashed before the chunks go to the writer
+                if (!bStreamDigest)
+                    digestSpans([&](std::int64_t nOffset) { return buffer.span_at(nOffset); }, nFileSize);
+
+                // Written behind the next transfers, the session only waits for it at the end
+                diskWriter.submit(strOutFileName, std::exchange(buffer, BufferChain{}), writeGroup);
+            }
+
+            // Only a file that decoded and applied is reported, and only after its digest matches
+            if (bIntact && !fileProcessConfig.digest)
+            {
+                print_std("!! File received successfully");
+            }
+            else if (bIntact && nDigest != crc.value())
+            {
+                print_err("?? File corrupt, digest ", nDigest, " != ", crc.value());
+                ++nCorruptFiles;
+            }
+            else if (bIntact)
+            {
+                print_std("!! File received successfully, digest verified");
+            }
+
+            if (journal)
+            {
+                auto const bLastFile = i + 1 == fileProcessConfig.timeouts;
+                journal->advance(static_cast<std::uint32_t>(bLastFile ? nTry + 1 : nTry), static_cast<std::uint32_t>(bLastFile ? 0 : i + 1));
+                if (!journal->save())
+                    print_err("Failed to save resume state for ", fileProcessConfig.transfer_id);
+            }
+
+            if (fileProcessConfig.report_times)
+            {
+                connection.send_val(nRecvTime);
             }
 
             ++itTimeData;
         }
+
+        // The client reconnects and resumes, the rest of this connection is gone
+        if (journal && bInterrupted)
+            break;
+
+        if (fileProcessConfig.target_ci > 0.0)
+        {
+            auto const bStop = std::all_of(timeData.cbegin(), timeData.cend(), [&](auto const& td)
+            {
+                return td.recv_time.is_precise(fileProcessConfig.target_ci, 0.95, fileProcessConfig.min_tries);
+            });
+
+            connection.send_val(static_cast<std::uint8_t>(bStop));
+            if (bStop)
+            {
+                print_std(":: confidence target reached after ", nTry + 1, " tries");
+                break;
+            }
+        }
+    }
+
+    if (journal && !bInterrupted)
+        journal->remove();
+
+    if (auto const nFailed = writeGroup->wait(); nFailed > 0)
+    {
+        print_err("Failed to write ", nFailed, " output files");
+        return 1;
     }
 
+    if (nMismatchedFiles > 0)
+    {
+        print_err("Payload mismatch in ", nMismatchedFiles, " files");
+        return 1;
+    }
+
+    if (nCorruptFiles > 0)
+    {
+        print_err("Digest mismatch in ", nCorruptFiles, " files");
+        return 1;
+    }
 
     {
         auto fout = std::ofstream{fileProcessConfig.file_name + ".csv"s};
 
-        std::for_each(timeData.cbegin(), std::prev(timeData.cend()), [&](auto const& td)
+        auto const writeRow = [&](auto const& value)
         {
-            fout << td.timeout << ",";
-        });
-        fout << timeData.back().timeout << std::endl;
+            std::for_each(timeData.cbegin(), std::prev(timeData.cend()), [&](auto const& td)
+            {
+                fout << value(td) << ",";
+            });
+            fout << value(timeData.back()) << std::endl;
+        };
+
+        writeRow([](TimeData const& td) { return td.timeout; });
+        writeRow([](TimeData const& td) { return static_cast<std::int64_t>(td.recv_time.mean()); });
+        writeRow([](TimeData const& td) { return td.recv_time.stddev(); });
+        writeRow([](TimeData const& td) { return td.recv_time.ci_half_width(0.95); });
+        writeRow([](TimeData const& td) { return td.recv_time.min(); });
+        writeRow([](TimeData const& td) { return td.recv_time.max(); });
+        writeRow([](TimeData const& td) { return td.recv_time.count(); });
+
+        if (fileProcessConfig.compression)
+        {
+            writeRow([](TimeData const& td) { return static_cast<std::int64_t>(td.codec_time.mean()); });
+            writeRow([](TimeData const& td) { return td.compression_ratio.mean(); });
+        }
 
-        std::for_each(timeData.begin(), std::prev(timeData.end()), [&](auto& td)
+        if (connection.is_secure())
         {
-            td.recv_time /= nTries;
-            fout << td.recv_time << ",";
-        });
-        timeData.back().recv_time /= nTries;
-        fout << timeData.back().recv_time << std::endl;
+            writeRow([](TimeData const& td) { return static_cast<std::int64_t>(td.crypto_time.mean()); });
+        }
 
     }
 
@@ -350,4 +699,150 @@ int main(int argc, char** argv)
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char** argv)
+{
+    auto const serverConfig = []()
+    {
+        auto const configName = std::string{"config_server.json"};
+
+        auto config = std::optional<ServerConfig>{ ServerConfig{} };
+        if (!config->deserialize(configName)) {
+            config->server_port = "9999";
+            config->apply_socket_timeout = true;
+            config->apply_select_timeout = true;
+            config->number_of_sessions = 1;
+            config->serialize(configName);
+
+            print_std("Generated default config: ", configName);
+            config = std::nullopt;
+        }
+
+        return config;
+    } ();
+
+    if(!serverConfig.has_value())
+        return 0;
+
+    if (auto psk = ChaCha20Poly1305::Key{}; !serverConfig->psk.empty() && !parse_psk(serverConfig->psk, psk)) {
+        print_err("psk must be 64 hex digits");
+        return 1;
+    }
+
+    // Initialize Winsock
+    auto const wsaData = createWSADataRaii();
+    if (!wsaData) {
+        print_err("WSAStartup failed");
+        return 1;
+    }
+
+    print_std("using config:");
+    print_std("server_port:        ", serverConfig->server_port);
+
+    auto const hints = []()
+    {
+        auto _hints = addrinfo{};
+        ZeroMemory(&_hints, sizeof(_hints));
+        _hints.ai_family = AF_INET;
+        _hints.ai_socktype = SOCK_STREAM;
+        _hints.ai_protocol = IPPROTO_TCP;
+        _hints.ai_flags = AI_PASSIVE;
+
+        return _hints;
+    } ();
+
+    // Resolve the server address and port
+    auto const clientAddrinfo = getaddrinfoRaii(nullptr, serverConfig->server_port.c_str(), &hints);
+    if (!clientAddrinfo) {
+        print_err("getaddrinfo failed");
+        return 1;
+    }
+
+    // Create a SOCKET for connecting to server
+    auto ListenSocket = createSocketRaii(clientAddrinfo->ai_family, clientAddrinfo->ai_socktype, clientAddrinfo->ai_protocol);
+    if (!ListenSocket) {
+        print_err("Failed to create listen socket: ", WSAGetLastError());
+        return 1;
+    }
+
+    {
+        // Setup the TCP listening socket
+        auto const iResult = bind(*ListenSocket, clientAddrinfo->ai_addr, (int)clientAddrinfo->ai_addrlen);
+        if (iResult == SOCKET_ERROR) {
+            print_err("Failed to bind listen socket with error: ", WSAGetLastError());
+            return 1;
+        }
+    }
+
+    {
+        auto const iResult = listen(*ListenSocket, SOMAXCONN);
+        if (iResult == SOCKET_ERROR) {
+            print_err("listen failed with error: ", WSAGetLastError());
+            return 1;
+        }
+    }
+
+    auto bufferPool = BufferPool{ [&]()
+    {
+        auto options = BufferPool::Options{};
+        options.bHugePages = serverConfig->huge_pages;
+        // The session thread acquires chunks, the writer threads release them
+        options.nThreads = serverConfig->writer_threads + 1;
+        return options;
+    } () };
+
+    // Repeated tries receive the same file, in the store each distinct chunk is written once
+    auto chunkStore = std::optional<ChunkStore>{};
+    if (!serverConfig->dedup_store.empty())
+    {
+        chunkStore.emplace(serverConfig->dedup_store);
+        if (!chunkStore->open()) {
+            print_err("Failed to open dedup store ", serverConfig->dedup_store);
+            return 1;
+        }
+    }
+
+    // Declared after the pool and the store: writers use both until they stop
+    auto diskWriter = DiskWriterPool{ [&]()
+    {
+        auto options = DiskWriterPool::Options{};
+        options.nThreads = serverConfig->writer_threads;
+        options.bDirectIo = serverConfig->direct_io;
+        options.nSyncBatch = serverConfig->sync_batch;
+        // Files waiting for the disk may hold twice the pool, beyond that the session waits
+        options.nQueueBytes = 2 * static_cast<std::int64_t>(bufferPool.chunk_size() * bufferPool.chunk_count());
+        options.pStore = chunkStore ? &*chunkStore : nullptr;
+        return options;
+    } () };
+
+    auto nResult = 0;
+    for (std::uint32_t nSession = 0; serverConfig->number_of_sessions == 0 || nSession < serverConfig->number_of_sessions; ++nSession)
+    {
+        // Waiting for client and Accept socket
+        auto connection = Connection{};
+        connection.setSocket(accept(*ListenSocket, nullptr, nullptr));
+        if (!connection.is_valid()) {
+            print_err("accept failed with error: ", WSAGetLastError());
+            return 1;
+        }
+
+        // No longer need server socket
+        if (nSession + 1 == serverConfig->number_of_sessions)
+            ListenSocket.reset();
+
+        // A failed session is not masked by later ones that succeed
+        if (auto const nSessionResult = run_session(*serverConfig, connection, bufferPool, diskWriter); nResult == 0)
+            nResult = nSessionResult;
+
+        if (chunkStore)
+        {
+            auto const stats = chunkStore->stats();
+            print_std("dedup store: ", stats.nNewFiles, " of ", stats.nFiles, " files, ",
+                      stats.nNewChunks, " of ", stats.nChunks, " chunks, ",
+                      stats.nNewBytes, " of ", stats.nBytes, " bytes written");
+        }
+    }
+
+    return nResult;
+}
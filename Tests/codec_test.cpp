@@ -0,0 +1,162 @@
+#include <os2var2_common.h>
+#include <sweep.h>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Round trips of a config with nested members through every codec path: JSON
+// DOM and SAX, MessagePack, CBOR and the fixed layout. A decoded value has to
+// encode back to the same JSON as the value it came from.
+
+namespace
+{
+
+struct Endpoint
+{
+    std::string   host;
+    std::uint16_t port = 0;
+
+    static constexpr auto fields()
+    {
+        return std::make_tuple(
+                codec_field   ("host", &Endpoint::host),
+                codec_optional("port", &Endpoint::port));
+    }
+};
+
+struct Limits
+{
+    std::uint32_t              max_size = 0;
+    std::optional<double>      ratio;
+    std::vector<std::string>   tags;
+    Endpoint                   fallback;
+
+    static constexpr auto fields()
+    {
+        return std::make_tuple(
+                codec_field   ("max_size", &Limits::max_size),
+                codec_optional("ratio"   , &Limits::ratio   ),
+                codec_optional("tags"    , &Limits::tags    ),
+                codec_field   ("fallback", &Limits::fallback));
+    }
+};
+
+struct Settings
+{
+    std::string                name;
+    bool                       enabled = false;
+    std::vector<std::uint32_t> sizes;
+    Limits                     limits;
+    std::vector<Endpoint>      endpoints;
+    std::optional<SweepGrid>   sweep;
+    std::int64_t               offset = 0;
+
+    static constexpr auto fields()
+    {
+        return std::make_tuple(
+                codec_field   ("name"     , &Settings::name     ),
+                codec_field   ("enabled"  , &Settings::enabled  ),
+                codec_field   ("sizes"    , &Settings::sizes    ),
+                codec_field   ("limits"   , &Settings::limits   ),
+                codec_optional("endpoints", &Settings::endpoints),
+                codec_optional("sweep"    , &Settings::sweep    ),
+                codec_optional("offset"   , &Settings::offset   ));
+    }
+};
+
+Settings make_settings()
+{
+    auto settings = Settings{};
+    settings.name = "nested";
+    settings.enabled = true;
+    settings.sizes = { 128, 4096, 65536 };
+    settings.limits.max_size = 1u << 20;
+    settings.limits.ratio = 0.25;
+    settings.limits.tags = { "a", "bc" };
+    settings.limits.fallback = Endpoint{ "backup", 778 };
+    settings.endpoints = { Endpoint{ "localhost", 777 }, Endpoint{ "127.0.0.1", 0 } };
+    settings.offset = -42;
+
+    auto sweep = SweepGrid{};
+    sweep.package_size = { 128, 1024 };
+    sweep.timeout = { 10, 20 };
+    sweep.wait_strategy = { "select", "both" };
+    sweep.seed = 7;
+    settings.sweep = sweep;
+    return settings;
+}
+
+template<typename TDecode>
+bool round_trip(char const* pName, Settings const& settings, TDecode&& decode)
+{
+    auto decoded = Settings{};
+    if (!decode(decoded)) {
+        print_err(pName, ": decoding failed");
+        return false;
+    }
+    if (codec_to_json(decoded) != codec_to_json(settings)) {
+        print_err(pName, ": decoded value differs: ", codec_to_json(decoded).dump());
+        return false;
+    }
+    return true;
+}
+
+bool sax_json(std::string const& strJson, Settings& settings)
+{
+    return codec_sax_parse({ strJson.data(), strJson.size() }, settings);
+}
+
+}   // namespace
+
+int main()
+{
+    auto const settings = make_settings();
+    auto const json = codec_to_json(settings);
+    auto const strJson = json.dump();
+    auto const msgpack = codec_to_msgpack(settings);
+    auto const cbor = codec_to_cbor(settings);
+    auto const binary = codec_to_binary(settings);
+
+    auto bResult = true;
+    bResult &= round_trip("json", settings, [&](Settings& decoded) { return codec_from_json(json, decoded); });
+    bResult &= round_trip("json sax", settings, [&](Settings& decoded) { return sax_json(strJson, decoded); });
+    bResult &= round_trip("msgpack", settings, [&](Settings& decoded) { return codec_from_msgpack(msgpack.data(), msgpack.size(), decoded); });
+    bResult &= round_trip("cbor", settings, [&](Settings& decoded) { return codec_from_cbor(cbor.data(), cbor.size(), decoded); });
+    bResult &= round_trip("binary", settings, [&](Settings& decoded) { return codec_from_binary(binary.data(), binary.size(), decoded); });
+
+    // A nested member missing a required field, or of the wrong type, fails every path like a top-level one
+    auto const rejected = [&](char const* pName, nlohmann::json const& bad)
+    {
+        auto const strBad = bad.dump();
+        auto const badMsgpack = nlohmann::json::to_msgpack(bad);
+        auto const badCbor = nlohmann::json::to_cbor(bad);
+        auto decoded = Settings{};
+        if (codec_from_json(bad, decoded) || sax_json(strBad, decoded)
+            || codec_from_msgpack(badMsgpack.data(), badMsgpack.size(), decoded)
+            || codec_from_cbor(badCbor.data(), badCbor.size(), decoded)) {
+            print_err(pName, ": accepted ", strBad);
+            return false;
+        }
+        return true;
+    };
+
+    auto missing = json;
+    missing["limits"]["fallback"].erase("host");
+    bResult &= rejected("missing nested field", missing);
+
+    auto mistyped = json;
+    mistyped["endpoints"][1]["port"] = "777";
+    bResult &= rejected("mistyped element field", mistyped);
+
+    auto notObject = json;
+    notObject["sweep"] = 5;
+    bResult &= rejected("scalar for a nested object", notObject);
+
+    if (!bResult)
+        return 1;
+
+    print_std("!! Codec round trips with nested members");
+    return 0;
+}
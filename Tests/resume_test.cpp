@@ -0,0 +1,204 @@
+#include <os2var2_common.h>
+#include <buffer_pool.h>
+#include <resume_journal.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::string_literals;
+
+// Loopback check of a resumable transfer: the sender closes the connection in
+// the middle of a file, the receiver keeps the whole chunks it has in the
+// partial file and the journal, and a second connection sends only the rest.
+
+namespace
+{
+
+constexpr auto kFileSize = std::int64_t{ 3 } * ResumeJournal::kChunkSize + ResumeJournal::kChunkSize / 2;
+constexpr auto kDropAt = std::int64_t{ 2 } * ResumeJournal::kChunkSize + ResumeJournal::kChunkSize / 2;
+constexpr auto kPackageSize = 64 * 1024;
+
+std::vector<char> make_file()
+{
+    auto file = std::vector<char>(static_cast<std::size_t>(kFileSize));
+    auto nState = std::uint32_t{ 0x9E3779B9u };
+    for (auto& c : file)
+    {
+        nState = nState * 1664525u + 1013904223u;
+        c = static_cast<char>(nState >> 24);
+    }
+    return file;
+}
+
+Connection connect_to(std::string const& strPort)
+{
+    auto connection = Connection{};
+
+    auto hints = addrinfo{};
+    ZeroMemory(&hints, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    auto const result = getaddrinfoRaii("127.0.0.1", strPort.c_str(), &hints);
+    if (!result)
+        return connection;
+
+    connection.setSocket(socket(result->ai_family, result->ai_socktype, result->ai_protocol));
+    if (connection.is_valid() && connection.connect(*result.get()) == SOCKET_ERROR)
+        connection.reset();
+    return connection;
+}
+
+// Sends the ranges the receiver asks for, and stops after nLimit bytes with a graceful close
+void send_file(std::string const& strPort, std::vector<char> const& file, std::int64_t nLimit)
+{
+    auto connection = connect_to(strPort);
+    if (!connection.is_valid())
+        return;
+
+    auto ranges = ByteRanges{};
+    if (!ranges.recv(connection, kFileSize))
+        return;
+
+    for (auto nSent = std::int64_t{ 0 }; nSent < std::min(nLimit, ranges.total()); )
+    {
+        auto const location = ranges.locate(nSent);
+        auto const nBytes = std::min({ location.second, nLimit - nSent, std::int64_t{ kPackageSize } });
+        if (connection.send(file.data() + location.first, static_cast<int>(nBytes)) <= 0)
+            return;
+        nSent += connection.getResult();
+    }
+
+    connection.shutdown(SD_SEND);
+}
+
+// The receive side of the server's file loop: a recv of 0 bytes or an error
+// ends it, and whole chunks received so far go to the partial file
+bool recv_file(Connection& connection, BufferChain& buffer, ByteRanges const& ranges, ResumeJournal& journal, std::string const& strPartFileName, bool& bDropped)
+{
+    auto nCurFileSize = std::int64_t{ 0 };
+    while (nCurFileSize < ranges.total())
+    {
+        auto const location = ranges.locate(nCurFileSize);
+        auto const span = buffer.span_at(location.first);
+        auto const nPackageSize = std::min({ span.second, location.second, std::int64_t{ kPackageSize } });
+
+        if (connection.recv(span.first, static_cast<int>(nPackageSize)) <= 0)
+            break;
+        nCurFileSize += connection.getResult();
+    }
+
+    bDropped = connection.is_socket_error() || connection.is_closed();
+    if (!bDropped)
+        return true;
+
+    auto const done = journal.mark(ranges.prefix(nCurFileSize));
+    return write_ranges(strPartFileName, buffer, done) && journal.save();
+}
+
+bool same_file(std::string const& fileName, std::vector<char> const& expected)
+{
+    auto fin = std::ifstream{ fileName, std::ios::binary };
+    auto const actual = std::vector<char>{ std::istreambuf_iterator<char>{ fin }, std::istreambuf_iterator<char>{} };
+    return actual == expected;
+}
+
+}   // namespace
+
+int main()
+{
+    auto const wsaData = createWSADataRaii();
+    if (!wsaData) {
+        print_err("WSAStartup failed");
+        return 1;
+    }
+
+    auto hints = addrinfo{};
+    ZeroMemory(&hints, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    hints.ai_flags = AI_PASSIVE;
+
+    // Any free port on the loopback interface
+    auto const listenAddrinfo = getaddrinfoRaii("127.0.0.1", "0", &hints);
+    auto const ListenSocket = listenAddrinfo ? createSocketRaii(listenAddrinfo->ai_family, listenAddrinfo->ai_socktype, listenAddrinfo->ai_protocol) : SocketRaii{};
+    auto address = sockaddr_in{};
+    auto nAddressSize = static_cast<int>(sizeof(address));
+    if (!ListenSocket
+        || bind(*ListenSocket, listenAddrinfo->ai_addr, static_cast<int>(listenAddrinfo->ai_addrlen)) == SOCKET_ERROR
+        || listen(*ListenSocket, SOMAXCONN) == SOCKET_ERROR
+        || getsockname(*ListenSocket, reinterpret_cast<sockaddr*>(&address), &nAddressSize) == SOCKET_ERROR) {
+        print_err("Failed to listen on loopback: ", WSAGetLastError());
+        return 1;
+    }
+    auto const strPort = std::to_string(ntohs(address.sin_port));
+
+    auto const file = make_file();
+    auto const strOutFileName = "out_resume_test.bin"s;
+    auto const strPartFileName = strOutFileName + ".part"s;
+    auto const strJournalName = strOutFileName + ".resume"s;
+    std::remove(strPartFileName.c_str());
+    std::remove(strJournalName.c_str());
+
+    auto bufferPool = BufferPool{ BufferPool::Options{} };
+    auto nResult = 0;
+
+    for (auto nConnection = 0; nConnection < 2 && nResult == 0; ++nConnection)
+    {
+        // The first connection is closed by the sender in the middle of the file
+        auto sender = std::thread{ send_file, strPort, std::cref(file), nConnection == 0 ? kDropAt : kFileSize };
+
+        auto connection = Connection{};
+        connection.setSocket(accept(*ListenSocket, nullptr, nullptr));
+
+        auto journal = ResumeJournal{};
+        journal.load(strJournalName);
+        auto const ranges = journal.missing(0, 0, kFileSize);
+
+        auto buffer = BufferChain{};
+        auto bDropped = false;
+        if (!connection.is_valid() || !buffer.assign(bufferPool, kFileSize) || !ranges.send(connection)
+            || !recv_file(connection, buffer, ranges, journal, strPartFileName, bDropped)) {
+            print_err("Connection ", nConnection, " failed: ", WSAGetLastError());
+            nResult = 1;
+        }
+        else if (nConnection == 0 && (!bDropped || !connection.is_closed() || !journal.has_progress())) {
+            print_err("The closed connection was not kept as a partial file");
+            nResult = 1;
+        }
+        else if (nConnection == 1 && (bDropped || ranges.total() != kFileSize - 2 * ResumeJournal::kChunkSize)) {
+            print_err("The resumed connection asked for ", ranges.total(), " bytes");
+            nResult = 1;
+        }
+        else if (nConnection == 1)
+        {
+            std::remove(strOutFileName.c_str());
+            if (!write_ranges(strPartFileName, buffer, ranges) || std::rename(strPartFileName.c_str(), strOutFileName.c_str()) != 0
+                || !same_file(strOutFileName, file)) {
+                print_err("The resumed file differs from the one sent");
+                nResult = 1;
+            }
+            journal.remove();
+        }
+
+        // A failed accept leaves the sender waiting for nothing
+        connection.reset();
+        sender.join();
+    }
+
+    std::remove(strOutFileName.c_str());
+    std::remove(strPartFileName.c_str());
+    std::remove(strJournalName.c_str());
+
+    if (nResult == 0)
+        print_std("!! Resumed after a closed connection");
+    return nResult;
+}